@@ -0,0 +1,60 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : require
+
+#include "mesh.h"
+
+// Set to read the position stream at binding 1; otherwise positions come out
+// of the full vertices at binding 0, for comparison
+layout(constant_id = 3) const bool POSITION_STREAM = true;
+
+layout(binding = 0) readonly buffer Vertices
+{
+    Vertex vertices[];
+};
+
+layout(binding = 0) readonly buffer PackedVertices
+{
+    PackedVertex packedVertices[];
+};
+
+// Three floats per vertex, or PackedPosition when vertices are packed
+layout(binding = 1) readonly buffer Positions
+{
+    float positions[];
+};
+
+layout(binding = 1) readonly buffer PackedPositions
+{
+    PackedPosition packedPositions[];
+};
+
+layout(binding = 2) readonly buffer Frame
+{
+    FrameData frame;
+};
+
+void main()
+{
+    vec3 position;
+
+    if (POSITION_STREAM)
+    {
+        if (PACKED_VERTICES)
+            position = unpackPosition(packedPositions[gl_VertexIndex]);
+        else
+            position = vec3(positions[gl_VertexIndex * 3 + 0], positions[gl_VertexIndex * 3 + 1], positions[gl_VertexIndex * 3 + 2]);
+    }
+    else
+    {
+        vec3 normal;
+        vec2 texcoord;
+
+        if (PACKED_VERTICES)
+            unpackVertex(packedVertices[gl_VertexIndex], position, normal, texcoord);
+        else
+            readVertex(vertices[gl_VertexIndex], position, normal, texcoord);
+    }
+
+    gl_Position = frame.viewProjection * vec4(position, 1.0);
+}
@@ -0,0 +1,127 @@
+// Shared by the vertex, culling, task and mesh shaders
+
+// Set when the vertex buffer holds PackedVertex
+layout(constant_id = 0) const bool PACKED_VERTICES = false;
+
+// Meshlets culled per task workgroup; matches MESHLET_TASK_GROUP_SIZE in main.c
+#define TASK_GROUP_SIZE 32
+
+struct Vertex
+{
+    float vx, vy, vz;
+    float nx, ny, nz;
+    float tu, tv;
+};
+
+// Matches PackedVertex in meshopt.h
+struct PackedVertex
+{
+    uint positionXY;        // unorm16 x, y
+    uint positionZNormal;   // unorm16 z, snorm8 octahedral normal
+    uint texcoord;          // half u, v
+};
+
+// Matches PackedPosition in meshopt.h
+struct PackedPosition
+{
+    uint positionXY;        // unorm16 x, y
+    uint positionZ;         // unorm16 z
+};
+
+// Matches Meshlet in meshopt.h
+struct Meshlet
+{
+    vec3 center;
+    float radius;
+    vec3 coneAxis;
+    float coneCutoff;
+    uint vertexOffset;
+    uint triangleOffset;
+    uint vertexCount;
+    uint triangleCount;
+};
+
+// Visible meshlets handed from a task workgroup to its mesh workgroups
+struct MeshletTask
+{
+    uint meshletIndices[TASK_GROUP_SIZE];
+};
+
+// Packed positions decode as offset + unorm * scale, from the mesh bounds
+layout(push_constant) uniform Constants
+{
+    vec4 positionOffset;
+    vec4 positionScale;
+    uint meshletCount;
+    uint vertexCount;
+    uint indexCount;
+};
+
+// Octahedral snorm8 code of a missing normal; matches PACKED_NORMAL_MISSING in meshopt.h
+const uint PACKED_NORMAL_MISSING = 0x8080;
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+void unpackVertex(PackedVertex v, out vec3 position, out vec3 normal, out vec2 texcoord)
+{
+    vec3 unorm = vec3(unpackUnorm2x16(v.positionXY), unpackUnorm2x16(v.positionZNormal).x);
+
+    position = positionOffset.xyz + unorm * positionScale.xyz;
+    normal = decodeOctahedral(unpackSnorm4x8(v.positionZNormal).zw);
+    texcoord = unpackHalf2x16(v.texcoord);
+}
+
+vec3 unpackPosition(PackedPosition p)
+{
+    vec3 unorm = vec3(unpackUnorm2x16(p.positionXY), unpackUnorm2x16(p.positionZ).x);
+
+    return positionOffset.xyz + unorm * positionScale.xyz;
+}
+
+void readVertex(Vertex v, out vec3 position, out vec3 normal, out vec2 texcoord)
+{
+    position = vec3(v.vx, v.vy, v.vz);
+    normal = vec3(v.nx, v.ny, v.nz);
+    texcoord = vec2(v.tu, v.tv);
+}
+
+// Matches FrameData in main.c; written by the host every frame into the frame
+// ring, which every pass that transforms or culls binds
+struct FrameData
+{
+    mat4 viewProjection;
+    vec4 viewDirection;     // xyz: the direction the view looks along, in mesh units
+};
+
+// The bounding sphere is tested against the planes of the clip volume, taken
+// from the rows of viewProjection, and the normal cone against the view
+// direction, which holds for the orthographic views the renderer uses
+bool meshletVisible(Meshlet meshlet, FrameData frame)
+{
+    mat4 rows = transpose(frame.viewProjection);
+
+    vec4 planes[6] =
+    {
+        rows[3] + rows[0],
+        rows[3] - rows[0],
+        rows[3] + rows[1],
+        rows[3] - rows[1],
+        rows[2],
+        rows[3] - rows[2]
+    };
+
+    bool inside = true;
+
+    for (int i = 0; i < 6; i++)
+        inside = inside && dot(planes[i].xyz, meshlet.center) + planes[i].w >= -meshlet.radius * length(planes[i].xyz);
+
+    bool backfacing = dot(frame.viewDirection.xyz, meshlet.coneAxis) > meshlet.coneCutoff;
+
+    return inside && !backfacing;
+}
@@ -1,31 +1,40 @@
-
 #version 460
 
-struct Vertex
-{
-    float vx, vy, vz;
-    float nx, ny, nz;
-    float tu, tv;
-};
+#extension GL_GOOGLE_include_directive : require
+
+#include "mesh.h"
 
 layout(binding = 0) readonly buffer Vertices
 {
     Vertex vertices[];
 };
 
+layout(binding = 0) readonly buffer PackedVertices
+{
+    PackedVertex packedVertices[];
+};
+
+layout(binding = 1) readonly buffer Frame
+{
+    FrameData frame;
+};
+
 layout(location = 0) out vec3 vNormal;
 layout(location = 1) out vec2 vTexCoord;
 layout(location = 2) out vec4 vColor;
 
 void main()
 {
-    Vertex v = vertices[gl_VertexIndex];
+    vec3 position;
+    vec3 normal;
+    vec2 texcoord;
 
-    vec3 position = vec3(v.vx, v.vy * -1.0, v.vz + 0.05);
-    vec3 normal = vec3(v.nx, v.ny, v.nz);
-    vec2 texcoord = vec2(v.tu, v.tv);
+    if (PACKED_VERTICES)
+        unpackVertex(packedVertices[gl_VertexIndex], position, normal, texcoord);
+    else
+        readVertex(vertices[gl_VertexIndex], position, normal, texcoord);
 
-    gl_Position = vec4(position, 1.0);
+    gl_Position = frame.viewProjection * vec4(position, 1.0);
 
     vNormal = normal;
     vTexCoord = texcoord;
@@ -0,0 +1,218 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+    // MAP_ANONYMOUS and MAP_NORESERVE are extensions hidden by strict -std modes
+    #define _DEFAULT_SOURCE
+#endif
+
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    #define ARENA_THREAD_LOCAL __declspec(thread)
+#else
+    #include <sys/mman.h>
+    #define ARENA_THREAD_LOCAL _Thread_local
+#endif
+
+#define ARENA_ALIGN 16
+#define ARENA_COMMIT_SIZE (1024 * 1024)
+
+// Precedes every allocation so it can be copied on realloc and popped on free
+typedef struct
+{
+    size_t size;
+    size_t prev;
+} ArenaHeader;
+
+#define ARENA_HEADER_SIZE ((sizeof(ArenaHeader) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static ARENA_THREAD_LOCAL Arena* boundArena;
+
+static size_t alignUp(size_t size, size_t align)
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+static ArenaHeader* getHeader(void* ptr)
+{
+    return (ArenaHeader*)((char*)ptr - ARENA_HEADER_SIZE);
+}
+
+static int arenaCommit(Arena* arena, size_t size)
+{
+    if (size <= arena->committed)
+        return 1;
+
+    size_t committed = alignUp(size, ARENA_COMMIT_SIZE);
+    if (committed > arena->reserved)
+        committed = arena->reserved;
+
+#ifdef _WIN32
+    if (!VirtualAlloc(arena->base + arena->committed, committed - arena->committed, MEM_COMMIT, PAGE_READWRITE))
+        return 0;
+#else
+    if (mprotect(arena->base + arena->committed, committed - arena->committed, PROT_READ | PROT_WRITE) != 0)
+        return 0;
+#endif
+
+    arena->committed = committed;
+    return 1;
+}
+
+int arenaCreate(Arena* arena, size_t reserveSize)
+{
+    memset(arena, 0, sizeof(*arena));
+
+    size_t reserved = alignUp(reserveSize, ARENA_COMMIT_SIZE);
+
+#ifdef _WIN32
+    void* base = VirtualAlloc(0, reserved, MEM_RESERVE, PAGE_NOACCESS);
+    if (!base)
+        return 0;
+#else
+    void* base = mmap(0, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        return 0;
+#endif
+
+    arena->base = base;
+    arena->reserved = reserved;
+    return 1;
+}
+
+void arenaDestroy(Arena* arena)
+{
+    if (!arena->base)
+        return;
+
+#ifdef _WIN32
+    VirtualFree(arena->base, 0, MEM_RELEASE);
+#else
+    munmap(arena->base, arena->reserved);
+#endif
+
+    memset(arena, 0, sizeof(*arena));
+}
+
+void arenaReset(Arena* arena)
+{
+    // Committed pages are kept for the next batch
+    arena->top = 0;
+    arena->last = 0;
+}
+
+void* arenaAlloc(Arena* arena, size_t size)
+{
+    size_t offset = arena->top + ARENA_HEADER_SIZE;
+    size_t end = offset + alignUp(size, ARENA_ALIGN);
+
+    if (end < offset || end > arena->reserved || !arenaCommit(arena, end))
+        return 0;
+
+    ArenaHeader* header = (ArenaHeader*)(arena->base + arena->top);
+    header->size = size;
+    header->prev = arena->last;
+
+    arena->last = offset;
+    arena->top = end;
+
+    return arena->base + offset;
+}
+
+void* arenaRealloc(Arena* arena, void* ptr, size_t size)
+{
+    if (!ptr)
+        return arenaAlloc(arena, size);
+
+    ArenaHeader* header = getHeader(ptr);
+    size_t offset = (size_t)((char*)ptr - arena->base);
+
+    // The top allocation grows (or shrinks) in place
+    if (offset == arena->last)
+    {
+        size_t end = offset + alignUp(size, ARENA_ALIGN);
+
+        if (end < offset || end > arena->reserved || !arenaCommit(arena, end))
+            return 0;
+
+        header->size = size;
+        arena->top = end;
+
+        return ptr;
+    }
+
+    // Anything below it shrinks in place; the tail comes back on reset
+    if (size <= header->size)
+    {
+        header->size = size;
+        return ptr;
+    }
+
+    void* result = arenaAlloc(arena, size);
+    if (!result)
+        return 0;
+
+    memcpy(result, ptr, header->size < size ? header->size : size);
+    return result;
+}
+
+void arenaFree(Arena* arena, void* ptr)
+{
+    // Only the top allocation can be given back before a reset
+    if (!ptr || (size_t)((char*)ptr - arena->base) != arena->last)
+        return;
+
+    arena->top = arena->last - ARENA_HEADER_SIZE;
+    arena->last = getHeader(ptr)->prev;
+}
+
+int arenaOwns(const Arena* arena, const void* ptr)
+{
+    return arena->base && (const char*)ptr >= arena->base && (const char*)ptr < arena->base + arena->reserved;
+}
+
+Arena* arenaBind(Arena* arena)
+{
+    Arena* previous = boundArena;
+    boundArena = arena;
+    return previous;
+}
+
+void* arenaHookRealloc(void* ptr, size_t size)
+{
+    Arena* arena = boundArena;
+
+    if (!arena || (ptr && !arenaOwns(arena, ptr)))
+        return realloc(ptr, size);
+
+    void* result = arenaRealloc(arena, ptr, size);
+    if (result)
+        return result;
+
+    // Arena is exhausted, carry on from the heap
+    result = malloc(size);
+    if (result && ptr)
+    {
+        size_t oldSize = getHeader(ptr)->size;
+        memcpy(result, ptr, oldSize < size ? oldSize : size);
+        arenaFree(arena, ptr);
+    }
+
+    return result;
+}
+
+void arenaHookFree(void* ptr)
+{
+    Arena* arena = boundArena;
+
+    if (arena && arenaOwns(arena, ptr))
+        arenaFree(arena, ptr);
+    else
+        free(ptr);
+}
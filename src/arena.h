@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+
+// Linear allocator over one reserved range of address space. Pages are
+// committed as the arena grows and everything is released at once with
+// arenaReset or arenaDestroy. The most recent allocation can be grown in
+// place or popped, which covers the realloc patterns of fast_obj, and any
+// allocation can be shrunk in place.
+typedef struct
+{
+    char*   base;
+    size_t  reserved;
+    size_t  committed;
+    size_t  top;
+    size_t  last;
+} Arena;
+
+int arenaCreate(Arena* arena, size_t reserveSize);
+void arenaDestroy(Arena* arena);
+void arenaReset(Arena* arena);
+
+void* arenaAlloc(Arena* arena, size_t size);
+void* arenaRealloc(Arena* arena, void* ptr, size_t size);
+void arenaFree(Arena* arena, void* ptr);
+int arenaOwns(const Arena* arena, const void* ptr);
+
+// Binds an arena to the calling thread for arenaHookRealloc/arenaHookFree
+// and returns the previous one. Other threads keep using the heap, and
+// frees of heap blocks while an arena is bound go back to the heap.
+Arena* arenaBind(Arena* arena);
+
+void* arenaHookRealloc(void* ptr, size_t size);
+void arenaHookFree(void* ptr);
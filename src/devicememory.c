@@ -0,0 +1,760 @@
+#include "devicememory.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+// Size classes: below 256 bytes in 8 linear steps of 32, then every power of
+// two split into 8 linear steps. 32 first level classes cover blocks up to
+// 2^38 bytes.
+#define TLSF_SL_LOG2 3
+#define TLSF_SL_COUNT (1u << TLSF_SL_LOG2)
+#define TLSF_SMALL_LOG2 8
+#define TLSF_FL_COUNT 32
+
+#define NO_RANGE (~0u)
+
+// A free or allocated range of a block. Ranges tile their block in offset
+// order through prevPhysical and nextPhysical; free ones are also listed in
+// the block's free list for their size class.
+typedef struct
+{
+    VkDeviceSize    offset;
+    VkDeviceSize    size;
+
+    uint32_t        prevPhysical;
+    uint32_t        nextPhysical;
+    uint32_t        prevFree;       // also links unused range records
+    uint32_t        nextFree;
+
+    int             free;
+} DeviceMemoryRange;
+
+typedef struct
+{
+    VkDeviceMemory  memory;         // 0 when the slot is unused
+    VkDeviceSize    size;
+    char*           data;
+    uint32_t        memoryType;
+    int             kind;
+    uint32_t        allocationCount;
+
+    uint32_t        flBitmap;
+    uint32_t        slBitmaps[TLSF_FL_COUNT];
+    uint32_t        freeLists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+} DeviceMemoryBlock;
+
+struct DeviceAllocator
+{
+    VkPhysicalDevice                    physicalDevice;
+    VkDevice                            device;
+    VkPhysicalDeviceMemoryProperties    memProps;
+    VkDeviceSize                        bufferImageGranularity;
+
+    DeviceMemoryBlock*                  blocks;
+    uint32_t                            blockCount;
+
+    DeviceMemoryRange*                  ranges;
+    uint32_t                            rangeCount;
+    uint32_t                            unusedRanges;
+
+    uint32_t                            allocationCount;
+    uint32_t                            driverAllocationCount;
+    VkDeviceSize                        allocatedBytes;
+
+    // Per heap: the budget and usage as of the last update, the block bytes
+    // then and now, which correct that usage until the next update, and the
+    // bytes allocated per category
+    int                                 memoryBudget;
+    VkDeviceSize                        heapBudget[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize                        heapUsage[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize                        heapUpdateBlockBytes[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize                        heapBlockBytes[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize                        categoryBytes[VK_MAX_MEMORY_HEAPS][DEVICE_MEMORY_CATEGORY_COUNT];
+
+    uint32_t                            overBudgetHeaps;
+    DeviceBudgetCallback                budgetCallback;
+    void*                               budgetContext;
+};
+
+static uint32_t lowestBit(uint32_t v)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, v);
+    return index;
+#else
+    return (uint32_t)__builtin_ctz(v);
+#endif
+}
+
+static uint32_t highestBit(VkDeviceSize v)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, v);
+    return index;
+#else
+    return 63 - (uint32_t)__builtin_clzll(v);
+#endif
+}
+
+static uint32_t bitCount(uint32_t v)
+{
+#ifdef _MSC_VER
+    return __popcnt(v);
+#else
+    return (uint32_t)__builtin_popcount(v);
+#endif
+}
+
+static void mapSize(VkDeviceSize size, uint32_t* fl, uint32_t* sl)
+{
+    if (size < (1u << TLSF_SMALL_LOG2))
+    {
+        *fl = 0;
+        *sl = (uint32_t)(size >> (TLSF_SMALL_LOG2 - TLSF_SL_LOG2));
+    }
+    else
+    {
+        uint32_t log2 = highestBit(size);
+
+        *fl = log2 - TLSF_SMALL_LOG2 + 1;
+        *sl = (uint32_t)(size >> (log2 - TLSF_SL_LOG2)) - TLSF_SL_COUNT;
+    }
+
+    assert(*fl < TLSF_FL_COUNT);
+}
+
+// Class from which every free range is at least size bytes
+static void mapSearchSize(VkDeviceSize size, uint32_t* fl, uint32_t* sl)
+{
+    if (size < (1u << TLSF_SMALL_LOG2))
+        size += (1u << (TLSF_SMALL_LOG2 - TLSF_SL_LOG2)) - 1;
+    else
+        size += (1ull << (highestBit(size) - TLSF_SL_LOG2)) - 1;
+
+    mapSize(size, fl, sl);
+}
+
+static uint32_t newRange(DeviceAllocator* allocator)
+{
+    if (allocator->unusedRanges != NO_RANGE)
+    {
+        uint32_t r = allocator->unusedRanges;
+        allocator->unusedRanges = allocator->ranges[r].prevFree;
+        return r;
+    }
+
+    // Capacity doubles at powers of two
+    uint32_t count = allocator->rangeCount;
+
+    if ((count & (count - 1)) == 0)
+    {
+        DeviceMemoryRange* ranges = realloc(allocator->ranges, (count ? count * 2 : 64) * sizeof(DeviceMemoryRange));
+        if (!ranges)
+            return NO_RANGE;
+
+        allocator->ranges = ranges;
+    }
+
+    return allocator->rangeCount++;
+}
+
+static void releaseRange(DeviceAllocator* allocator, uint32_t r)
+{
+    allocator->ranges[r].prevFree = allocator->unusedRanges;
+    allocator->unusedRanges = r;
+}
+
+static void insertFree(DeviceAllocator* allocator, DeviceMemoryBlock* block, uint32_t r)
+{
+    DeviceMemoryRange* range = &allocator->ranges[r];
+
+    uint32_t fl, sl;
+    mapSize(range->size, &fl, &sl);
+
+    range->free = 1;
+    range->prevFree = NO_RANGE;
+    range->nextFree = block->freeLists[fl][sl];
+
+    if (range->nextFree != NO_RANGE)
+        allocator->ranges[range->nextFree].prevFree = r;
+
+    block->freeLists[fl][sl] = r;
+    block->flBitmap |= 1u << fl;
+    block->slBitmaps[fl] |= 1u << sl;
+}
+
+static void removeFree(DeviceAllocator* allocator, DeviceMemoryBlock* block, uint32_t r)
+{
+    DeviceMemoryRange* range = &allocator->ranges[r];
+
+    uint32_t fl, sl;
+    mapSize(range->size, &fl, &sl);
+
+    if (range->prevFree != NO_RANGE)
+        allocator->ranges[range->prevFree].nextFree = range->nextFree;
+    else
+        block->freeLists[fl][sl] = range->nextFree;
+
+    if (range->nextFree != NO_RANGE)
+        allocator->ranges[range->nextFree].prevFree = range->prevFree;
+
+    if (block->freeLists[fl][sl] == NO_RANGE)
+    {
+        block->slBitmaps[fl] &= ~(1u << sl);
+
+        if (block->slBitmaps[fl] == 0)
+            block->flBitmap &= ~(1u << fl);
+    }
+
+    range->free = 0;
+}
+
+// First free range in the smallest non-empty class at or above fl, sl
+static uint32_t findFree(const DeviceMemoryBlock* block, uint32_t fl, uint32_t sl)
+{
+    uint32_t slMap = block->slBitmaps[fl] & (~0u << sl);
+
+    if (slMap == 0)
+    {
+        uint32_t flMap = fl + 1 < TLSF_FL_COUNT ? block->flBitmap & (~0u << (fl + 1)) : 0;
+
+        if (flMap == 0)
+            return NO_RANGE;
+
+        fl = lowestBit(flMap);
+        slMap = block->slBitmaps[fl];
+    }
+
+    return block->freeLists[fl][lowestBit(slMap)];
+}
+
+// Splits the end of range r off into a new free range
+static int splitRange(DeviceAllocator* allocator, DeviceMemoryBlock* block, uint32_t r, VkDeviceSize size)
+{
+    uint32_t rest = newRange(allocator);
+    if (rest == NO_RANGE)
+        return 0;
+
+    DeviceMemoryRange* range = &allocator->ranges[r];
+
+    allocator->ranges[rest] = (DeviceMemoryRange)
+    {
+        .offset = range->offset + size,
+        .size = range->size - size,
+        .prevPhysical = r,
+        .nextPhysical = range->nextPhysical,
+    };
+
+    if (range->nextPhysical != NO_RANGE)
+        allocator->ranges[range->nextPhysical].prevPhysical = rest;
+
+    range->nextPhysical = rest;
+    range->size = size;
+
+    insertFree(allocator, block, rest);
+
+    return 1;
+}
+
+// Allocates size bytes at the given alignment from free range r, which
+// must be large enough; returns the allocated range or NO_RANGE
+static uint32_t takeRange(DeviceAllocator* allocator, DeviceMemoryBlock* block, uint32_t r, VkDeviceSize size, VkDeviceSize alignment)
+{
+    removeFree(allocator, block, r);
+
+    // Alignment padding becomes a free range of its own in front
+    VkDeviceSize offset = allocator->ranges[r].offset;
+    VkDeviceSize padding = (offset + alignment - 1) / alignment * alignment - offset;
+
+    if (padding)
+    {
+        if (!splitRange(allocator, block, r, padding))
+        {
+            insertFree(allocator, block, r);
+            return NO_RANGE;
+        }
+
+        uint32_t front = r;
+        r = allocator->ranges[front].nextPhysical;
+
+        removeFree(allocator, block, r);
+        insertFree(allocator, block, front);
+    }
+
+    // Without a record for the tail it stays with the allocation, which is
+    // only wasteful
+    if (allocator->ranges[r].size > size)
+        splitRange(allocator, block, r, size);
+
+    block->allocationCount++;
+
+    return r;
+}
+
+// Good fit search: any range in the class found holds size bytes at the
+// alignment, however it is placed
+static uint32_t blockAlloc(DeviceAllocator* allocator, DeviceMemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment)
+{
+    uint32_t fl, sl;
+    mapSearchSize(size + alignment - 1, &fl, &sl);
+
+    uint32_t r = findFree(block, fl, sl);
+    if (r == NO_RANGE)
+        return NO_RANGE;
+
+    return takeRange(allocator, block, r, size, alignment);
+}
+
+static void blockFree(DeviceAllocator* allocator, DeviceMemoryBlock* block, uint32_t r)
+{
+    DeviceMemoryRange* range = &allocator->ranges[r];
+
+    uint32_t next = range->nextPhysical;
+
+    if (next != NO_RANGE && allocator->ranges[next].free)
+    {
+        removeFree(allocator, block, next);
+
+        range->size += allocator->ranges[next].size;
+        range->nextPhysical = allocator->ranges[next].nextPhysical;
+
+        if (range->nextPhysical != NO_RANGE)
+            allocator->ranges[range->nextPhysical].prevPhysical = r;
+
+        releaseRange(allocator, next);
+    }
+
+    uint32_t prev = range->prevPhysical;
+
+    if (prev != NO_RANGE && allocator->ranges[prev].free)
+    {
+        removeFree(allocator, block, prev);
+
+        allocator->ranges[prev].size += range->size;
+        allocator->ranges[prev].nextPhysical = range->nextPhysical;
+
+        if (range->nextPhysical != NO_RANGE)
+            allocator->ranges[range->nextPhysical].prevPhysical = prev;
+
+        releaseRange(allocator, r);
+        r = prev;
+    }
+
+    insertFree(allocator, block, r);
+
+    block->allocationCount--;
+}
+
+uint32_t selectMemoryType(const VkPhysicalDeviceMemoryProperties* memProps, uint32_t memTypeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred)
+{
+    uint32_t best = ~0u;
+    uint32_t bestCost = ~0u;
+
+    for (uint32_t i = 0; i < memProps->memoryTypeCount; i++)
+    {
+        VkMemoryPropertyFlags flags = memProps->memoryTypes[i].propertyFlags;
+
+        if ((memTypeBits & (1u << i)) == 0 || (flags & required) != required)
+            continue;
+
+        // Missing preferences outweigh any number of extra properties
+        uint32_t missing = bitCount(preferred & ~flags);
+        uint32_t extra = bitCount(flags & ~(required | preferred));
+        uint32_t cost = missing * 32 + extra;
+
+        if (cost < bestCost)
+        {
+            best = i;
+            bestCost = cost;
+        }
+    }
+
+    return best;
+}
+
+static VkDeviceSize estimateHeapUsage(const DeviceAllocator* allocator, uint32_t heap)
+{
+    VkDeviceSize usage = allocator->heapUsage[heap] + allocator->heapBlockBytes[heap];
+
+    return usage > allocator->heapUpdateBlockBytes[heap] ? usage - allocator->heapUpdateBlockBytes[heap] : 0;
+}
+
+static void checkBudget(DeviceAllocator* allocator, uint32_t heap)
+{
+    VkDeviceSize usage = estimateHeapUsage(allocator, heap);
+    VkDeviceSize budget = allocator->heapBudget[heap];
+
+    int over = (double)usage > (double)budget * DEVICE_MEMORY_BUDGET_THRESHOLD;
+
+    if (over && (allocator->overBudgetHeaps & (1u << heap)) == 0)
+    {
+        allocator->overBudgetHeaps |= 1u << heap;
+
+        if (allocator->budgetCallback)
+            allocator->budgetCallback(allocator->budgetContext, heap, usage, budget);
+    }
+    else if (!over)
+        allocator->overBudgetHeaps &= ~(1u << heap);
+}
+
+DeviceAllocator* deviceAllocatorCreate(VkPhysicalDevice physicalDevice, VkDevice device, int memoryBudget)
+{
+    DeviceAllocator* allocator = calloc(1, sizeof(DeviceAllocator));
+    if (!allocator)
+        return 0;
+
+    allocator->physicalDevice = physicalDevice;
+    allocator->device = device;
+    allocator->unusedRanges = NO_RANGE;
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &allocator->memProps);
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+
+    allocator->bufferImageGranularity = props.limits.bufferImageGranularity;
+
+    // The budget is read through vkGetPhysicalDeviceMemoryProperties2, which
+    // is core from Vulkan 1.1; older devices fall back to the estimate
+    allocator->memoryBudget = memoryBudget && props.apiVersion >= VK_API_VERSION_1_1;
+
+    deviceAllocatorUpdateBudget(allocator);
+
+    return allocator;
+}
+
+void deviceAllocatorDestroy(DeviceAllocator* allocator)
+{
+    if (!allocator)
+        return;
+
+    for (uint32_t i = 0; i < allocator->blockCount; i++)
+        if (allocator->blocks[i].memory)
+        {
+            assert(allocator->blocks[i].allocationCount == 0);
+            vkFreeMemory(allocator->device, allocator->blocks[i].memory, 0);
+        }
+
+    free(allocator->blocks);
+    free(allocator->ranges);
+    free(allocator);
+}
+
+// A block of the memory type holding one free range over all of it, which
+// is written to range; returns NO_RANGE if the driver is out of memory
+static uint32_t createBlock(DeviceAllocator* allocator, uint32_t memoryType, VkDeviceSize size, int kind, uint32_t* range)
+{
+    uint32_t b = 0;
+
+    while (b < allocator->blockCount && allocator->blocks[b].memory)
+        b++;
+
+    if (b == allocator->blockCount)
+    {
+        DeviceMemoryBlock* blocks = realloc(allocator->blocks, (b + 1) * sizeof(DeviceMemoryBlock));
+        if (!blocks)
+            return NO_RANGE;
+
+        allocator->blocks = blocks;
+        allocator->blocks[b].memory = 0;
+        allocator->blockCount++;
+    }
+
+    uint32_t r = newRange(allocator);
+    if (r == NO_RANGE)
+        return NO_RANGE;
+
+    const VkMemoryAllocateInfo allocateInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = size,
+        .memoryTypeIndex = memoryType,
+    };
+
+    VkDeviceMemory memory = 0;
+
+    if (vkAllocateMemory(allocator->device, &allocateInfo, 0, &memory) != VK_SUCCESS)
+    {
+        releaseRange(allocator, r);
+        return NO_RANGE;
+    }
+
+    allocator->driverAllocationCount++;
+
+    void* data = 0;
+
+    if ((allocator->memProps.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+        vkMapMemory(allocator->device, memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+    {
+        vkFreeMemory(allocator->device, memory, 0);
+        releaseRange(allocator, r);
+        return NO_RANGE;
+    }
+
+    DeviceMemoryBlock* block = &allocator->blocks[b];
+
+    memset(block, 0, sizeof(*block));
+    memset(block->freeLists, 0xff, sizeof(block->freeLists));
+
+    block->memory = memory;
+    block->size = size;
+    block->data = data;
+    block->memoryType = memoryType;
+    block->kind = kind;
+
+    uint32_t heap = allocator->memProps.memoryTypes[memoryType].heapIndex;
+
+    allocator->heapBlockBytes[heap] += size;
+    checkBudget(allocator, heap);
+
+    allocator->ranges[r] = (DeviceMemoryRange){ .offset = 0, .size = size, .prevPhysical = NO_RANGE, .nextPhysical = NO_RANGE };
+    insertFree(allocator, block, r);
+
+    *range = r;
+    return b;
+}
+
+static VkDeviceSize blockSize(const DeviceAllocator* allocator, uint32_t memoryType)
+{
+    VkDeviceSize heapSize = allocator->memProps.memoryHeaps[allocator->memProps.memoryTypes[memoryType].heapIndex].size;
+
+    return heapSize / 8 < DEVICE_MEMORY_BLOCK_SIZE ? heapSize / 8 : DEVICE_MEMORY_BLOCK_SIZE;
+}
+
+// Allocates from existing blocks of the type first, then from a new one
+static int allocFromType(DeviceAllocator* allocator, DeviceAllocation* allocation, uint32_t memoryType, VkDeviceSize size, VkDeviceSize alignment, int kind, int category)
+{
+    uint32_t r = NO_RANGE;
+    uint32_t b = 0;
+
+    for (; b < allocator->blockCount; b++)
+    {
+        DeviceMemoryBlock* block = &allocator->blocks[b];
+
+        if (!block->memory || block->memoryType != memoryType || block->kind != kind)
+            continue;
+
+        r = blockAlloc(allocator, block, size, alignment);
+        if (r != NO_RANGE)
+            break;
+    }
+
+    if (r == NO_RANGE)
+    {
+        VkDeviceSize defaultSize = blockSize(allocator, memoryType);
+
+        uint32_t first = NO_RANGE;
+
+        b = createBlock(allocator, memoryType, size > defaultSize / 2 ? size : defaultSize, kind, &first);
+        if (b == NO_RANGE)
+            return 0;
+
+        // Block offsets start at 0, which satisfies any alignment
+        r = takeRange(allocator, &allocator->blocks[b], first, size, 1);
+        assert(r != NO_RANGE);
+    }
+
+    const DeviceMemoryBlock* block = &allocator->blocks[b];
+    const DeviceMemoryRange* range = &allocator->ranges[r];
+
+    *allocation = (DeviceAllocation)
+    {
+        .memory = block->memory,
+        .offset = range->offset,
+        .size = range->size,
+        .data = block->data ? block->data + range->offset : 0,
+        .memoryType = memoryType,
+        .block = b,
+        .range = r,
+        .category = (uint32_t)category,
+    };
+
+    allocator->allocationCount++;
+    allocator->allocatedBytes += range->size;
+    allocator->categoryBytes[allocator->memProps.memoryTypes[memoryType].heapIndex][category] += range->size;
+
+    return 1;
+}
+
+int deviceAlloc(DeviceAllocator* allocator, DeviceAllocation* allocation, const VkMemoryRequirements* requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, int kind, int category)
+{
+    assert(category >= 0 && category < DEVICE_MEMORY_CATEGORY_COUNT);
+
+    // Without a granularity constraint every kind of resource shares blocks
+    if (allocator->bufferImageGranularity <= 1)
+        kind = DEVICE_MEMORY_LINEAR;
+
+    uint32_t memTypeBits = requirements->memoryTypeBits;
+
+    for (;;)
+    {
+        uint32_t memoryType = selectMemoryType(&allocator->memProps, memTypeBits, required, preferred);
+
+        if (memoryType == ~0u)
+        {
+            *allocation = (DeviceAllocation){0};
+            return 0;
+        }
+
+        if (allocFromType(allocator, allocation, memoryType, requirements->size, requirements->alignment, kind, category))
+            return 1;
+
+        memTypeBits &= ~(1u << memoryType);
+    }
+}
+
+void deviceFree(DeviceAllocator* allocator, DeviceAllocation* allocation)
+{
+    if (!allocation->memory)
+        return;
+
+    DeviceMemoryBlock* block = &allocator->blocks[allocation->block];
+    uint32_t heap = allocator->memProps.memoryTypes[block->memoryType].heapIndex;
+
+    allocator->allocationCount--;
+    allocator->allocatedBytes -= allocator->ranges[allocation->range].size;
+    allocator->categoryBytes[heap][allocation->category] -= allocator->ranges[allocation->range].size;
+
+    blockFree(allocator, block, allocation->range);
+
+    // Empty blocks go back to the driver, except the last of their type and
+    // kind, which is kept to avoid thrashing; blocks made for one large
+    // request always go
+    if (block->allocationCount == 0)
+    {
+        int keep = block->size == blockSize(allocator, block->memoryType);
+
+        for (uint32_t b = 0; keep && b < allocator->blockCount; b++)
+        {
+            const DeviceMemoryBlock* other = &allocator->blocks[b];
+
+            keep = other == block || !other->memory || other->memoryType != block->memoryType || other->kind != block->kind;
+        }
+
+        if (!keep)
+        {
+            // Its only range spans the whole block again
+            uint32_t fl, sl;
+            mapSize(block->size, &fl, &sl);
+
+            uint32_t r = block->freeLists[fl][sl];
+            assert(allocator->ranges[r].size == block->size);
+
+            removeFree(allocator, block, r);
+            releaseRange(allocator, r);
+
+            vkFreeMemory(allocator->device, block->memory, 0);
+            block->memory = 0;
+
+            allocator->heapBlockBytes[heap] -= block->size;
+            checkBudget(allocator, heap);
+        }
+    }
+
+    *allocation = (DeviceAllocation){0};
+}
+
+void deviceAllocatorStats(const DeviceAllocator* allocator, DeviceMemoryStats* stats)
+{
+    *stats = (DeviceMemoryStats)
+    {
+        .allocationCount = allocator->allocationCount,
+        .driverAllocationCount = allocator->driverAllocationCount,
+        .allocatedBytes = allocator->allocatedBytes,
+    };
+
+    for (uint32_t b = 0; b < allocator->blockCount; b++)
+    {
+        const DeviceMemoryBlock* block = &allocator->blocks[b];
+
+        if (!block->memory)
+            continue;
+
+        stats->blockCount++;
+        stats->blockBytes += block->size;
+        stats->heapBlockBytes[allocator->memProps.memoryTypes[block->memoryType].heapIndex] += block->size;
+
+        // The largest class holding anything starts the search
+        if (block->flBitmap)
+        {
+            uint32_t fl = highestBit(block->flBitmap);
+            uint32_t sl = highestBit(block->slBitmaps[fl]);
+
+            for (uint32_t r = block->freeLists[fl][sl]; r != NO_RANGE; r = allocator->ranges[r].nextFree)
+                if (allocator->ranges[r].size > stats->largestFreeRange)
+                    stats->largestFreeRange = allocator->ranges[r].size;
+        }
+    }
+}
+
+void deviceAllocatorUpdateBudget(DeviceAllocator* allocator)
+{
+    const VkPhysicalDeviceMemoryProperties* memProps = &allocator->memProps;
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+    };
+
+    if (allocator->memoryBudget)
+    {
+        VkPhysicalDeviceMemoryProperties2 memProps2 =
+        {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+            .pNext = &budgetProps,
+        };
+
+        vkGetPhysicalDeviceMemoryProperties2(allocator->physicalDevice, &memProps2);
+    }
+
+    for (uint32_t i = 0; i < memProps->memoryHeapCount; i++)
+    {
+        // Some drivers report no budget for heaps they do not track
+        if (allocator->memoryBudget && budgetProps.heapBudget[i])
+        {
+            allocator->heapBudget[i] = budgetProps.heapBudget[i];
+            allocator->heapUsage[i] = budgetProps.heapUsage[i];
+        }
+        else
+        {
+            allocator->heapBudget[i] = memProps->memoryHeaps[i].size / 10 * 8;
+            allocator->heapUsage[i] = allocator->heapBlockBytes[i];
+        }
+
+        allocator->heapUpdateBlockBytes[i] = allocator->heapBlockBytes[i];
+
+        checkBudget(allocator, i);
+    }
+}
+
+void deviceAllocatorBudget(const DeviceAllocator* allocator, DeviceMemoryBudget* budget)
+{
+    *budget = (DeviceMemoryBudget)
+    {
+        .heapCount = allocator->memProps.memoryHeapCount,
+        .driverBudget = allocator->memoryBudget,
+    };
+
+    for (uint32_t i = 0; i < allocator->memProps.memoryHeapCount; i++)
+    {
+        budget->heapSize[i] = allocator->memProps.memoryHeaps[i].size;
+        budget->budget[i] = allocator->heapBudget[i];
+        budget->usage[i] = estimateHeapUsage(allocator, i);
+        budget->blockBytes[i] = allocator->heapBlockBytes[i];
+
+        memcpy(budget->categoryBytes[i], allocator->categoryBytes[i], sizeof(budget->categoryBytes[i]));
+    }
+}
+
+void deviceAllocatorSetBudgetCallback(DeviceAllocator* allocator, DeviceBudgetCallback callback, void* context)
+{
+    allocator->budgetCallback = callback;
+    allocator->budgetContext = context;
+}
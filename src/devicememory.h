@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+// Blocks reserved from the driver at a time, per memory type. Heaps smaller
+// than 8 blocks get blocks of an eighth of the heap instead, and requests
+// over half a block get a block of their own.
+#define DEVICE_MEMORY_BLOCK_SIZE (64ull * 1024 * 1024)
+
+// Resources whose memory layout is linear (buffers) and those that are not
+// (optimally tiled images) are kept in separate blocks when the device has a
+// bufferImageGranularity above 1, so neighbours never share a page
+enum
+{
+    DEVICE_MEMORY_LINEAR,
+    DEVICE_MEMORY_OPTIMAL,
+};
+
+// What allocations hold, for the per heap accounting in DeviceMemoryBudget
+enum
+{
+    DEVICE_MEMORY_GEOMETRY,     // vertices, indices and meshlets
+    DEVICE_MEMORY_STAGING,      // upload and readback memory
+    DEVICE_MEMORY_FRAME,        // rewritten every frame
+    DEVICE_MEMORY_TARGET,       // render targets
+    DEVICE_MEMORY_SCRATCH,      // written and read by the GPU alone
+
+    DEVICE_MEMORY_CATEGORY_COUNT
+};
+
+// A heap is over budget once its usage passes this fraction of the budget,
+// which leaves room to back off before the driver starts paging
+#define DEVICE_MEMORY_BUDGET_THRESHOLD 0.9
+
+// Memory type with all of required and as many of preferred as possible,
+// among those allowed by memTypeBits. Ties go to the type with the fewest
+// properties beyond those, so host visible memory is not chosen for device
+// only data by accident, then to the lowest index. Returns ~0u if none has
+// the required properties.
+uint32_t selectMemoryType(const VkPhysicalDeviceMemoryProperties* memProps, uint32_t memTypeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred);
+
+typedef struct
+{
+    VkDeviceMemory  memory;
+    VkDeviceSize    offset;
+    VkDeviceSize    size;
+    void*           data;           // at offset, in host visible memory; 0 otherwise
+    uint32_t        memoryType;
+
+    uint32_t        block;          // internal
+    uint32_t        range;          // internal
+    uint32_t        category;       // internal
+} DeviceAllocation;
+
+typedef struct
+{
+    uint32_t        blockCount;
+    uint32_t        allocationCount;
+    uint32_t        driverAllocationCount;      // vkAllocateMemory calls so far
+    VkDeviceSize    blockBytes;                 // reserved from the driver
+    VkDeviceSize    allocatedBytes;             // handed out, alignment padding included
+    VkDeviceSize    largestFreeRange;
+    VkDeviceSize    heapBlockBytes[VK_MAX_MEMORY_HEAPS];
+} DeviceMemoryStats;
+
+// Per heap, as of the last deviceAllocatorUpdateBudget plus the blocks
+// reserved and freed since. Without VK_EXT_memory_budget the budget is 80%
+// of the heap and the usage counts this allocator's blocks alone.
+typedef struct
+{
+    uint32_t        heapCount;
+    int             driverBudget;                   // from VK_EXT_memory_budget
+    VkDeviceSize    heapSize[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize    budget[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize    usage[VK_MAX_MEMORY_HEAPS];     // by the whole process
+    VkDeviceSize    blockBytes[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize    categoryBytes[VK_MAX_MEMORY_HEAPS][DEVICE_MEMORY_CATEGORY_COUNT];
+} DeviceMemoryBudget;
+
+// Called when a heap's usage passes DEVICE_MEMORY_BUDGET_THRESHOLD of its
+// budget, and again only after it has dropped back below
+typedef void (*DeviceBudgetCallback)(void* context, uint32_t heapIndex, VkDeviceSize usage, VkDeviceSize budget);
+
+// Sub-allocates buffer and image memory from large blocks per memory type
+// with a two level segregated fit (TLSF) free list in each block, so
+// allocation and free take constant time and neighbouring free ranges
+// merge. Host visible blocks stay mapped. An allocator is used from one
+// thread.
+typedef struct DeviceAllocator DeviceAllocator;
+
+// memoryBudget is set when the device was created with VK_EXT_memory_budget;
+// the driver's budget is only queried on a Vulkan 1.1 or later instance and
+// device
+DeviceAllocator* deviceAllocatorCreate(VkPhysicalDevice physicalDevice, VkDevice device, int memoryBudget);
+void deviceAllocatorDestroy(DeviceAllocator* allocator);
+
+// Places a resource with these requirements in the best memory type per
+// selectMemoryType, falling back to the next best when that type's heap is
+// out of memory. kind is DEVICE_MEMORY_LINEAR or DEVICE_MEMORY_OPTIMAL, and
+// category one of DEVICE_MEMORY_GEOMETRY and on. Returns 0 if no memory
+// type can hold it.
+int deviceAlloc(DeviceAllocator* allocator, DeviceAllocation* allocation, const VkMemoryRequirements* requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, int kind, int category);
+void deviceFree(DeviceAllocator* allocator, DeviceAllocation* allocation);
+
+void deviceAllocatorStats(const DeviceAllocator* allocator, DeviceMemoryStats* stats);
+
+// Queries the driver's budget and usage; meant to be called once a frame
+void deviceAllocatorUpdateBudget(DeviceAllocator* allocator);
+void deviceAllocatorBudget(const DeviceAllocator* allocator, DeviceMemoryBudget* budget);
+void deviceAllocatorSetBudgetCallback(DeviceAllocator* allocator, DeviceBudgetCallback callback, void* context);
@@ -1,3 +1,18 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+    // fseeko/ftello are extensions hidden by strict -std modes
+    #define _DEFAULT_SOURCE
+#endif
+
+// 64-bit file offsets on 32-bit platforms too
+#ifndef _FILE_OFFSET_BITS
+    #define _FILE_OFFSET_BITS 64
+#endif
+
+#include "arena.h"
+
+// Route fast_obj allocations through the arena bound to the calling thread, if any
+#define FAST_OBJ_REALLOC arenaHookRealloc
+#define FAST_OBJ_FREE arenaHookFree
 
 #define FAST_OBJ_IMPLEMENTATION
 #include "fast_obj.h"
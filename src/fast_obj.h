@@ -79,13 +79,21 @@ typedef struct
 
 } fastObjMaterial;
 
-/* Allows user override to bigger indexable array */
+/* Allows user override to bigger indexable array. FAST_OBJ_64BIT selects
+   64-bit counts and indices for meshes past 4G elements; the default build
+   rejects files it cannot count instead of wrapping. */
 #ifndef FAST_OBJ_UINT_TYPE
+#ifdef FAST_OBJ_64BIT
+#define FAST_OBJ_UINT_TYPE unsigned long long
+#else
 #define FAST_OBJ_UINT_TYPE unsigned int
 #endif
+#endif
 
 typedef FAST_OBJ_UINT_TYPE fastObjUInt;
 
+#define FAST_OBJ_UINT_MAX ((fastObjUInt)(~(fastObjUInt)(0)))
+
 typedef struct
 {
     fastObjUInt                 p;
@@ -101,13 +109,13 @@ typedef struct
     char*                       name;
 
     /* Number of faces */
-    unsigned int                face_count;
+    fastObjUInt                 face_count;
 
     /* First face in fastObjMesh face_* arrays */
-    unsigned int                face_offset;
+    fastObjUInt                 face_offset;
 
     /* First index in fastObjMesh indices array */
-    unsigned int                index_offset;
+    fastObjUInt                 index_offset;
 
 } fastObjGroup;
 
@@ -115,22 +123,22 @@ typedef struct
 typedef struct
 {
     /* Vertex data */
-    unsigned int                position_count;
+    fastObjUInt                 position_count;
     float*                      positions;
 
-    unsigned int                texcoord_count;
+    fastObjUInt                 texcoord_count;
     float*                      texcoords;
 
-    unsigned int                normal_count;
+    fastObjUInt                 normal_count;
     float*                      normals;
 
     /* Face data: one element for each face */
-    unsigned int                face_count;
+    fastObjUInt                 face_count;
     unsigned int*               face_vertices;
     unsigned int*               face_materials;
 
     /* Index data: one element for each face vertex */
-    unsigned int                index_count;
+    fastObjUInt                 index_count;
     fastObjIndex*               indices;
 
     /* Materials */
@@ -138,11 +146,11 @@ typedef struct
     fastObjMaterial*            materials;
 
     /* Mesh objects ('o' tag in .obj file) */
-    unsigned int                object_count;
+    fastObjUInt                 object_count;
     fastObjGroup*               objects;
 
     /* Mesh groups ('g' tag in .obj file) */
-    unsigned int                group_count;
+    fastObjUInt                 group_count;
     fastObjGroup*               groups;
 
 } fastObjMesh;
@@ -152,15 +160,36 @@ typedef struct
     void*                       (*file_open)(const char* path, void* user_data);
     void                        (*file_close)(void* file, void* user_data);
     size_t                      (*file_read)(void* file, void* dst, size_t bytes, void* user_data);
+
+    /* Only used to read material libraries whole; OBJs of any size go
+       through file_read or file_map. Sizes that do not fit should be
+       reported as ULONG_MAX, which is rejected as too large. */
     unsigned long               (*file_size)(void* file, void* user_data);
+
+    /* Optional: map the whole file into memory so it can be parsed in place.
+       Leave both as null to read the file through file_read instead. */
+    void*                       (*file_map)(void* file, size_t* size, void* user_data);
+    void                        (*file_unmap)(void* file, void* data, size_t size, void* user_data);
 } fastObjCallbacks;
 
+/* Receives each face as it is parsed, with indices already made absolute. The
+   mesh holds the positions/texcoords/normals/materials read so far, and its
+   position/texcoord/normal counts cover them. face_count and index_count hold
+   the totals found by the counting pass (0 when it is disabled) so callers
+   can size their output up front; once parsing is done they count the faces
+   and indices that were passed on. */
+typedef void (*fastObjFaceCallback)(const fastObjMesh* mesh, const fastObjIndex* indices, unsigned int count, unsigned int material, void* user_data);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 fastObjMesh*                    fast_obj_read(const char* path);
+fastObjMesh*                    fast_obj_read_mapped(const char* path);
+fastObjMesh*                    fast_obj_read_parallel(const char* path, unsigned int thread_count); /* 0 = one thread per CPU */
 fastObjMesh*                    fast_obj_read_with_callbacks(const char* path, const fastObjCallbacks* callbacks, void* user_data);
+fastObjMesh*                    fast_obj_read_faces(const char* path, fastObjFaceCallback callback, void* user_data); /* faces are passed to callback, not stored */
+fastObjMesh*                    fast_obj_read_faces_with_callbacks(const char* path, const fastObjCallbacks* callbacks, void* user_data, fastObjFaceCallback callback, void* face_user_data);
 void                            fast_obj_destroy(fastObjMesh* mesh);
 
 #ifdef __cplusplus
@@ -174,6 +203,51 @@ void                            fast_obj_destroy(fastObjMesh* mesh);
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+/* SIMD kernels for newline scanning; define FAST_OBJ_NO_SIMD to use scalar code only */
+#ifndef FAST_OBJ_NO_SIMD
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FAST_OBJ_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#define FAST_OBJ_AVX2
+#define FAST_OBJ_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#elif defined(__GNUC__) || defined(__clang__)
+#define FAST_OBJ_AVX2
+#define FAST_OBJ_TARGET_AVX2    __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define FAST_OBJ_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/* The kernels read whole aligned blocks past the current position; these
+   never cross a page boundary but can run past the end of a heap
+   allocation, which address sanitizers would report */
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#define FAST_OBJ_NO_SANITIZE    __attribute__((no_sanitize_address))
+#else
+#define FAST_OBJ_NO_SANITIZE
+#endif
 
 #ifndef FAST_OBJ_REALLOC
 #define FAST_OBJ_REALLOC        realloc
@@ -198,6 +272,51 @@ void                            fast_obj_destroy(fastObjMesh* mesh);
 /* Max supported power when parsing float */
 #define MAX_POWER               20
 
+/* Smallest chunk worth handing to another thread when parsing in parallel */
+#define MIN_CHUNK_SIZE          (1024 * 1024)
+
+/* Max threads used when parsing in parallel */
+#define MAX_THREADS             64
+
+
+typedef struct
+{
+    /* Line type: 'o', 'g', 'u' (usemtl) or 'm' (mtllib) */
+    char                        type;
+
+    /* Line contents after the keyword */
+    const char*                 ptr;
+
+    /* Faces/indices parsed in the chunk before this line */
+    fastObjUInt                 face;
+    fastObjUInt                 index;
+
+} fastObjEvent;
+
+
+typedef struct
+{
+    /* Index with a negative (relative) component */
+    fastObjUInt                 index;
+
+    /* Relative components: 1 = p, 2 = t, 4 = n */
+    unsigned int                mask;
+
+} fastObjRelative;
+
+
+typedef struct
+{
+    /* Elements found by the counting pass, wide enough not to wrap */
+    unsigned long long          positions;
+    unsigned long long          texcoords;
+    unsigned long long          normals;
+    unsigned long long          faces;
+    unsigned long long          indices;
+
+} fastObjCounts;
+
+
 typedef struct
 {
     /* Final mesh */
@@ -211,11 +330,28 @@ typedef struct
     unsigned int                material;
 
     /* Current line in file */
-    unsigned int                line;
+    fastObjUInt                 line;
 
     /* Base path for materials/textures */
     char*                       base;
 
+    /* Parsing one chunk of a file in parallel: lines which depend on state
+       from earlier chunks are recorded and replayed in order when merging */
+    int                         deferred;
+    fastObjEvent*               events;
+    fastObjRelative*            relative;
+
+    /* Streaming faces to a callback: the current face's indices and the
+       faces/indices passed on so far */
+    fastObjFaceCallback         face_callback;
+    void*                       face_user_data;
+    fastObjIndex*               face_indices;
+    fastObjUInt                 streamed_faces;
+    fastObjUInt                 streamed_indices;
+
+    /* Set when the file holds more elements than fastObjUInt can count */
+    int                         failed;
+
 } fastObjData;
 
 
@@ -252,13 +388,14 @@ void memory_dealloc(void* ptr)
 #define array_size(_arr)        ((_arr) ? _array_size(_arr) : 0)
 #define array_capacity(_arr)    ((_arr) ? _array_capacity(_arr) : 0)
 #define array_empty(_arr)       (array_size(_arr) == 0)
+#define array_reserve(_arr, _n) ((void)(_array_mgrow(_arr, (_n) + 1)))
 
 #define _array_header(_arr)     ((fastObjUInt*)(_arr)-2)
 #define _array_size(_arr)       (_array_header(_arr)[0])
 #define _array_capacity(_arr)   (_array_header(_arr)[1])
 #define _array_ngrow(_arr, _n)  ((_arr) == 0 || (_array_size(_arr) + (_n) >= _array_capacity(_arr)))
 #define _array_mgrow(_arr, _n)  (_array_ngrow(_arr, _n) ? (_array_grow(_arr, _n) != 0) : 1)
-#define _array_grow(_arr, _n)   (*((void**)&(_arr)) = array_realloc(_arr, _n, sizeof(*(_arr))))
+#define _array_grow(_arr, _n)   (array_grow((void**)(&(_arr)), _n, sizeof(*(_arr))))
 
 
 static void* array_realloc(void* ptr, fastObjUInt n, fastObjUInt b)
@@ -266,15 +403,23 @@ static void* array_realloc(void* ptr, fastObjUInt n, fastObjUInt b)
     fastObjUInt sz = array_size(ptr);
     fastObjUInt nsz = sz + n;
     fastObjUInt cap = array_capacity(ptr);
-    fastObjUInt ncap = 3 * cap / 2;
+    fastObjUInt ncap = cap + cap / 2;
     fastObjUInt* r;
 
 
-    if (ncap < nsz)
+    /* Fail instead of wrapping when the element count outgrows fastObjUInt
+       or the byte size outgrows size_t */
+    if (nsz < sz || nsz > FAST_OBJ_UINT_MAX - 15)
+        return 0;
+
+    if (ncap < nsz || ncap > FAST_OBJ_UINT_MAX - 15)
         ncap = nsz;
-    ncap = (ncap + 15) & ~15u;
+    ncap = (ncap + 15) & ~(fastObjUInt)(15);
 
-    r = (fastObjUInt*)(memory_realloc(ptr ? _array_header(ptr) : 0, b * ncap + 2 * sizeof(fastObjUInt)));
+    if (ncap > (SIZE_MAX - 2 * sizeof(fastObjUInt)) / b)
+        return 0;
+
+    r = (fastObjUInt*)(memory_realloc(ptr ? _array_header(ptr) : 0, (size_t)(b) * ncap + 2 * sizeof(fastObjUInt)));
     if (!r)
         return 0;
 
@@ -285,6 +430,21 @@ static void* array_realloc(void* ptr, fastObjUInt n, fastObjUInt b)
 }
 
 
+/* Keeps the array intact when it cannot grow */
+static int array_grow(void** arr, fastObjUInt n, fastObjUInt b)
+{
+    void* r;
+
+
+    r = array_realloc(*arr, n, b);
+    if (!r)
+        return 0;
+
+    *arr = r;
+    return 1;
+}
+
+
 static
 void* file_open(const char* path, void* user_data)
 {
@@ -315,28 +475,218 @@ size_t file_read(void* file, void* dst, size_t bytes, void* user_data)
 }
 
 
+/* 64-bit seeks where available; plain ftell is limited to long */
+#if defined(_WIN32)
+#define FAST_OBJ_FSEEK(_f, _o, _w)  _fseeki64(_f, _o, _w)
+#define FAST_OBJ_FTELL(_f)          _ftelli64(_f)
+typedef long long fastObjOffset;
+#elif defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200112L
+#define FAST_OBJ_FSEEK(_f, _o, _w)  fseeko(_f, _o, _w)
+#define FAST_OBJ_FTELL(_f)          ftello(_f)
+typedef off_t fastObjOffset;
+#else
+#define FAST_OBJ_FSEEK(_f, _o, _w)  fseek(_f, _o, _w)
+#define FAST_OBJ_FTELL(_f)          ftell(_f)
+typedef long fastObjOffset;
+#endif
+
+
+/* Sizes past ULONG_MAX (4 GB where long is 32-bit) come back as ULONG_MAX,
+   which callers treat as too large to read whole */
+static
+unsigned long clamp_file_size(unsigned long long n)
+{
+    return n < ULONG_MAX ? (unsigned long)(n) : ULONG_MAX;
+}
+
+
 static
 unsigned long file_size(void* file, void* user_data)
 {
     FILE* f;
-    long p;
-    long n;
+    fastObjOffset p;
+    fastObjOffset n;
     (void)(user_data);
 	
     f = (FILE*)(file);
 
-    p = ftell(f);
-    fseek(f, 0, SEEK_END);
-    n = ftell(f);
-    fseek(f, p, SEEK_SET);
+    p = FAST_OBJ_FTELL(f);
+    FAST_OBJ_FSEEK(f, 0, SEEK_END);
+    n = FAST_OBJ_FTELL(f);
+    FAST_OBJ_FSEEK(f, p, SEEK_SET);
 
     if (n > 0)
-        return (unsigned long)(n);
+        return clamp_file_size((unsigned long long)(n));
     else
         return 0;
 }
 
 
+/* Native file handles for the mapped reader. On POSIX the descriptor is
+   stored off by one so that a valid descriptor 0 is not mistaken for failure. */
+#ifdef _WIN32
+
+static
+void* mapped_file_open(const char* path, void* user_data)
+{
+    HANDLE h;
+    (void)(user_data);
+
+    h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    return (h == INVALID_HANDLE_VALUE) ? 0 : (void*)(h);
+}
+
+
+static
+void mapped_file_close(void* file, void* user_data)
+{
+    (void)(user_data);
+    CloseHandle((HANDLE)(file));
+}
+
+
+static
+size_t mapped_file_read(void* file, void* dst, size_t bytes, void* user_data)
+{
+    DWORD read;
+    (void)(user_data);
+
+    if (!ReadFile((HANDLE)(file), dst, (DWORD)(bytes), &read, 0))
+        return 0;
+
+    return (size_t)(read);
+}
+
+
+static
+unsigned long mapped_file_size(void* file, void* user_data)
+{
+    LARGE_INTEGER n;
+    (void)(user_data);
+
+    if (!GetFileSizeEx((HANDLE)(file), &n) || n.QuadPart <= 0)
+        return 0;
+
+    return clamp_file_size((unsigned long long)(n.QuadPart));
+}
+
+
+static
+void* mapped_file_map(void* file, size_t* size, void* user_data)
+{
+    LARGE_INTEGER n;
+    HANDLE        mapping;
+    void*         p;
+    (void)(user_data);
+
+    /* Files larger than the address space are read instead */
+    if (!GetFileSizeEx((HANDLE)(file), &n) || n.QuadPart <= 0 || (unsigned long long)(n.QuadPart) > SIZE_MAX)
+        return 0;
+
+    mapping = CreateFileMappingA((HANDLE)(file), 0, PAGE_READONLY, 0, 0, 0);
+    if (!mapping)
+        return 0;
+
+    /* The view keeps the mapping alive after the handle is closed */
+    p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    if (p)
+        *size = (size_t)(n.QuadPart);
+
+    return p;
+}
+
+
+static
+void mapped_file_unmap(void* file, void* data, size_t size, void* user_data)
+{
+    (void)(file);
+    (void)(size);
+    (void)(user_data);
+
+    UnmapViewOfFile(data);
+}
+
+#else
+
+static
+void* mapped_file_open(const char* path, void* user_data)
+{
+    int fd;
+    (void)(user_data);
+
+    fd = open(path, O_RDONLY);
+    return (fd < 0) ? 0 : (void*)((size_t)(fd) + 1);
+}
+
+
+static
+void mapped_file_close(void* file, void* user_data)
+{
+    (void)(user_data);
+    close((int)((size_t)(file) - 1));
+}
+
+
+static
+size_t mapped_file_read(void* file, void* dst, size_t bytes, void* user_data)
+{
+    ssize_t n;
+    (void)(user_data);
+
+    n = read((int)((size_t)(file) - 1), dst, bytes);
+    return (n > 0) ? (size_t)(n) : 0;
+}
+
+
+static
+unsigned long mapped_file_size(void* file, void* user_data)
+{
+    struct stat st;
+    (void)(user_data);
+
+    if (fstat((int)((size_t)(file) - 1), &st) != 0 || st.st_size <= 0)
+        return 0;
+
+    return clamp_file_size((unsigned long long)(st.st_size));
+}
+
+
+static
+void* mapped_file_map(void* file, size_t* size, void* user_data)
+{
+    struct stat st;
+    void*       p;
+    int         fd;
+    (void)(user_data);
+
+    /* Files larger than the address space are read instead */
+    fd = (int)((size_t)(file) - 1);
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || (unsigned long long)(st.st_size) > SIZE_MAX)
+        return 0;
+
+    p = mmap(0, (size_t)(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        return 0;
+
+    *size = (size_t)(st.st_size);
+    return p;
+}
+
+
+static
+void mapped_file_unmap(void* file, void* data, size_t size, void* user_data)
+{
+    (void)(file);
+    (void)(user_data);
+
+    munmap(data, size);
+}
+
+#endif
+
+
 static
 char* string_copy(const char* s, const char* e)
 {
@@ -439,103 +789,524 @@ int is_exponent(char c)
 }
 
 
+#if defined(FAST_OBJ_SSE2) || defined(FAST_OBJ_NEON)
+
 static
-const char* skip_whitespace(const char* ptr)
+unsigned int count_trailing_zeros(unsigned long long x)
 {
-    while (is_whitespace(*ptr))
-        ptr++;
-
-    return ptr;
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long r;
+    _BitScanForward64(&r, x);
+    return (unsigned int)(r);
+#elif defined(__GNUC__) || defined(__clang__)
+    return (unsigned int)(__builtin_ctzll(x));
+#else
+    unsigned int r = 0;
+    while (!(x & 1))
+    {
+        x >>= 1;
+        r++;
+    }
+    return r;
+#endif
 }
 
+#endif
+
 
 static
-const char* skip_line(const char* ptr)
+const char* find_newline_scalar(const char* ptr)
 {
-    while (!is_newline(*ptr++))
-        ;
+    while (!is_newline(*ptr))
+        ptr++;
 
     return ptr;
 }
 
 
+#ifdef FAST_OBJ_SSE2
+
+FAST_OBJ_NO_SANITIZE
 static
-fastObjGroup object_default(void)
+const char* find_newline_sse2(const char* ptr)
 {
-    fastObjGroup object;
+    const __m128i nl = _mm_set1_epi8('\n');
+    const char*   p;
+    unsigned int  mask;
 
-    object.name         = 0;
-    object.face_count   = 0;
-    object.face_offset  = 0;
-    object.index_offset = 0;
 
-    return object;
+    /* Aligned loads cannot fault past the page holding the newline */
+    p    = (const char*)((uintptr_t)(ptr) & ~(uintptr_t)(15));
+    mask = (unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)(p)), nl)));
+    mask &= ~0u << (ptr - p);
+
+    while (!mask)
+    {
+        p += 16;
+        mask = (unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)(p)), nl)));
+    }
+
+    return p + count_trailing_zeros(mask);
 }
 
+#endif
+
 
+#ifdef FAST_OBJ_AVX2
+
+FAST_OBJ_NO_SANITIZE FAST_OBJ_TARGET_AVX2
 static
-void object_clean(fastObjGroup* object)
+const char* find_newline_avx2(const char* ptr)
 {
-    memory_dealloc(object->name);
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const char*   p;
+    unsigned int  mask;
+
+
+    p    = (const char*)((uintptr_t)(ptr) & ~(uintptr_t)(31));
+    mask = (unsigned int)(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i*)(p)), nl)));
+    mask &= ~0u << (ptr - p);
+
+    while (!mask)
+    {
+        p += 32;
+        mask = (unsigned int)(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i*)(p)), nl)));
+    }
+
+    return p + count_trailing_zeros(mask);
 }
 
 
 static
-void flush_object(fastObjData* data)
+int cpu_has_avx2(void)
 {
-    /* Add object if not empty */
-    if (data->object.face_count > 0)
-        array_push(data->mesh->objects, data->object);
-    else
-        object_clean(&data->object);
+#if defined(_MSC_VER)
+    int info[4];
 
-    /* Reset for more data */
-    data->object = object_default();
-    data->object.face_offset  = array_size(data->mesh->face_vertices);
-    data->object.index_offset = array_size(data->mesh->indices);
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return 0;
+
+    /* OSXSAVE and AVX, then check the OS saves YMM state */
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+        return 0;
+
+    if ((_xgetbv(0) & 6) != 6)
+        return 0;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
 }
 
+#endif
+
 
+#ifdef FAST_OBJ_NEON
 
+FAST_OBJ_NO_SANITIZE
 static
-fastObjGroup group_default(void)
+const char* find_newline_neon(const char* ptr)
 {
-    fastObjGroup group;
+    const uint8x16_t   nl = vdupq_n_u8('\n');
+    const char*        p;
+    unsigned long long mask;
 
-    group.name         = 0;
-    group.face_count   = 0;
-    group.face_offset  = 0;
-    group.index_offset = 0;
 
-    return group;
-}
+    /* Narrowing shift packs the compare result into 4 bits per byte */
+    p    = (const char*)((uintptr_t)(ptr) & ~(uintptr_t)(15));
+    mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vceqq_u8(vld1q_u8((const uint8_t*)(p)), nl)), 4)), 0);
+    mask &= ~0ull << (4 * (ptr - p));
 
+    while (!mask)
+    {
+        p += 16;
+        mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vceqq_u8(vld1q_u8((const uint8_t*)(p)), nl)), 4)), 0);
+    }
 
-static
-void group_clean(fastObjGroup* group)
-{
-    memory_dealloc(group->name);
+    return p + count_trailing_zeros(mask) / 4;
 }
 
+#endif
 
-static
-void flush_group(fastObjData* data)
+
+/* Mapped files are counted before parsing so the mesh arrays are allocated
+   once; define FAST_OBJ_NO_PRECOUNT to grow them while parsing instead */
+#ifndef FAST_OBJ_NO_PRECOUNT
+
+/* One bit per byte of a 64 byte block, for the counting pass */
+typedef struct
 {
-    /* Add group if not empty */
-    if (data->group.face_count > 0)
-        array_push(data->mesh->groups, data->group);
-    else
-        group_clean(&data->group);
+    unsigned long long          newline;
+    unsigned long long          blank;
+    unsigned long long          ret;
+    unsigned long long          v;
+    unsigned long long          f;
+    unsigned long long          t;
+    unsigned long long          n;
 
-    /* Reset for more data */
-    data->group = group_default();
-    data->group.face_offset  = array_size(data->mesh->face_vertices);
-    data->group.index_offset = array_size(data->mesh->indices);
-}
+} fastObjClasses;
 
 
 static
-const char* parse_int(const char* ptr, int* val)
+unsigned int count_bits(unsigned long long x)
+{
+#if defined(__POPCNT__)
+    return (unsigned int)(__builtin_popcountll(x));
+#else
+    unsigned int r = 0;
+
+    /* The masks counted hold a bit or two per line, so clearing the lowest
+       set bit beats both a SWAR count and the compiler's library call */
+    while (x)
+    {
+        x &= x - 1;
+        r++;
+    }
+
+    return r;
+#endif
+}
+
+
+static
+void classify_scalar(const char* ptr, fastObjClasses* c)
+{
+    unsigned long long bit;
+    unsigned int       ii;
+
+
+    memset(c, 0, sizeof(*c));
+
+    for (ii = 0; ii < 64; ii++)
+    {
+        bit = 1ull << ii;
+
+        switch (ptr[ii])
+        {
+        case '\n': c->newline |= bit; break;
+        case ' ':
+        case '\t': c->blank   |= bit; break;
+        case '\r': c->ret     |= bit; break;
+        case 'v':  c->v       |= bit; break;
+        case 'f':  c->f       |= bit; break;
+        case 't':  c->t       |= bit; break;
+        case 'n':  c->n       |= bit; break;
+        }
+    }
+}
+
+
+#ifdef FAST_OBJ_SSE2
+
+static
+void classify_sse2(const char* ptr, fastObjClasses* c)
+{
+    const __m128i      nl = _mm_set1_epi8('\n');
+    const __m128i      sp = _mm_set1_epi8(' ');
+    const __m128i      tb = _mm_set1_epi8('\t');
+    const __m128i      cr = _mm_set1_epi8('\r');
+    const __m128i      cv = _mm_set1_epi8('v');
+    const __m128i      cf = _mm_set1_epi8('f');
+    const __m128i      ct = _mm_set1_epi8('t');
+    const __m128i      cn = _mm_set1_epi8('n');
+    __m128i            x;
+    unsigned int       ii;
+
+
+    memset(c, 0, sizeof(*c));
+
+    for (ii = 0; ii < 4; ii++)
+    {
+        x = _mm_loadu_si128((const __m128i*)(ptr + 16 * ii));
+
+        c->newline |= (unsigned long long)(unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi8(x, nl))) << (16 * ii);
+        c->blank   |= (unsigned long long)(unsigned int)(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, sp), _mm_cmpeq_epi8(x, tb)))) << (16 * ii);
+        c->ret     |= (unsigned long long)(unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi8(x, cr))) << (16 * ii);
+        c->v       |= (unsigned long long)(unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi8(x, cv))) << (16 * ii);
+        c->f       |= (unsigned long long)(unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi8(x, cf))) << (16 * ii);
+        c->t       |= (unsigned long long)(unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi8(x, ct))) << (16 * ii);
+        c->n       |= (unsigned long long)(unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi8(x, cn))) << (16 * ii);
+    }
+}
+
+#endif
+
+
+#ifdef FAST_OBJ_AVX2
+
+FAST_OBJ_TARGET_AVX2
+static
+void classify_avx2(const char* ptr, fastObjClasses* c)
+{
+    const __m256i      nl = _mm256_set1_epi8('\n');
+    const __m256i      sp = _mm256_set1_epi8(' ');
+    const __m256i      tb = _mm256_set1_epi8('\t');
+    const __m256i      cr = _mm256_set1_epi8('\r');
+    const __m256i      cv = _mm256_set1_epi8('v');
+    const __m256i      cf = _mm256_set1_epi8('f');
+    const __m256i      ct = _mm256_set1_epi8('t');
+    const __m256i      cn = _mm256_set1_epi8('n');
+    __m256i            lo;
+    __m256i            hi;
+
+
+    lo = _mm256_loadu_si256((const __m256i*)(ptr));
+    hi = _mm256_loadu_si256((const __m256i*)(ptr + 32));
+
+#define FAST_OBJ_MASK(_m) ((unsigned long long)(unsigned int)(_mm256_movemask_epi8(_m)))
+#define FAST_OBJ_BITS(_f) (FAST_OBJ_MASK(_f(lo)) | (FAST_OBJ_MASK(_f(hi)) << 32))
+#define FAST_OBJ_NL(_x)   _mm256_cmpeq_epi8(_x, nl)
+#define FAST_OBJ_SP(_x)   _mm256_or_si256(_mm256_cmpeq_epi8(_x, sp), _mm256_cmpeq_epi8(_x, tb))
+#define FAST_OBJ_CR(_x)   _mm256_cmpeq_epi8(_x, cr)
+#define FAST_OBJ_V(_x)    _mm256_cmpeq_epi8(_x, cv)
+#define FAST_OBJ_F(_x)    _mm256_cmpeq_epi8(_x, cf)
+#define FAST_OBJ_T(_x)    _mm256_cmpeq_epi8(_x, ct)
+#define FAST_OBJ_N(_x)    _mm256_cmpeq_epi8(_x, cn)
+
+    c->newline = FAST_OBJ_BITS(FAST_OBJ_NL);
+    c->blank   = FAST_OBJ_BITS(FAST_OBJ_SP);
+    c->ret     = FAST_OBJ_BITS(FAST_OBJ_CR);
+    c->v       = FAST_OBJ_BITS(FAST_OBJ_V);
+    c->f       = FAST_OBJ_BITS(FAST_OBJ_F);
+    c->t       = FAST_OBJ_BITS(FAST_OBJ_T);
+    c->n       = FAST_OBJ_BITS(FAST_OBJ_N);
+
+#undef FAST_OBJ_N
+#undef FAST_OBJ_T
+#undef FAST_OBJ_F
+#undef FAST_OBJ_V
+#undef FAST_OBJ_CR
+#undef FAST_OBJ_SP
+#undef FAST_OBJ_NL
+#undef FAST_OBJ_BITS
+#undef FAST_OBJ_MASK
+}
+
+#endif
+
+
+#ifdef FAST_OBJ_NEON
+
+static
+unsigned long long neon_bitmask(uint8x16_t m0, uint8x16_t m1, uint8x16_t m2, uint8x16_t m3)
+{
+    static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t     w = vld1q_u8(weights);
+    uint8x16_t           a;
+    uint8x16_t           b;
+
+
+    /* Pairwise adds fold each weighted byte lane into one bit per byte */
+    a = vpaddq_u8(vandq_u8(m0, w), vandq_u8(m1, w));
+    b = vpaddq_u8(vandq_u8(m2, w), vandq_u8(m3, w));
+    a = vpaddq_u8(a, b);
+    a = vpaddq_u8(a, a);
+
+    return vgetq_lane_u64(vreinterpretq_u64_u8(a), 0);
+}
+
+
+static
+void classify_neon(const char* ptr, fastObjClasses* c)
+{
+    uint8x16_t x0 = vld1q_u8((const uint8_t*)(ptr));
+    uint8x16_t x1 = vld1q_u8((const uint8_t*)(ptr + 16));
+    uint8x16_t x2 = vld1q_u8((const uint8_t*)(ptr + 32));
+    uint8x16_t x3 = vld1q_u8((const uint8_t*)(ptr + 48));
+
+#define FAST_OBJ_EQ(_x, _c) vceqq_u8(_x, vdupq_n_u8(_c))
+#define FAST_OBJ_BLANK(_x)  vorrq_u8(FAST_OBJ_EQ(_x, ' '), FAST_OBJ_EQ(_x, '\t'))
+
+    c->newline = neon_bitmask(FAST_OBJ_EQ(x0, '\n'), FAST_OBJ_EQ(x1, '\n'), FAST_OBJ_EQ(x2, '\n'), FAST_OBJ_EQ(x3, '\n'));
+    c->blank   = neon_bitmask(FAST_OBJ_BLANK(x0),    FAST_OBJ_BLANK(x1),    FAST_OBJ_BLANK(x2),    FAST_OBJ_BLANK(x3));
+    c->ret     = neon_bitmask(FAST_OBJ_EQ(x0, '\r'), FAST_OBJ_EQ(x1, '\r'), FAST_OBJ_EQ(x2, '\r'), FAST_OBJ_EQ(x3, '\r'));
+    c->v       = neon_bitmask(FAST_OBJ_EQ(x0, 'v'),  FAST_OBJ_EQ(x1, 'v'),  FAST_OBJ_EQ(x2, 'v'),  FAST_OBJ_EQ(x3, 'v'));
+    c->f       = neon_bitmask(FAST_OBJ_EQ(x0, 'f'),  FAST_OBJ_EQ(x1, 'f'),  FAST_OBJ_EQ(x2, 'f'),  FAST_OBJ_EQ(x3, 'f'));
+    c->t       = neon_bitmask(FAST_OBJ_EQ(x0, 't'),  FAST_OBJ_EQ(x1, 't'),  FAST_OBJ_EQ(x2, 't'),  FAST_OBJ_EQ(x3, 't'));
+    c->n       = neon_bitmask(FAST_OBJ_EQ(x0, 'n'),  FAST_OBJ_EQ(x1, 'n'),  FAST_OBJ_EQ(x2, 'n'),  FAST_OBJ_EQ(x3, 'n'));
+
+#undef FAST_OBJ_BLANK
+#undef FAST_OBJ_EQ
+}
+
+#endif
+
+
+static void (*classify_block)(const char*, fastObjClasses*) = classify_scalar;
+
+#endif
+
+
+/* Chosen once per process by select_kernels */
+static const char* (*find_newline)(const char*) = find_newline_scalar;
+
+
+static
+void pick_kernels(void)
+{
+#if defined(FAST_OBJ_AVX2)
+    find_newline = cpu_has_avx2() ? find_newline_avx2 : find_newline_sse2;
+#elif defined(FAST_OBJ_SSE2)
+    find_newline = find_newline_sse2;
+#elif defined(FAST_OBJ_NEON)
+    find_newline = find_newline_neon;
+#else
+    find_newline = find_newline_scalar;
+#endif
+
+#ifndef FAST_OBJ_NO_PRECOUNT
+#if defined(FAST_OBJ_AVX2)
+    classify_block = cpu_has_avx2() ? classify_avx2 : classify_sse2;
+#elif defined(FAST_OBJ_SSE2)
+    classify_block = classify_sse2;
+#elif defined(FAST_OBJ_NEON)
+    classify_block = classify_neon;
+#else
+    classify_block = classify_scalar;
+#endif
+#endif
+}
+
+
+#ifdef _WIN32
+
+static INIT_ONCE kernels_once = INIT_ONCE_STATIC_INIT;
+
+
+static
+BOOL CALLBACK pick_kernels_once(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+    (void)(once);
+    (void)(param);
+    (void)(context);
+
+    pick_kernels();
+    return TRUE;
+}
+
+#else
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+#endif
+
+
+/* The kernel pointers are written once, before the first read uses them, so
+   reads running on several threads never write them concurrently */
+static
+void select_kernels(void)
+{
+#ifdef _WIN32
+    InitOnceExecuteOnce(&kernels_once, pick_kernels_once, 0, 0);
+#else
+    pthread_once(&kernels_once, pick_kernels);
+#endif
+}
+
+
+static
+const char* skip_whitespace(const char* ptr)
+{
+    while (is_whitespace(*ptr))
+        ptr++;
+
+    return ptr;
+}
+
+
+static
+const char* skip_line(const char* ptr)
+{
+    /* Parsed lines usually stop right at the newline */
+    if (is_newline(*ptr))
+        return ptr + 1;
+
+    return find_newline(ptr) + 1;
+}
+
+
+static
+fastObjGroup object_default(void)
+{
+    fastObjGroup object;
+
+    object.name         = 0;
+    object.face_count   = 0;
+    object.face_offset  = 0;
+    object.index_offset = 0;
+
+    return object;
+}
+
+
+static
+void object_clean(fastObjGroup* object)
+{
+    memory_dealloc(object->name);
+}
+
+
+static
+void flush_object(fastObjData* data)
+{
+    /* Add object if not empty */
+    if (data->object.face_count > 0)
+        array_push(data->mesh->objects, data->object);
+    else
+        object_clean(&data->object);
+
+    /* Reset for more data */
+    data->object = object_default();
+    data->object.face_offset  = data->face_callback ? data->streamed_faces   : array_size(data->mesh->face_vertices);
+    data->object.index_offset = data->face_callback ? data->streamed_indices : array_size(data->mesh->indices);
+}
+
+
+
+static
+fastObjGroup group_default(void)
+{
+    fastObjGroup group;
+
+    group.name         = 0;
+    group.face_count   = 0;
+    group.face_offset  = 0;
+    group.index_offset = 0;
+
+    return group;
+}
+
+
+static
+void group_clean(fastObjGroup* group)
+{
+    memory_dealloc(group->name);
+}
+
+
+static
+void flush_group(fastObjData* data)
+{
+    /* Add group if not empty */
+    if (data->group.face_count > 0)
+        array_push(data->mesh->groups, data->group);
+    else
+        group_clean(&data->group);
+
+    /* Reset for more data */
+    data->group = group_default();
+    data->group.face_offset  = data->face_callback ? data->streamed_faces   : array_size(data->mesh->face_vertices);
+    data->group.index_offset = data->face_callback ? data->streamed_indices : array_size(data->mesh->indices);
+}
+
+
+static
+const char* parse_int(const char* ptr, int* val)
 {
     int sign;
     int num;
@@ -561,6 +1332,34 @@ const char* parse_int(const char* ptr, int* val)
 }
 
 
+/* Indices are read wide so that values past 2^31 do not overflow */
+static
+const char* parse_index(const char* ptr, long long* val)
+{
+    long long          sign;
+    unsigned long long num;
+
+
+    if (*ptr == '-')
+    {
+        sign = -1;
+        ptr++;
+    }
+    else
+    {
+        sign = +1;
+    }
+
+    num = 0;
+    while (is_digit(*ptr))
+        num = 10 * num + (unsigned long long)(*ptr++ - '0');
+
+    *val = sign * (long long)(num);
+
+    return ptr;
+}
+
+
 static
 const char* parse_float(const char* ptr, float* val)
 {
@@ -698,11 +1497,12 @@ const char* parse_normal(fastObjData* data, const char* ptr)
 static
 const char* parse_face(fastObjData* data, const char* ptr)
 {
-    unsigned int count;
-    fastObjIndex vn;
-    int          v;
-    int          t;
-    int          n;
+    unsigned int    count;
+    fastObjIndex    vn;
+    fastObjRelative rel;
+    long long       v;
+    long long       t;
+    long long       n;
 
 
     ptr = skip_whitespace(ptr);
@@ -714,47 +1514,88 @@ const char* parse_face(fastObjData* data, const char* ptr)
         t = 0;
         n = 0;
 
-        ptr = parse_int(ptr, &v);
+        ptr = parse_index(ptr, &v);
         if (*ptr == '/')
         {
             ptr++;
             if (*ptr != '/')
-                ptr = parse_int(ptr, &t);
+                ptr = parse_index(ptr, &t);
 
             if (*ptr == '/')
             {
                 ptr++;
-                ptr = parse_int(ptr, &n);
+                ptr = parse_index(ptr, &n);
             }
         }
 
+        rel.mask = 0;
+
         if (v < 0)
+        {
             vn.p = (array_size(data->mesh->positions) / 3) - (fastObjUInt)(-v);
+            rel.mask |= 1;
+        }
         else
             vn.p = (fastObjUInt)(v);
 
         if (t < 0)
+        {
             vn.t = (array_size(data->mesh->texcoords) / 2) - (fastObjUInt)(-t);
+            rel.mask |= 2;
+        }
         else if (t > 0)
             vn.t = (fastObjUInt)(t);
         else
             vn.t = 0;
 
         if (n < 0)
+        {
             vn.n = (array_size(data->mesh->normals) / 3) - (fastObjUInt)(-n);
+            rel.mask |= 4;
+        }
         else if (n > 0)
             vn.n = (fastObjUInt)(n);
         else
             vn.n = 0;
 
-        array_push(data->mesh->indices, vn);
+        /* Relative indices are resolved against this chunk's vertex counts;
+           remember them so the merge can offset them by earlier chunks */
+        if (rel.mask && data->deferred)
+        {
+            rel.index = array_size(data->mesh->indices);
+            array_push(data->relative, rel);
+        }
+
+        if (data->face_callback)
+            array_push(data->face_indices, vn);
+        else
+            array_push(data->mesh->indices, vn);
+
         count++;
 
         ptr = skip_whitespace(ptr);
     }
 
-    array_push(data->mesh->face_vertices, count);
-    array_push(data->mesh->face_materials, data->material);
+    if (data->face_callback)
+    {
+        /* Counts cover the attributes parsed so far */
+        data->mesh->position_count = array_size(data->mesh->positions) / 3;
+        data->mesh->texcoord_count = array_size(data->mesh->texcoords) / 2;
+        data->mesh->normal_count   = array_size(data->mesh->normals) / 3;
+
+        data->face_callback(data->mesh, data->face_indices, count, data->material, data->face_user_data);
+
+        if (data->face_indices)
+            _array_size(data->face_indices) = 0;
+
+        data->streamed_faces++;
+        data->streamed_indices += count;
+    }
+    else
+    {
+        array_push(data->mesh->face_vertices, count);
+        array_push(data->mesh->face_materials, data->material);
+    }
 
     data->group.face_count++;
     data->object.face_count++;
@@ -994,24 +1835,26 @@ const char* read_map(fastObjData* data, const char* ptr, fastObjTexture* map)
 static
 int read_mtllib(fastObjData* data, void* file, const fastObjCallbacks* callbacks, void* user_data)
 {
-    unsigned long   n;
-    const char*     s;
-    char*           contents;
-    size_t          l;
-    const char*     p;
-    const char*     e;
-    int             found_d;
-    fastObjMaterial mtl;
+    unsigned long      n;
+    const char*        s;
+    char*              contents;
+    size_t             l;
+    const char*        p;
+    const char*        e;
+    int                found_d;
+    fastObjMaterial    mtl;
 
 
     /* Read entire file */
     n = callbacks->file_size(file, user_data);
+    if (n == ULONG_MAX || n >= SIZE_MAX)
+        return 0;
 
-    contents = (char*)(memory_realloc(0, n + 1));
+    contents = (char*)(memory_realloc(0, (size_t)(n) + 1));
     if (!contents)
         return 0;
 
-    l = callbacks->file_read(file, contents, n, user_data);
+    l = callbacks->file_read(file, contents, (size_t)(n), user_data);
     contents[l] = '\n';
 
     mtl = mtl_default();
@@ -1217,6 +2060,28 @@ const char* parse_mtllib(fastObjData* data, const char* ptr, const fastObjCallba
 }
 
 
+static
+const char* defer_line(fastObjData* data, char type, const char* ptr)
+{
+    fastObjEvent event;
+
+
+    event.type  = type;
+    event.ptr   = ptr;
+    event.face  = array_size(data->mesh->face_vertices);
+    event.index = array_size(data->mesh->indices);
+
+    array_push(data->events, event);
+
+    /* Faces store the chunk-local usemtl ordinal until the merge, with
+       0 meaning the material active at the start of the chunk */
+    if (type == 'u')
+        data->material++;
+
+    return ptr;
+}
+
+
 static
 void parse_buffer(fastObjData* data, const char* ptr, const char* end, const fastObjCallbacks* callbacks, void* user_data)
 {
@@ -1275,7 +2140,7 @@ void parse_buffer(fastObjData* data, const char* ptr, const char* end, const fas
             {
             case ' ':
             case '\t':
-                p = parse_object(data, p);
+                p = data->deferred ? defer_line(data, 'o', p) : parse_object(data, p);
                 break;
 
             default:
@@ -1290,7 +2155,7 @@ void parse_buffer(fastObjData* data, const char* ptr, const char* end, const fas
             {
             case ' ':
             case '\t':
-                p = parse_group(data, p);
+                p = data->deferred ? defer_line(data, 'g', p) : parse_group(data, p);
                 break;
 
             default:
@@ -1306,7 +2171,7 @@ void parse_buffer(fastObjData* data, const char* ptr, const char* end, const fas
                 p[3] == 'i' &&
                 p[4] == 'b' &&
                 is_whitespace(p[5]))
-                p = parse_mtllib(data, p + 5, callbacks, user_data);
+                p = data->deferred ? defer_line(data, 'm', p + 5) : parse_mtllib(data, p + 5, callbacks, user_data);
             break;
 
         case 'u':
@@ -1317,7 +2182,7 @@ void parse_buffer(fastObjData* data, const char* ptr, const char* end, const fas
                 p[3] == 't' &&
                 p[4] == 'l' &&
                 is_whitespace(p[5]))
-                p = parse_usemtl(data, p + 5);
+                p = data->deferred ? defer_line(data, 'u', p + 5) : parse_usemtl(data, p + 5);
             break;
 
         case '#':
@@ -1331,68 +2196,217 @@ void parse_buffer(fastObjData* data, const char* ptr, const char* end, const fas
 }
 
 
-void fast_obj_destroy(fastObjMesh* m)
-{
-    unsigned int ii;
+#ifdef FAST_OBJ_NO_PRECOUNT
 
+/* Without a counting pass the file size bounds the element counts: "v\n"
+   adds three floats for every two bytes */
+static
+int size_fits(unsigned long long size)
+{
+    return size / 2 < FAST_OBJ_UINT_MAX / 3 - 16;
+}
 
-    for (ii = 0; ii < array_size(m->objects); ii++)
-        object_clean(&m->objects[ii]);
+#endif
 
-    for (ii = 0; ii < array_size(m->groups); ii++)
-        group_clean(&m->groups[ii]);
 
-    for (ii = 0; ii < array_size(m->materials); ii++)
-        mtl_clean(&m->materials[ii]);
+/* Element totals must leave room for the dummy elements and rounding */
+static
+int counts_fit(const fastObjCounts* counts)
+{
+    unsigned long long limit;
 
-    array_clean(m->positions);
-    array_clean(m->texcoords);
-    array_clean(m->normals);
-    array_clean(m->face_vertices);
-    array_clean(m->face_materials);
-    array_clean(m->indices);
-    array_clean(m->objects);
-    array_clean(m->groups);
-    array_clean(m->materials);
 
-    memory_dealloc(m);
+    limit = FAST_OBJ_UINT_MAX / 3 - 16;
+
+    return counts->positions < limit &&
+           counts->texcoords < limit &&
+           counts->normals   < limit &&
+           counts->faces     < limit &&
+           counts->indices   < limit;
 }
 
 
-fastObjMesh* fast_obj_read(const char* path)
+/* Streaming checks each buffer before parsing it: the counts so far plus
+   the most the buffer could add */
+static
+int buffer_fits(const fastObjData* data, size_t bytes)
 {
-    fastObjCallbacks callbacks;
-    callbacks.file_open = file_open;
-    callbacks.file_close = file_close;
-    callbacks.file_read = file_read;
-    callbacks.file_size = file_size;
+    fastObjCounts counts;
 
-    return fast_obj_read_with_callbacks(path, &callbacks, 0);
+
+    counts.positions = array_size(data->mesh->positions) / 3 + bytes / 2;
+    counts.texcoords = array_size(data->mesh->texcoords) / 2 + bytes / 2;
+    counts.normals   = array_size(data->mesh->normals) / 3 + bytes / 2;
+    counts.faces     = array_size(data->mesh->face_vertices) + bytes / 2;
+    counts.indices   = array_size(data->mesh->indices) + bytes / 2;
+
+    return counts_fit(&counts);
 }
 
 
-fastObjMesh* fast_obj_read_with_callbacks(const char* path, const fastObjCallbacks* callbacks, void* user_data)
+#ifndef FAST_OBJ_NO_PRECOUNT
+
+static
+void count_buffer(fastObjCounts* counts, const char* ptr, const char* end)
 {
-    fastObjData  data;
-    fastObjMesh* m;
-    void*        file;
-    char*        buffer;
-    char*        start;
-    char*        end;
-    char*        last;
-    fastObjUInt  read;
-    fastObjUInt  bytes;
+    fastObjClasses     c;
+    char               pad[64];
+    const char*        p;
+    unsigned long long space;
+    unsigned long long starts;
+    unsigned long long vs;
+    unsigned long long fs;
+    unsigned long long after_v;
+    unsigned long long after_f;
+    unsigned long long faces;
+    unsigned long long inside;
+    unsigned long long tokens;
+    unsigned long long last_newline;
+    unsigned long long last_v;
+    unsigned long long last_f;
+    unsigned long long last_space;
+    unsigned long long open_face;
+    size_t             bytes;
+
+
+    /* Counts 'v', 'vt', 'vn' and 'f' lines starting in the first column and
+       the whitespace separated tokens on face lines, 64 bytes at a time.
+       Anything missed (e.g. indented lines) only means the arrays grow
+       while parsing, as they would without this pass. */
+    last_newline = 1;
+    last_v       = 0;
+    last_f       = 0;
+    last_space   = 1;
+    open_face    = 0;
 
-    /* Check if callbacks are valid */
-    if(!callbacks)
-        return 0;
+    p = ptr;
+    while (p < end)
+    {
+        bytes = (size_t)(end - p);
+        if (bytes >= 64)
+        {
+            classify_block(p, &c);
+        }
+        else
+        {
+            /* Pad the final block with newlines, which start nothing */
+            memset(pad, '\n', sizeof(pad));
+            memcpy(pad, p, bytes);
+            classify_block(pad, &c);
+        }
 
+        space  = c.blank | c.ret | c.newline;
+        starts = (c.newline << 1) | last_newline;
+        vs     = starts & c.v;
+        fs     = starts & c.f;
 
-    /* Open file */
-    file = callbacks->file_open(path, user_data);
-    if (!file)
+        after_v = (vs << 1) | last_v;
+        after_f = (fs << 1) | last_f;
+
+        counts->positions += count_bits(after_v & c.blank);
+        counts->texcoords += count_bits(after_v & c.t);
+        counts->normals   += count_bits(after_v & c.n);
+
+        faces = after_f & c.blank;
+        counts->faces += count_bits(faces);
+
+        /* Subtracting a face's first blank from the newline mask borrows
+           through every byte up to the newline ending that face line */
+        inside = c.newline ^ (c.newline - (faces | open_face));
+        tokens = ~space & ((space << 1) | last_space);
+        counts->indices += count_bits(inside & tokens);
+
+        open_face    = c.newline < (faces | open_face);
+        last_newline = c.newline >> 63;
+        last_v       = vs >> 63;
+        last_f       = fs >> 63;
+        last_space   = space >> 63;
+
+        p += 64;
+    }
+}
+
+
+static
+void reserve_arrays(fastObjData* data, const fastObjCounts* counts)
+{
+    fastObjMesh* m = data->mesh;
+
+
+    array_reserve(m->positions,      3 * counts->positions);
+    array_reserve(m->texcoords,      2 * counts->texcoords);
+    array_reserve(m->normals,        3 * counts->normals);
+
+    /* Streamed faces are never stored, the totals are a sizing hint */
+    if (data->face_callback)
+    {
+        m->face_count  = counts->faces;
+        m->index_count = counts->indices;
+        return;
+    }
+
+    array_reserve(m->face_vertices,  counts->faces);
+    array_reserve(m->face_materials, counts->faces);
+    array_reserve(m->indices,        counts->indices);
+}
+
+
+static
+int presize_buffer(fastObjData* data, const char* ptr, const char* end, const char* tail, const char* tail_end)
+{
+    fastObjCounts counts;
+
+
+    memset(&counts, 0, sizeof(counts));
+
+    count_buffer(&counts, ptr, end);
+    if (tail)
+        count_buffer(&counts, tail, tail_end);
+
+    if (!counts_fit(&counts))
         return 0;
 
+    reserve_arrays(data, &counts);
+    return 1;
+}
+
+#endif
+
+
+void fast_obj_destroy(fastObjMesh* m)
+{
+    unsigned int ii;
+
+
+    for (ii = 0; ii < array_size(m->objects); ii++)
+        object_clean(&m->objects[ii]);
+
+    for (ii = 0; ii < array_size(m->groups); ii++)
+        group_clean(&m->groups[ii]);
+
+    for (ii = 0; ii < array_size(m->materials); ii++)
+        mtl_clean(&m->materials[ii]);
+
+    /* Newest arrays first, so a stack allocator can pop them */
+    array_clean(m->materials);
+    array_clean(m->groups);
+    array_clean(m->objects);
+    array_clean(m->indices);
+    array_clean(m->face_materials);
+    array_clean(m->face_vertices);
+    array_clean(m->normals);
+    array_clean(m->texcoords);
+    array_clean(m->positions);
+
+    memory_dealloc(m);
+}
+
+
+static
+fastObjMesh* mesh_begin(fastObjData* data, const char* path)
+{
+    fastObjMesh* m;
+
 
     /* Empty mesh */
     m = (fastObjMesh*)(memory_realloc(0, sizeof(fastObjMesh)));
@@ -1409,6 +2423,10 @@ fastObjMesh* fast_obj_read_with_callbacks(const char* path, const fastObjCallbac
     m->objects        = 0;
     m->groups         = 0;
 
+    /* Face callbacks read these as sizing hints before mesh_end sets them */
+    m->face_count     = 0;
+    m->index_count    = 0;
+
 
     /* Add dummy position/texcoord/normal */
     array_push(m->positions, 0.0f);
@@ -1424,12 +2442,22 @@ fastObjMesh* fast_obj_read_with_callbacks(const char* path, const fastObjCallbac
 
 
     /* Data needed during parsing */
-    data.mesh     = m;
-    data.object   = object_default();
-    data.group    = group_default();
-    data.material = 0;
-    data.line     = 1;
-    data.base     = 0;
+    data->mesh     = m;
+    data->object   = object_default();
+    data->group    = group_default();
+    data->material = 0;
+    data->line     = 1;
+    data->base     = 0;
+    data->deferred = 0;
+    data->events   = 0;
+    data->relative = 0;
+    data->failed   = 0;
+
+    data->face_callback    = 0;
+    data->face_user_data   = 0;
+    data->face_indices     = 0;
+    data->streamed_faces   = 0;
+    data->streamed_indices = 0;
 
 
     /* Find base path for materials/textures */
@@ -1441,20 +2469,63 @@ fastObjMesh* fast_obj_read_with_callbacks(const char* path, const fastObjCallbac
         const char* sep = sep2 && (!sep1 || sep1 < sep2) ? sep2 : sep1;
 
         if (sep)
-            data.base = string_substr(path, 0, sep - path + 1);
+            data->base = string_substr(path, 0, sep - path + 1);
     }
 
+    return m;
+}
+
+
+static
+void mesh_end(fastObjData* data)
+{
+    fastObjMesh* m = data->mesh;
+
+
+    /* Flush final object/group */
+    flush_object(data);
+    object_clean(&data->object);
+
+    flush_group(data);
+    group_clean(&data->group);
+
+    m->position_count = array_size(m->positions) / 3;
+    m->texcoord_count = array_size(m->texcoords) / 2;
+    m->normal_count   = array_size(m->normals) / 3;
+    m->face_count     = data->face_callback ? data->streamed_faces   : array_size(m->face_vertices);
+    m->index_count    = data->face_callback ? data->streamed_indices : array_size(m->indices);
+    m->material_count = array_size(m->materials);
+    m->object_count   = array_size(m->objects);
+    m->group_count    = array_size(m->groups);
+
+
+    /* Clean up */
+    memory_dealloc(data->base);
+    array_clean(data->face_indices);
+}
+
+
+static
+void read_streamed(fastObjData* data, void* file, const fastObjCallbacks* callbacks, void* user_data)
+{
+    char*        buffer;
+    char*        start;
+    char*        end;
+    char*        last;
+    size_t       read;
+    size_t       bytes;
+
 
     /* Create buffer for reading file */
     buffer = (char*)(memory_realloc(0, 2 * BUFFER_SIZE * sizeof(char)));
     if (!buffer)
-        return 0;
+        return;
 
     start = buffer;
     for (;;)
     {
         /* Read another buffer's worth from file */
-        read = (fastObjUInt)(callbacks->file_read(file, start, BUFFER_SIZE, user_data));
+        read = callbacks->file_read(file, start, BUFFER_SIZE, user_data);
         if (read == 0 && start == buffer)
             break;
 
@@ -1489,40 +2560,735 @@ fastObjMesh* fast_obj_read_with_callbacks(const char* path, const fastObjCallbac
 
 
         /* Process buffer */
-        parse_buffer(&data, buffer, last, callbacks, user_data);
+        if (!buffer_fits(data, (size_t)(last - buffer)))
+        {
+            data->failed = 1;
+            break;
+        }
+
+        parse_buffer(data, buffer, last, callbacks, user_data);
 
 
         /* Copy overflow for next buffer */
-        bytes = (fastObjUInt)(end - last);
+        bytes = (size_t)(end - last);
         memmove(buffer, last, bytes);
         start = buffer + bytes;
     }
 
+    memory_dealloc(buffer);
+}
 
-    /* Flush final object/group */
-    flush_object(&data);
-    object_clean(&data.object);
 
-    flush_group(&data);
-    group_clean(&data.group);
+static
+int read_mapped(fastObjData* data, void* file, const fastObjCallbacks* callbacks, void* user_data)
+{
+    char*       contents;
+    size_t      size;
+    const char* end;
+    const char* last;
+    char*       tail;
+    size_t      bytes;
 
-    m->position_count = array_size(m->positions) / 3;
-    m->texcoord_count = array_size(m->texcoords) / 2;
-    m->normal_count   = array_size(m->normals) / 3;
-    m->face_count     = array_size(m->face_vertices);
-    m->index_count    = array_size(m->indices);
-    m->material_count = array_size(m->materials);
-    m->object_count   = array_size(m->objects);
-    m->group_count    = array_size(m->groups);
+
+    size     = 0;
+    contents = (char*)(callbacks->file_map(file, &size, user_data));
+    if (!contents)
+        return 0;
+
+    /* Parse every complete line straight out of the mapping */
+    end  = contents + size;
+    last = end;
+    while (last > contents && last[-1] != '\n')
+        last--;
+
+
+    /* The mapping is read-only, so a final line without a newline is
+       copied out and terminated before parsing */
+    bytes = (size_t)(end - last);
+    tail  = 0;
+
+    if (bytes > 0)
+    {
+        tail = (char*)(memory_realloc(0, bytes + 1));
+        if (tail)
+        {
+            memcpy(tail, last, bytes);
+            tail[bytes] = '\n';
+        }
+    }
+
+#ifndef FAST_OBJ_NO_PRECOUNT
+    if (!presize_buffer(data, contents, last, tail, tail ? tail + bytes + 1 : 0))
+        data->failed = 1;
+#else
+    if (!size_fits(size))
+        data->failed = 1;
+#endif
+
+    if (last > contents && !data->failed)
+        parse_buffer(data, contents, last, callbacks, user_data);
+
+    if (tail)
+    {
+        if (!data->failed)
+            parse_buffer(data, tail, tail + bytes + 1, callbacks, user_data);
+
+        memory_dealloc(tail);
+    }
+
+    if (callbacks->file_unmap)
+        callbacks->file_unmap(file, contents, size, user_data);
+
+    return 1;
+}
+
+
+typedef struct
+{
+    /* Lines to parse */
+    const char*                 start;
+    const char*                 end;
+
+    /* Chunk-local parse state and arrays */
+    fastObjData                 data;
+
+    /* Merged material for each usemtl ordinal in the chunk */
+    unsigned int*               materials;
+
+    /* Elements before this chunk in the merged arrays */
+    fastObjUInt                 position_offset;
+    fastObjUInt                 texcoord_offset;
+    fastObjUInt                 normal_offset;
+    fastObjUInt                 face_offset;
+    fastObjUInt                 index_offset;
+
+    /* Merged mesh */
+    fastObjMesh*                mesh;
+
+    /* 0 = parse, 1 = copy into merged mesh */
+    int                         stage;
+
+    const fastObjCallbacks*     callbacks;
+    void*                       user_data;
+
+} fastObjChunk;
+
+
+static
+void chunk_parse(fastObjChunk* chunk)
+{
+    /* Chunk arrays are created on the worker thread, so a custom allocator
+       only ever sees a chunk's arrays from one thread until the merge */
+    if (!mesh_begin(&chunk->data, ""))
+        return;
+
+    chunk->data.deferred = 1;
+
+#ifndef FAST_OBJ_NO_PRECOUNT
+    if (!presize_buffer(&chunk->data, chunk->start, chunk->end, 0, 0))
+    {
+        chunk->data.failed = 1;
+        return;
+    }
+#else
+    if (!size_fits((unsigned long long)(chunk->end - chunk->start)))
+    {
+        chunk->data.failed = 1;
+        return;
+    }
+#endif
+
+    parse_buffer(&chunk->data, chunk->start, chunk->end, chunk->callbacks, chunk->user_data);
+}
+
+
+static
+void chunk_copy(fastObjChunk* chunk)
+{
+    const fastObjMesh* c;
+    fastObjMesh*       m;
+    fastObjIndex*      idx;
+    fastObjUInt        ii;
+    fastObjUInt        n;
+
+
+    c = chunk->data.mesh;
+    m = chunk->mesh;
+
+    /* Vertex data, skipping the chunk's dummy elements */
+    memcpy(m->positions + 3 * (1 + chunk->position_offset), c->positions + 3, (array_size(c->positions) - 3) * sizeof(float));
+    memcpy(m->texcoords + 2 * (1 + chunk->texcoord_offset), c->texcoords + 2, (array_size(c->texcoords) - 2) * sizeof(float));
+    memcpy(m->normals   + 3 * (1 + chunk->normal_offset),   c->normals + 3,   (array_size(c->normals) - 3) * sizeof(float));
+
+    /* Face data */
+    n = array_size(c->face_vertices);
+    if (n > 0)
+        memcpy(m->face_vertices + chunk->face_offset, c->face_vertices, n * sizeof(unsigned int));
+
+    for (ii = 0; ii < n; ii++)
+        m->face_materials[chunk->face_offset + ii] = chunk->materials[c->face_materials[ii]];
+
+    /* Index data */
+    n = array_size(c->indices);
+    if (n > 0)
+        memcpy(m->indices + chunk->index_offset, c->indices, n * sizeof(fastObjIndex));
+
+    /* Relative indices were resolved against chunk-local counts */
+    for (ii = 0; ii < array_size(chunk->data.relative); ii++)
+    {
+        idx = &m->indices[chunk->index_offset + chunk->data.relative[ii].index];
+
+        if (chunk->data.relative[ii].mask & 1)
+            idx->p += chunk->position_offset;
+
+        if (chunk->data.relative[ii].mask & 2)
+            idx->t += chunk->texcoord_offset;
+
+        if (chunk->data.relative[ii].mask & 4)
+            idx->n += chunk->normal_offset;
+    }
+}
+
+
+static
+void chunk_run(fastObjChunk* chunk)
+{
+    if (chunk->stage == 0)
+        chunk_parse(chunk);
+    else
+        chunk_copy(chunk);
+}
+
+
+#ifdef _WIN32
+
+static
+DWORD WINAPI chunk_thread(LPVOID param)
+{
+    chunk_run((fastObjChunk*)(param));
+    return 0;
+}
+
+
+static
+void run_chunks(fastObjChunk* chunks, unsigned int count)
+{
+    HANDLE       threads[MAX_THREADS];
+    unsigned int ii;
+
+
+    for (ii = 1; ii < count; ii++)
+    {
+        threads[ii] = CreateThread(0, 0, chunk_thread, &chunks[ii], 0, 0);
+        if (!threads[ii])
+            chunk_run(&chunks[ii]);
+    }
+
+    chunk_run(&chunks[0]);
+
+    for (ii = 1; ii < count; ii++)
+    {
+        if (threads[ii])
+        {
+            WaitForSingleObject(threads[ii], INFINITE);
+            CloseHandle(threads[ii]);
+        }
+    }
+}
+
+
+static
+unsigned int cpu_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    return (unsigned int)(info.dwNumberOfProcessors);
+}
+
+#else
+
+static
+void* chunk_thread(void* param)
+{
+    chunk_run((fastObjChunk*)(param));
+    return 0;
+}
+
+
+static
+void run_chunks(fastObjChunk* chunks, unsigned int count)
+{
+    pthread_t    threads[MAX_THREADS];
+    int          started[MAX_THREADS];
+    unsigned int ii;
+
+
+    for (ii = 1; ii < count; ii++)
+    {
+        started[ii] = pthread_create(&threads[ii], 0, chunk_thread, &chunks[ii]) == 0;
+        if (!started[ii])
+            chunk_run(&chunks[ii]);
+    }
+
+    chunk_run(&chunks[0]);
+
+    for (ii = 1; ii < count; ii++)
+        if (started[ii])
+            pthread_join(threads[ii], 0);
+}
+
+
+static
+unsigned int cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (unsigned int)(n) : 1;
+}
+
+#endif
+
+
+static
+void merge_chunks(fastObjData* data, fastObjChunk* chunks, unsigned int count, const fastObjCallbacks* callbacks, void* user_data)
+{
+    fastObjMesh*  m;
+    fastObjMesh*  c;
+    fastObjEvent* event;
+    fastObjUInt   positions;
+    fastObjUInt   texcoords;
+    fastObjUInt   normals;
+    fastObjUInt   faces;
+    fastObjUInt   indices;
+    fastObjUInt   face;
+    fastObjUInt   index;
+    fastObjCounts totals;
+    unsigned int  ii;
+    fastObjUInt   jj;
+
+
+    m = data->mesh;
+
+    /* Prefix sums over the per-chunk counts */
+    positions = 0;
+    texcoords = 0;
+    normals   = 0;
+    faces     = 0;
+    indices   = 0;
+
+    /* Each chunk fits, but together they may not */
+    memset(&totals, 0, sizeof(totals));
+
+    for (ii = 0; ii < count; ii++)
+    {
+        c = chunks[ii].data.mesh;
+
+        totals.positions += array_size(c->positions) / 3;
+        totals.texcoords += array_size(c->texcoords) / 2;
+        totals.normals   += array_size(c->normals) / 3;
+        totals.faces     += array_size(c->face_vertices);
+        totals.indices   += array_size(c->indices);
+    }
+
+    if (!counts_fit(&totals))
+    {
+        data->failed = 1;
+        return;
+    }
+
+    for (ii = 0; ii < count; ii++)
+    {
+        c = chunks[ii].data.mesh;
+
+        chunks[ii].position_offset = positions;
+        chunks[ii].texcoord_offset = texcoords;
+        chunks[ii].normal_offset   = normals;
+        chunks[ii].face_offset     = faces;
+        chunks[ii].index_offset    = indices;
+
+        positions += array_size(c->positions) / 3 - 1;
+        texcoords += array_size(c->texcoords) / 2 - 1;
+        normals   += array_size(c->normals) / 3 - 1;
+        faces     += array_size(c->face_vertices);
+        indices   += array_size(c->indices);
+    }
+
+
+    /* Size the merged arrays exactly; the dummy elements are already there */
+    m->positions = (float*)(array_realloc(m->positions, 3 * positions, sizeof(float)));
+    m->texcoords = (float*)(array_realloc(m->texcoords, 2 * texcoords, sizeof(float)));
+    m->normals   = (float*)(array_realloc(m->normals, 3 * normals, sizeof(float)));
+
+    if (faces > 0)
+    {
+        m->face_vertices  = (unsigned int*)(array_realloc(0, faces, sizeof(unsigned int)));
+        m->face_materials = (unsigned int*)(array_realloc(0, faces, sizeof(unsigned int)));
+    }
+
+    if (indices > 0)
+        m->indices = (fastObjIndex*)(array_realloc(0, indices, sizeof(fastObjIndex)));
+
+    if (!m->positions || !m->texcoords || !m->normals ||
+        (faces > 0 && (!m->face_vertices || !m->face_materials)) ||
+        (indices > 0 && !m->indices))
+        return;
+
+    _array_size(m->positions) = 3 * (1 + positions);
+    _array_size(m->texcoords) = 2 * (1 + texcoords);
+    _array_size(m->normals)   = 3 * (1 + normals);
+
+    if (faces > 0)
+    {
+        _array_size(m->face_vertices)  = faces;
+        _array_size(m->face_materials) = faces;
+    }
+
+    if (indices > 0)
+        _array_size(m->indices) = indices;
+
+
+    /* Replay deferred lines in file order */
+    for (ii = 0; ii < count; ii++)
+    {
+        array_push(chunks[ii].materials, data->material);
+
+        for (jj = 0; jj < array_size(chunks[ii].data.events); jj++)
+        {
+            event = &chunks[ii].data.events[jj];
+            face  = chunks[ii].face_offset + event->face;
+            index = chunks[ii].index_offset + event->index;
+
+            switch (event->type)
+            {
+            case 'o':
+                data->object.face_count = face - data->object.face_offset;
+                parse_object(data, event->ptr);
+
+                /* flush_object took its offsets from the fully sized arrays */
+                data->object.face_offset  = face;
+                data->object.index_offset = index;
+                break;
+
+            case 'g':
+                data->group.face_count = face - data->group.face_offset;
+                parse_group(data, event->ptr);
+
+                data->group.face_offset  = face;
+                data->group.index_offset = index;
+                break;
+
+            case 'u':
+                parse_usemtl(data, event->ptr);
+                array_push(chunks[ii].materials, data->material);
+                break;
+
+            case 'm':
+                parse_mtllib(data, event->ptr, callbacks, user_data);
+                break;
+            }
+        }
+    }
+
+    data->object.face_count = faces - data->object.face_offset;
+    data->group.face_count  = faces - data->group.face_offset;
+
+
+    /* Copy chunk data into place */
+    for (ii = 0; ii < count; ii++)
+    {
+        chunks[ii].mesh  = m;
+        chunks[ii].stage = 1;
+    }
+
+    run_chunks(chunks, count);
+}
+
+
+static
+int read_parallel(fastObjData* data, void* file, const fastObjCallbacks* callbacks, void* user_data, unsigned int thread_count)
+{
+    fastObjChunk* chunks;
+    char*         contents;
+    size_t        size;
+    const char*   end;
+    const char*   last;
+    const char*   p;
+    char*         tail;
+    size_t        bytes;
+    unsigned int  count;
+    unsigned int  ii;
+    int           merged;
+
+
+    size     = 0;
+    contents = (char*)(callbacks->file_map(file, &size, user_data));
+    if (!contents)
+        return 0;
+
+    if (thread_count == 0)
+        thread_count = cpu_count();
+
+    /* Leave room for the tail chunk */
+    if (thread_count > MAX_THREADS - 1)
+        thread_count = MAX_THREADS - 1;
+
+    count = (unsigned int)(size / MIN_CHUNK_SIZE);
+    if (count > thread_count)
+        count = thread_count;
+
+    /* Not worth splitting */
+    if (count <= 1)
+    {
+        callbacks->file_unmap(file, contents, size, user_data);
+        return 0;
+    }
+
+
+    end  = contents + size;
+    last = end;
+    while (last > contents && last[-1] != '\n')
+        last--;
+
+    /* A final line without a newline gets a chunk of its own */
+    bytes = (size_t)(end - last);
+    tail  = 0;
+
+    if (bytes > 0)
+    {
+        tail = (char*)(memory_realloc(0, bytes + 1));
+        if (!tail)
+        {
+            callbacks->file_unmap(file, contents, size, user_data);
+            return 0;
+        }
+
+        memcpy(tail, last, bytes);
+        tail[bytes] = '\n';
+    }
+
+    chunks = (fastObjChunk*)(memory_realloc(0, (count + 1) * sizeof(fastObjChunk)));
+    if (!chunks)
+    {
+        memory_dealloc(tail);
+        callbacks->file_unmap(file, contents, size, user_data);
+        return 0;
+    }
+
+
+    /* Split at newline boundaries */
+    p = contents;
+    for (ii = 0; ii < count; ii++)
+    {
+        chunks[ii].start = p;
+
+        if (ii + 1 < count)
+        {
+            p = contents + (size_t)((double)(size) * (ii + 1) / count);
+            if (p < chunks[ii].start)
+                p = chunks[ii].start;
+
+            while (p < last && p[-1] != '\n')
+                p++;
+
+            if (p > last)
+                p = last;
+        }
+        else
+        {
+            p = last;
+        }
+
+        chunks[ii].end = p;
+    }
+
+    if (tail)
+    {
+        chunks[count].start = tail;
+        chunks[count].end   = tail + bytes + 1;
+        count++;
+    }
+
+    for (ii = 0; ii < count; ii++)
+    {
+        chunks[ii].data.mesh     = 0;
+        chunks[ii].data.events   = 0;
+        chunks[ii].data.relative = 0;
+
+        chunks[ii].materials = 0;
+        chunks[ii].mesh      = 0;
+        chunks[ii].stage     = 0;
+        chunks[ii].callbacks = callbacks;
+        chunks[ii].user_data = user_data;
+    }
+
+
+    /* Parse chunks in parallel */
+    run_chunks(chunks, count);
+
+    /* If a chunk could not be set up the mesh is left untouched and the
+       caller falls back to parsing serially */
+    merged = 1;
+    for (ii = 0; ii < count; ii++)
+    {
+        if (!chunks[ii].data.mesh)
+            merged = 0;
+        else if (chunks[ii].data.failed)
+            data->failed = 1;
+    }
+
+    if (merged && !data->failed)
+        merge_chunks(data, chunks, count, callbacks, user_data);
 
 
     /* Clean up */
-    memory_dealloc(buffer);
-    memory_dealloc(data.base);
+    for (ii = 0; ii < count; ii++)
+    {
+        if (chunks[ii].data.mesh)
+            fast_obj_destroy(chunks[ii].data.mesh);
+
+        array_clean(chunks[ii].data.events);
+        array_clean(chunks[ii].data.relative);
+        array_clean(chunks[ii].materials);
+    }
+
+    memory_dealloc(chunks);
+    memory_dealloc(tail);
+
+    callbacks->file_unmap(file, contents, size, user_data);
+
+    return merged;
+}
+
+
+fastObjMesh* fast_obj_read(const char* path)
+{
+    fastObjCallbacks callbacks;
+    callbacks.file_open = file_open;
+    callbacks.file_close = file_close;
+    callbacks.file_read = file_read;
+    callbacks.file_size = file_size;
+    callbacks.file_map = 0;
+    callbacks.file_unmap = 0;
+
+    return fast_obj_read_with_callbacks(path, &callbacks, 0);
+}
+
+
+fastObjMesh* fast_obj_read_mapped(const char* path)
+{
+    fastObjCallbacks callbacks;
+    callbacks.file_open = mapped_file_open;
+    callbacks.file_close = mapped_file_close;
+    callbacks.file_read = mapped_file_read;
+    callbacks.file_size = mapped_file_size;
+    callbacks.file_map = mapped_file_map;
+    callbacks.file_unmap = mapped_file_unmap;
+
+    return fast_obj_read_with_callbacks(path, &callbacks, 0);
+}
+
+
+static
+fastObjMesh* read_file(const char* path, const fastObjCallbacks* callbacks, void* user_data, unsigned int thread_count, fastObjFaceCallback face_callback, void* face_user_data)
+{
+    fastObjData  data;
+    fastObjMesh* m;
+    void*        file;
+    int          mapped;
+
+    /* Check if callbacks are valid */
+    if(!callbacks)
+        return 0;
+
+    select_kernels();
+
+
+    /* Open file */
+    file = callbacks->file_open(path, user_data);
+    if (!file)
+        return 0;
+
+
+    m = mesh_begin(&data, path);
+    if (!m)
+    {
+        callbacks->file_close(file, user_data);
+        return 0;
+    }
+
+    data.face_callback  = face_callback;
+    data.face_user_data = face_user_data;
+
+
+    /* Parse in place when the file can be mapped, splitting it across threads
+       when it is large enough, otherwise stream it. Empty files cannot be
+       mapped and take the streaming path. */
+    mapped = 0;
+    if (callbacks->file_map)
+    {
+        if (thread_count != 1)
+            mapped = read_parallel(&data, file, callbacks, user_data, thread_count);
+
+        if (!mapped)
+            mapped = read_mapped(&data, file, callbacks, user_data);
+    }
+
+    if (!mapped)
+        read_streamed(&data, file, callbacks, user_data);
+
+
+    mesh_end(&data);
 
     callbacks->file_close(file, user_data);
 
+    if (data.failed)
+    {
+        fast_obj_destroy(m);
+        return 0;
+    }
+
     return m;
 }
 
+
+fastObjMesh* fast_obj_read_with_callbacks(const char* path, const fastObjCallbacks* callbacks, void* user_data)
+{
+    return read_file(path, callbacks, user_data, 1, 0, 0);
+}
+
+
+fastObjMesh* fast_obj_read_parallel(const char* path, unsigned int thread_count)
+{
+    fastObjCallbacks callbacks;
+    callbacks.file_open = mapped_file_open;
+    callbacks.file_close = mapped_file_close;
+    callbacks.file_read = mapped_file_read;
+    callbacks.file_size = mapped_file_size;
+    callbacks.file_map = mapped_file_map;
+    callbacks.file_unmap = mapped_file_unmap;
+
+    return read_file(path, &callbacks, 0, thread_count, 0, 0);
+}
+
+
+fastObjMesh* fast_obj_read_faces(const char* path, fastObjFaceCallback callback, void* user_data)
+{
+    fastObjCallbacks callbacks;
+    callbacks.file_open = mapped_file_open;
+    callbacks.file_close = mapped_file_close;
+    callbacks.file_read = mapped_file_read;
+    callbacks.file_size = mapped_file_size;
+    callbacks.file_map = mapped_file_map;
+    callbacks.file_unmap = mapped_file_unmap;
+
+    return fast_obj_read_faces_with_callbacks(path, &callbacks, 0, callback, user_data);
+}
+
+
+fastObjMesh* fast_obj_read_faces_with_callbacks(const char* path, const fastObjCallbacks* callbacks, void* user_data, fastObjFaceCallback callback, void* face_user_data)
+{
+    /* Faces must reach the callback in file order, so parse on one thread */
+    return read_file(path, callbacks, user_data, 1, callback, face_user_data);
+}
+
 #endif
@@ -0,0 +1,710 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+    // pread and syscall are extensions hidden by strict -std modes
+    #define _DEFAULT_SOURCE
+#endif
+
+#include "fileio.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <pthread.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// io_uring is driven through the raw syscalls so there is no liburing dependency
+#if defined(__linux__) && !defined(FILE_QUEUE_NO_URING) && __has_include(<linux/io_uring.h>)
+    #include <linux/io_uring.h>
+    #include <sys/syscall.h>
+
+    // IORING_OP_READ arrived in the same kernel release as this feature flag
+    #ifdef IORING_FEAT_RW_CUR_POS
+        #define FILE_QUEUE_URING
+    #endif
+#endif
+
+#define FILE_QUEUE_MAX_THREADS 8
+
+// Largest single read; longer requests are continued like short reads
+#define FILE_READ_MAX_CHUNK (1u << 30)
+
+struct FileQueue
+{
+    uint32_t                depth;
+
+#ifdef FILE_QUEUE_URING
+    int                     ring;
+    uint32_t                inflight;
+
+    void*                   sqMap;
+    size_t                  sqMapSize;
+    void*                   cqMap;
+    size_t                  cqMapSize;
+
+    uint32_t*               sqHead;
+    uint32_t*               sqTail;
+    uint32_t*               sqMask;
+    uint32_t*               sqArray;
+    struct io_uring_sqe*    sqes;
+    size_t                  sqesSize;
+
+    uint32_t*               cqHead;
+    uint32_t*               cqTail;
+    uint32_t*               cqMask;
+    struct io_uring_cqe*    cqes;
+#endif
+
+    // Thread pool fallback; with no threads reads complete on submit
+    uint32_t                threadCount;
+    int                     stopping;
+    FileRead*               head;
+    FileRead*               tail;
+
+#ifdef _WIN32
+    HANDLE                  threads[FILE_QUEUE_MAX_THREADS];
+    CRITICAL_SECTION        lock;
+    CONDITION_VARIABLE      wake;
+    CONDITION_VARIABLE      done;
+#else
+    pthread_t               threads[FILE_QUEUE_MAX_THREADS];
+    pthread_mutex_t         lock;
+    pthread_cond_t          wake;
+    pthread_cond_t          done;
+#endif
+};
+
+int fileOpen(File* file, const char* path)
+{
+    memset(file, 0, sizeof(*file));
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (handle == INVALID_HANDLE_VALUE)
+        return 0;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size))
+    {
+        CloseHandle(handle);
+        return 0;
+    }
+
+    file->handle = (intptr_t)handle;
+    file->size = (uint64_t)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    file->handle = fd;
+    file->size = (uint64_t)st.st_size;
+#endif
+
+    return 1;
+}
+
+void fileClose(File* file)
+{
+#ifdef _WIN32
+    CloseHandle((HANDLE)file->handle);
+#else
+    close((int)file->handle);
+#endif
+
+    memset(file, 0, sizeof(*file));
+}
+
+static int readBlocking(FileRead* read)
+{
+    char* buffer = read->buffer;
+
+    while (read->result < read->size)
+    {
+        size_t remaining = read->size - read->result;
+        uint64_t offset = read->offset + read->result;
+
+#ifdef _WIN32
+        // Synchronous handles read at the offset given in the OVERLAPPED
+        OVERLAPPED overlapped = {0};
+        overlapped.Offset = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+        DWORD bytes = 0;
+
+        if (!ReadFile((HANDLE)read->file->handle, buffer + read->result, remaining < FILE_READ_MAX_CHUNK ? (DWORD)remaining : FILE_READ_MAX_CHUNK, &bytes, &overlapped))
+        {
+            if (GetLastError() == ERROR_HANDLE_EOF)
+                break;
+
+            return FILE_READ_FAILED;
+        }
+#else
+        ssize_t bytes = pread((int)read->file->handle, buffer + read->result, remaining < FILE_READ_MAX_CHUNK ? remaining : FILE_READ_MAX_CHUNK, (off_t)offset);
+
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return FILE_READ_FAILED;
+        }
+#endif
+
+        if (bytes == 0)
+            break;
+
+        read->result += (size_t)bytes;
+    }
+
+    return FILE_READ_DONE;
+}
+
+#ifdef FILE_QUEUE_URING
+
+static int uringEnter(int ring, uint32_t submit, uint32_t complete, uint32_t flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring, submit, complete, flags, 0, 0);
+}
+
+static int uringCreate(FileQueue* queue, uint32_t depth)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int ring = (int)syscall(__NR_io_uring_setup, depth, &params);
+    if (ring < 0)
+        return 0;
+
+    if (!(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+        close(ring);
+        return 0;
+    }
+
+    queue->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    queue->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    queue->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    void* sq = mmap(0, queue->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, ring, IORING_OFF_SQ_RING);
+    void* cq = mmap(0, queue->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, ring, IORING_OFF_CQ_RING);
+    void* sqes = mmap(0, queue->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED, ring, IORING_OFF_SQES);
+
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        if (sq != MAP_FAILED)
+            munmap(sq, queue->sqMapSize);
+        if (cq != MAP_FAILED)
+            munmap(cq, queue->cqMapSize);
+        if (sqes != MAP_FAILED)
+            munmap(sqes, queue->sqesSize);
+
+        close(ring);
+        return 0;
+    }
+
+    queue->ring = ring;
+    queue->sqMap = sq;
+    queue->cqMap = cq;
+
+    queue->sqHead = (uint32_t*)((char*)sq + params.sq_off.head);
+    queue->sqTail = (uint32_t*)((char*)sq + params.sq_off.tail);
+    queue->sqMask = (uint32_t*)((char*)sq + params.sq_off.ring_mask);
+    queue->sqArray = (uint32_t*)((char*)sq + params.sq_off.array);
+    queue->sqes = sqes;
+
+    queue->cqHead = (uint32_t*)((char*)cq + params.cq_off.head);
+    queue->cqTail = (uint32_t*)((char*)cq + params.cq_off.tail);
+    queue->cqMask = (uint32_t*)((char*)cq + params.cq_off.ring_mask);
+    queue->cqes = (struct io_uring_cqe*)((char*)cq + params.cq_off.cqes);
+
+    // Never having more reads in flight than submission entries keeps the
+    // completion ring (twice as large) from overflowing
+    queue->depth = depth < params.sq_entries ? depth : params.sq_entries;
+
+    return 1;
+}
+
+static void uringReap(FileQueue* queue, int wait);
+
+static void uringPush(FileQueue* queue, FileRead* read)
+{
+    while (queue->inflight == queue->depth)
+        uringReap(queue, 1);
+
+    uint32_t tail = *queue->sqTail;
+    uint32_t index = tail & *queue->sqMask;
+    size_t remaining = read->size - read->result;
+
+    struct io_uring_sqe* sqe = &queue->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = (int)read->file->handle;
+    sqe->addr = (uint64_t)(uintptr_t)((char*)read->buffer + read->result);
+    sqe->len = remaining < FILE_READ_MAX_CHUNK ? (uint32_t)remaining : FILE_READ_MAX_CHUNK;
+    sqe->off = read->offset + read->result;
+    sqe->user_data = (uint64_t)(uintptr_t)read;
+
+    queue->sqArray[index] = index;
+    __atomic_store_n(queue->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    queue->inflight++;
+
+    // Submit right away so the read proceeds while the caller keeps working;
+    // entries left over from an interrupted submit go out with this one
+    uint32_t pending = tail + 1 - __atomic_load_n(queue->sqHead, __ATOMIC_ACQUIRE);
+
+    while (uringEnter(queue->ring, pending, 0, 0) < 0 && errno == EINTR)
+        ;
+}
+
+static void uringReap(FileQueue* queue, int wait)
+{
+    uint32_t head = *queue->cqHead;
+
+    if (wait && head == __atomic_load_n(queue->cqTail, __ATOMIC_ACQUIRE))
+        uringEnter(queue->ring, 0, 1, IORING_ENTER_GETEVENTS);
+
+    uint32_t tail = __atomic_load_n(queue->cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++)
+    {
+        const struct io_uring_cqe* cqe = &queue->cqes[head & *queue->cqMask];
+
+        FileRead* read = (FileRead*)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+
+        queue->inflight--;
+
+        if (res == -EINTR || res == -EAGAIN)
+            uringPush(queue, read);
+        else if (res < 0)
+            read->state = FILE_READ_FAILED;
+        else
+        {
+            read->result += (size_t)res;
+
+            // Continue short reads until the request is filled or the file ends
+            if (res > 0 && read->result < read->size)
+                uringPush(queue, read);
+            else
+                read->state = FILE_READ_DONE;
+        }
+    }
+
+    __atomic_store_n(queue->cqHead, head, __ATOMIC_RELEASE);
+}
+
+static void uringDestroy(FileQueue* queue)
+{
+    while (queue->inflight > 0)
+        uringReap(queue, 1);
+
+    munmap(queue->sqes, queue->sqesSize);
+    munmap(queue->cqMap, queue->cqMapSize);
+    munmap(queue->sqMap, queue->sqMapSize);
+    close(queue->ring);
+}
+
+#endif
+
+static void workerLoop(FileQueue* queue)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&queue->lock);
+#else
+    pthread_mutex_lock(&queue->lock);
+#endif
+
+    for (;;)
+    {
+        while (!queue->head && !queue->stopping)
+        {
+#ifdef _WIN32
+            SleepConditionVariableCS(&queue->wake, &queue->lock, INFINITE);
+#else
+            pthread_cond_wait(&queue->wake, &queue->lock);
+#endif
+        }
+
+        // Queued reads are finished before the workers exit
+        FileRead* read = queue->head;
+        if (!read)
+            break;
+
+        queue->head = read->next;
+        if (!queue->head)
+            queue->tail = 0;
+
+#ifdef _WIN32
+        LeaveCriticalSection(&queue->lock);
+#else
+        pthread_mutex_unlock(&queue->lock);
+#endif
+
+        int state = readBlocking(read);
+
+#ifdef _WIN32
+        EnterCriticalSection(&queue->lock);
+        read->state = state;
+        WakeAllConditionVariable(&queue->done);
+#else
+        pthread_mutex_lock(&queue->lock);
+        read->state = state;
+        pthread_cond_broadcast(&queue->done);
+#endif
+    }
+
+#ifdef _WIN32
+    LeaveCriticalSection(&queue->lock);
+#else
+    pthread_mutex_unlock(&queue->lock);
+#endif
+}
+
+#ifdef _WIN32
+static DWORD WINAPI workerThread(void* queue)
+{
+    workerLoop(queue);
+    return 0;
+}
+#else
+static void* workerThread(void* queue)
+{
+    workerLoop(queue);
+    return 0;
+}
+#endif
+
+static void threadsCreate(FileQueue* queue, uint32_t depth)
+{
+    uint32_t count = depth < FILE_QUEUE_MAX_THREADS ? depth : FILE_QUEUE_MAX_THREADS;
+
+#ifdef _WIN32
+    InitializeCriticalSection(&queue->lock);
+    InitializeConditionVariable(&queue->wake);
+    InitializeConditionVariable(&queue->done);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        queue->threads[queue->threadCount] = CreateThread(0, 0, workerThread, queue, 0, 0);
+        if (queue->threads[queue->threadCount])
+            queue->threadCount++;
+    }
+#else
+    pthread_mutex_init(&queue->lock, 0);
+    pthread_cond_init(&queue->wake, 0);
+    pthread_cond_init(&queue->done, 0);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (pthread_create(&queue->threads[queue->threadCount], 0, workerThread, queue) == 0)
+            queue->threadCount++;
+    }
+#endif
+}
+
+static void threadsDestroy(FileQueue* queue)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&queue->lock);
+    queue->stopping = 1;
+    WakeAllConditionVariable(&queue->wake);
+    LeaveCriticalSection(&queue->lock);
+
+    for (uint32_t i = 0; i < queue->threadCount; i++)
+    {
+        WaitForSingleObject(queue->threads[i], INFINITE);
+        CloseHandle(queue->threads[i]);
+    }
+
+    DeleteCriticalSection(&queue->lock);
+#else
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = 1;
+    pthread_cond_broadcast(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+
+    for (uint32_t i = 0; i < queue->threadCount; i++)
+        pthread_join(queue->threads[i], 0);
+
+    pthread_cond_destroy(&queue->done);
+    pthread_cond_destroy(&queue->wake);
+    pthread_mutex_destroy(&queue->lock);
+#endif
+}
+
+FileQueue* fileQueueCreate(uint32_t depth)
+{
+    FileQueue* queue = calloc(1, sizeof(FileQueue));
+    if (!queue)
+        return 0;
+
+    depth = depth ? depth : 1;
+    queue->depth = depth;
+
+#ifdef FILE_QUEUE_URING
+    queue->ring = -1;
+
+    // io_uring can be missing or blocked (old kernels, seccomp filters)
+    if (uringCreate(queue, depth))
+        return queue;
+#endif
+
+    threadsCreate(queue, depth);
+
+    return queue;
+}
+
+void fileQueueDestroy(FileQueue* queue)
+{
+    if (!queue)
+        return;
+
+#ifdef FILE_QUEUE_URING
+    if (queue->ring >= 0)
+        uringDestroy(queue);
+    else
+#endif
+        threadsDestroy(queue);
+
+    free(queue);
+}
+
+const char* fileQueueBackend(const FileQueue* queue)
+{
+#ifdef FILE_QUEUE_URING
+    if (queue->ring >= 0)
+        return "io_uring";
+#endif
+
+    return queue->threadCount ? "threads" : "blocking";
+}
+
+void fileQueueSubmit(FileQueue* queue, FileRead* read)
+{
+    read->result = 0;
+    read->state = FILE_READ_PENDING;
+    read->next = 0;
+
+#ifdef FILE_QUEUE_URING
+    if (queue->ring >= 0)
+    {
+        uringPush(queue, read);
+        return;
+    }
+#endif
+
+    if (queue->threadCount == 0)
+    {
+        read->state = readBlocking(read);
+        return;
+    }
+
+#ifdef _WIN32
+    EnterCriticalSection(&queue->lock);
+#else
+    pthread_mutex_lock(&queue->lock);
+#endif
+
+    if (queue->tail)
+        queue->tail->next = read;
+    else
+        queue->head = read;
+
+    queue->tail = read;
+
+#ifdef _WIN32
+    WakeConditionVariable(&queue->wake);
+    LeaveCriticalSection(&queue->lock);
+#else
+    pthread_cond_signal(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+#endif
+}
+
+int fileQueueWait(FileQueue* queue, FileRead* read)
+{
+#ifdef FILE_QUEUE_URING
+    if (queue->ring >= 0)
+    {
+        while (read->state == FILE_READ_PENDING && queue->inflight > 0)
+            uringReap(queue, 1);
+
+        return read->state == FILE_READ_DONE;
+    }
+#endif
+
+    if (queue->threadCount == 0)
+        return read->state == FILE_READ_DONE;
+
+#ifdef _WIN32
+    EnterCriticalSection(&queue->lock);
+    while (read->state == FILE_READ_PENDING)
+        SleepConditionVariableCS(&queue->done, &queue->lock, INFINITE);
+    LeaveCriticalSection(&queue->lock);
+#else
+    pthread_mutex_lock(&queue->lock);
+    while (read->state == FILE_READ_PENDING)
+        pthread_cond_wait(&queue->done, &queue->lock);
+    pthread_mutex_unlock(&queue->lock);
+#endif
+
+    return read->state == FILE_READ_DONE;
+}
+
+int fileLoadBegin(FileQueue* queue, FileLoad* load, const char* path)
+{
+    memset(load, 0, sizeof(*load));
+
+    if (!fileOpen(&load->file, path))
+        return 0;
+
+    if (load->file.size > SIZE_MAX - 1)
+    {
+        fileClose(&load->file);
+        return 0;
+    }
+
+    void* buffer = malloc(load->file.size ? (size_t)load->file.size : 1);
+    if (!buffer)
+    {
+        fileClose(&load->file);
+        return 0;
+    }
+
+    load->read.file = &load->file;
+    load->read.buffer = buffer;
+    load->read.size = (size_t)load->file.size;
+    load->read.offset = 0;
+
+    fileQueueSubmit(queue, &load->read);
+    return 1;
+}
+
+void* fileLoadEnd(FileQueue* queue, FileLoad* load, size_t* size)
+{
+    int ok = fileQueueWait(queue, &load->read) && load->read.result == load->read.size;
+
+    fileClose(&load->file);
+
+    if (!ok)
+    {
+        free(load->read.buffer);
+        return 0;
+    }
+
+    *size = load->read.result;
+    return load->read.buffer;
+}
+
+static void fileReaderSubmit(FileReader* reader, uint32_t block)
+{
+    FileRead* read = &reader->reads[block];
+    uint64_t remaining = reader->file.size - reader->nextOffset;
+
+    read->file = &reader->file;
+    read->buffer = reader->blocks + (size_t)block * FILE_READER_BLOCK_SIZE;
+    read->size = remaining < FILE_READER_BLOCK_SIZE ? (size_t)remaining : FILE_READER_BLOCK_SIZE;
+    read->offset = reader->nextOffset;
+    read->result = 0;
+
+    // Blocks past the end of the file stay empty
+    if (read->size == 0)
+    {
+        read->state = FILE_READ_DONE;
+        return;
+    }
+
+    reader->nextOffset += read->size;
+
+    fileQueueSubmit(reader->queue, read);
+}
+
+int fileReaderOpen(FileReader* reader, FileQueue* queue, const char* path)
+{
+    memset(reader, 0, sizeof(*reader));
+
+    if (!fileOpen(&reader->file, path))
+        return 0;
+
+    reader->blocks = malloc((size_t)FILE_READER_BLOCKS * FILE_READER_BLOCK_SIZE);
+    if (!reader->blocks)
+    {
+        fileClose(&reader->file);
+        return 0;
+    }
+
+    reader->queue = queue;
+
+    for (uint32_t i = 0; i < FILE_READER_BLOCKS; i++)
+        fileReaderSubmit(reader, i);
+
+    return 1;
+}
+
+size_t fileReaderRead(FileReader* reader, void* buffer, size_t size)
+{
+    size_t copied = 0;
+
+    while (copied < size)
+    {
+        FileRead* read = &reader->reads[reader->current];
+
+        if (!fileQueueWait(reader->queue, read))
+            break;
+
+        if (reader->consumed == read->result)
+        {
+            // An empty or short block is the end of the file
+            if (read->size == 0 || read->result < read->size)
+                break;
+
+            // Refill the drained block with the next range and move on
+            fileReaderSubmit(reader, reader->current);
+
+            reader->current = (reader->current + 1) % FILE_READER_BLOCKS;
+            reader->consumed = 0;
+            continue;
+        }
+
+        size_t available = read->result - reader->consumed;
+        size_t bytes = available < size - copied ? available : size - copied;
+
+        memcpy((char*)buffer + copied, (char*)read->buffer + reader->consumed, bytes);
+
+        reader->consumed += bytes;
+        copied += bytes;
+    }
+
+    return copied;
+}
+
+void fileReaderClose(FileReader* reader)
+{
+    // The queue may still be writing into the blocks
+    for (uint32_t i = 0; i < FILE_READER_BLOCKS; i++)
+        fileQueueWait(reader->queue, &reader->reads[i]);
+
+    fileClose(&reader->file);
+    free(reader->blocks);
+
+    memset(reader, 0, sizeof(*reader));
+}
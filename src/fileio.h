@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    intptr_t    handle;     // file descriptor, or HANDLE on Windows
+    uint64_t    size;
+} File;
+
+int fileOpen(File* file, const char* path);
+void fileClose(File* file);
+
+enum
+{
+    FILE_READ_PENDING,
+    FILE_READ_DONE,
+    FILE_READ_FAILED,
+};
+
+// One positional read; the request must stay alive until it has been waited on.
+// Short reads are continued internally, so result is only less than size at
+// the end of the file.
+typedef struct FileRead
+{
+    const File*         file;
+    void*               buffer;
+    size_t              size;
+    uint64_t            offset;
+
+    size_t              result;
+    int                 state;
+
+    struct FileRead*    next;       // internal
+} FileRead;
+
+// Keeps up to depth reads in flight. Uses io_uring where the kernel supports
+// it and a small pool of blocking reader threads otherwise. A queue is used
+// from one thread; completion order is not defined.
+typedef struct FileQueue FileQueue;
+
+FileQueue* fileQueueCreate(uint32_t depth);
+void fileQueueDestroy(FileQueue* queue);
+
+// Returns the name of the backend in use, for logging
+const char* fileQueueBackend(const FileQueue* queue);
+
+void fileQueueSubmit(FileQueue* queue, FileRead* read);
+int fileQueueWait(FileQueue* queue, FileRead* read);
+
+// Reads a whole file into a malloc'd buffer in the background
+typedef struct
+{
+    File        file;
+    FileRead    read;
+} FileLoad;
+
+int fileLoadBegin(FileQueue* queue, FileLoad* load, const char* path);
+void* fileLoadEnd(FileQueue* queue, FileLoad* load, size_t* size);
+
+#define FILE_READER_BLOCKS 4
+#define FILE_READER_BLOCK_SIZE (1024 * 1024)
+
+// Sequential reader that keeps the next few blocks of the file in flight, so
+// consuming one block overlaps reading the ones after it
+typedef struct
+{
+    FileQueue*  queue;
+    File        file;
+
+    char*       blocks;
+    FileRead    reads[FILE_READER_BLOCKS];
+
+    uint64_t    nextOffset;
+    uint32_t    current;
+    size_t      consumed;
+} FileReader;
+
+int fileReaderOpen(FileReader* reader, FileQueue* queue, const char* path);
+size_t fileReaderRead(FileReader* reader, void* buffer, size_t size);
+void fileReaderClose(FileReader* reader);
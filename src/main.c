@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <math.h>
+#include <string.h>
 #include <assert.h>
 
 #ifdef _WIN32
@@ -13,7 +15,11 @@
 #include <GLFW/glfw3native.h>
 
 #include <vulkan/vulkan.h>
-#include "fast_obj.h"
+#include "arena.h"
+#include "devicememory.h"
+#include "fileio.h"
+#include "mesh.h"
+#include "meshopt.h"
 
 #define countof(arr) sizeof(arr) / sizeof(arr[0])
 
@@ -59,6 +65,7 @@ VkInstance createInstance(void)
     static const VkInstanceCreateInfo createInfo =
     {
         .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        .pApplicationInfo = &appInfo,
         .ppEnabledExtensionNames = extensions,
         .enabledExtensionCount = countof(extensions),
 
@@ -135,22 +142,26 @@ VkPhysicalDevice pickPhysicalDevice(VkInstance instance)
     VkPhysicalDevice* physicalDevices = calloc(physicalDeviceCount, sizeof(*physicalDevices));
     VK_CHECK(vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, physicalDevices));
 
+    // Uploads are synchronized with timeline semaphores and the feature
+    // queries use Vulkan 1.2 structures, so older devices are skipped
     VkPhysicalDevice physicalDevice = 0;
-    if (physicalDeviceCount > 0)
+    for (uint32_t i = 0; i < physicalDeviceCount; i++)
     {
         VkPhysicalDeviceProperties props;
-        vkGetPhysicalDeviceProperties(physicalDevices[0], &props);
+        vkGetPhysicalDeviceProperties(physicalDevices[i], &props);
 
-        printf("Picking fallback GPU: %s\n", props.deviceName);
-        physicalDevice = physicalDevices[0];
+        if (props.apiVersion < VK_API_VERSION_1_2)
+            continue;
 
-        free(physicalDevices);
-    }
-    else
-    {
-        printf("No physical devices available\n");
+        printf("Picking fallback GPU: %s\n", props.deviceName);
+        physicalDevice = physicalDevices[i];
+        break;
     }
 
+    if (!physicalDevice)
+        printf("No Vulkan 1.2 physical devices available\n");
+
+    free(physicalDevices);
     return physicalDevice;
 }
 
@@ -175,29 +186,95 @@ uint32_t getGraphicsQueueFamily(VkPhysicalDevice physicalDevice)
     return familyIndex;
 }
 
-VkDevice createDevice(VkPhysicalDevice physicalDevice, uint32_t familyIndex)
+// A family with transfers and neither graphics nor compute is a copy engine
+// that runs alongside the graphics queue; VK_QUEUE_FAMILY_IGNORED if none
+uint32_t getTransferQueueFamily(VkPhysicalDevice physicalDevice)
+{
+    uint32_t queueCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueCount, 0);
+
+    VkQueueFamilyProperties* queues = calloc(queueCount, sizeof(*queues));
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueCount, queues);
+
+    uint32_t familyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+    for (uint32_t i = 0; i < queueCount; i++)
+        if ((queues[i].queueFlags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == VK_QUEUE_TRANSFER_BIT)
+        {
+            familyIndex = i;
+            break;
+        }
+
+    free(queues);
+    return familyIndex;
+}
+
+int hasDeviceExtension(VkPhysicalDevice physicalDevice, const char* name)
+{
+    uint32_t extensionCount = 0;
+    VK_CHECK(vkEnumerateDeviceExtensionProperties(physicalDevice, 0, &extensionCount, 0));
+
+    VkExtensionProperties* extensions = calloc(extensionCount, sizeof(*extensions));
+    VK_CHECK(vkEnumerateDeviceExtensionProperties(physicalDevice, 0, &extensionCount, extensions));
+
+    int found = 0;
+
+    for (uint32_t i = 0; i < extensionCount; i++)
+        if (strcmp(extensions[i].extensionName, name) == 0)
+        {
+            found = 1;
+            break;
+        }
+
+    free(extensions);
+    return found;
+}
+
+// One queue of familyIndex, and one of transferFamilyIndex unless it is
+// VK_QUEUE_FAMILY_IGNORED. Mesh shaders and memory budget queries are
+// enabled on request.
+VkDevice createDevice(VkPhysicalDevice physicalDevice, uint32_t familyIndex, uint32_t transferFamilyIndex, const VkPhysicalDeviceFeatures2* features, VkBool32 meshShading, int memoryBudget)
 {
-    const VkDeviceQueueCreateInfo queueInfo =
+    const VkDeviceQueueCreateInfo queueInfos[] =
     {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        .queueFamilyIndex = familyIndex,
-        .queueCount = 1,
-        .pQueuePriorities = (float[]){1.0f},
+        {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = familyIndex,
+            .queueCount = 1,
+            .pQueuePriorities = (float[]){1.0f},
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = transferFamilyIndex,
+            .queueCount = 1,
+            .pQueuePriorities = (float[]){1.0f},
+        },
     };
 
-    static const char* extensions[] =
+    const char* extensions[4] =
     {
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
         VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
     };
 
+    uint32_t extensionCount = 2;
+
+    // VK_EXT_mesh_shader depends on SPIR-V 1.4, which is core on the 1.2
+    // devices pickPhysicalDevice accepts
+    if (meshShading)
+        extensions[extensionCount++] = VK_EXT_MESH_SHADER_EXTENSION_NAME;
+
+    if (memoryBudget)
+        extensions[extensionCount++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+
     const VkDeviceCreateInfo createInfo =
     {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .pQueueCreateInfos = &queueInfo,
-        .queueCreateInfoCount = 1,
+        .pNext = features,
+        .pQueueCreateInfos = queueInfos,
+        .queueCreateInfoCount = transferFamilyIndex == VK_QUEUE_FAMILY_IGNORED ? 1 : 2,
         .ppEnabledExtensionNames = extensions,
-        .enabledExtensionCount = countof(extensions),
+        .enabledExtensionCount = extensionCount,
     };
 
     VkDevice device = 0;
@@ -206,25 +283,13 @@ VkDevice createDevice(VkPhysicalDevice physicalDevice, uint32_t familyIndex)
     return device;
 }
 
-VkShaderModule loadShader(VkDevice device, const char* path)
+VkShaderModule loadShader(VkDevice device, FileQueue* io, FileLoad* load)
 {
-    FILE* file = fopen(path, "rb");
-    assert(file);
-
-    fseek(file, 0, SEEK_END);
-    long len = ftell(file);
-    assert(len >= 0);
-    fseek(file, 0, SEEK_SET);
-
-    char* buf = calloc(len, sizeof(char));
+    // The read was started with fileLoadBegin and may still be in flight
+    size_t len = 0;
+    char* buf = fileLoadEnd(io, load, &len);
     assert(buf);
 
-    size_t rc = fread(buf, 1, len, file);
-    if (rc != len)
-        assert(!"Failed to read file");
-    
-    fclose(file);
-
     const VkShaderModuleCreateInfo createInfo =
     {
         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
@@ -240,23 +305,26 @@ VkShaderModule loadShader(VkDevice device, const char* path)
     return shaderModule;
 }
 
-VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device)
+// Storage buffers at bindings 0 to bindingCount - 1, all visible to the same stages
+VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device, uint32_t bindingCount, VkShaderStageFlags stages)
 {
-        const VkDescriptorSetLayoutBinding setBindings[] =
-    {
+    VkDescriptorSetLayoutBinding setBindings[5];
+    assert(bindingCount <= countof(setBindings));
+
+    for (uint32_t i = 0; i < bindingCount; i++)
+        setBindings[i] = (VkDescriptorSetLayoutBinding)
         {
-            .binding = 0,
+            .binding = i,
             .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
             .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-        }
-    };
+            .stageFlags = stages,
+        };
 
     const VkDescriptorSetLayoutCreateInfo setCreateInfo =
     {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
         .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR,
-        .bindingCount = countof(setBindings),
+        .bindingCount = bindingCount,
         .pBindings = setBindings,
     };
 
@@ -266,13 +334,81 @@ VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device)
     return setLayout;
 }
 
-VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout setLayout)
+// Matches FrameData in shaders/mesh.h
+typedef struct
+{
+    float       viewProjection[16];     // column major
+    float       viewDirection[4];       // xyz, from viewProjection
+} FrameData;
+
+// The mesh space direction an orthographic viewProjection looks along, for
+// the meshlet cone tests: the cross product of its x and y rows, which both
+// give 0 along it, signed so that depth grows along it
+void setViewDirection(FrameData* frame)
+{
+    const float* m = frame->viewProjection;
+
+    float d[3] =
+    {
+        m[4] * m[9] - m[8] * m[5],
+        m[8] * m[1] - m[0] * m[9],
+        m[0] * m[5] - m[4] * m[1],
+    };
+
+    float z = m[2] * d[0] + m[6] * d[1] + m[10] * d[2];
+    float length = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    assert(z != 0.f && length > 0.f);
+
+    for (int k = 0; k < 3; k++)
+        frame->viewDirection[k] = d[k] / (z > 0.f ? length : -length);
+
+    frame->viewDirection[3] = 0.f;
+}
+
+// Matches the push constants in shaders/mesh.h
+typedef struct
 {
+    float       positionOffset[4];
+    float       positionScale[4];
+    uint32_t    meshletCount;
+    uint32_t    vertexCount;
+    uint32_t    indexCount;
+} VertexConstants;
+
+// Matches TASK_GROUP_SIZE in shaders/mesh.h and the local size of cull.comp
+#define MESHLET_TASK_GROUP_SIZE 32
+#define MESHLET_CULL_GROUP_SIZE 64
+
+// Passes of normals.comp, selected by its constant_id 2, and its local size
+#define NORMAL_PASS_COUNT 0
+#define NORMAL_PASS_SCAN 1
+#define NORMAL_PASS_FILL 2
+#define NORMAL_PASS_NORMALS 3
+#define NORMAL_GROUP_SIZE 64
+
+// Pipelines of the depth pass, and the size of its square target
+#define DEPTH_PASS_FULL_VERTICES 0
+#define DEPTH_PASS_POSITION_STREAM 1
+#define DEPTH_PASS_SIZE 2048
+
+#define DRAW_TIMING_FRAMES 256
+
+VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout setLayout, VkShaderStageFlags stages)
+{
+    const VkPushConstantRange pushConstantRange =
+    {
+        .stageFlags = stages,
+        .offset = 0,
+        .size = sizeof(VertexConstants),
+    };
+
     const VkPipelineLayoutCreateInfo createInfo =
     {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
         .setLayoutCount = 1,
         .pSetLayouts = &setLayout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange,
     };
 
     VkPipelineLayout layout = 0;
@@ -283,30 +419,15 @@ VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout set
 
 typedef struct
 {
-    float position[3];
-    float normal[3];
-    float texcoord[2];
-} Vertex;
-
-typedef struct
-{
-    VkBuffer        buffer;
-    VkDeviceMemory  memory;
-    void*           data;
-    size_t          size;
+    VkBuffer            buffer;
+    DeviceAllocation    allocation;
+    void*               data;
+    size_t              size;
 } Buffer;
 
-uint32_t selectMemoryType(const VkPhysicalDeviceMemoryProperties* memProps, uint32_t memTypeBits, VkMemoryPropertyFlags flags)
-{
-    for (uint32_t i = 0; i < memProps->memoryTypeCount; i++)
-        if ((memTypeBits & (1 << i)) != 0 && (memProps->memoryTypes[i].propertyFlags & flags) == flags)
-            return i;
-
-    assert(!"No compatible memory type found!");
-    return ~0u;
-}
-
-void createBuffer(Buffer* buffer, VkDevice device, const VkPhysicalDeviceMemoryProperties* memProps, size_t size, VkBufferUsageFlags usage)
+// Buffers in host visible memory are mapped, and the host writes them in
+// place; others are filled through an Uploader
+void createBuffer(Buffer* buffer, VkDevice device, DeviceAllocator* allocator, size_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, int category)
 {
     const VkBufferCreateInfo createInfo =
     {
@@ -320,47 +441,79 @@ void createBuffer(Buffer* buffer, VkDevice device, const VkPhysicalDeviceMemoryP
     VkMemoryRequirements memReq;
     vkGetBufferMemoryRequirements(device, buffer->buffer, &memReq);
 
-    uint32_t memTypeIndex = selectMemoryType(memProps, memReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    assert(memTypeIndex != ~0u);
-
-    const VkMemoryAllocateInfo allocateInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memReq.size,
-        .memoryTypeIndex = memTypeIndex,
-    };
-
-    VK_CHECK(vkAllocateMemory(device, &allocateInfo, 0, &buffer->memory));
-    VK_CHECK(vkBindBufferMemory(device, buffer->buffer, buffer->memory, 0));
+    int rc = deviceAlloc(allocator, &buffer->allocation, &memReq, required, preferred, DEVICE_MEMORY_LINEAR, category);
+    assert(rc);
 
-    VK_CHECK(vkMapMemory(device, buffer->memory, 0, size, 0, &buffer->data));
+    VK_CHECK(vkBindBufferMemory(device, buffer->buffer, buffer->allocation.memory, buffer->allocation.offset));
 
+    buffer->data = buffer->allocation.data;
     buffer->size = size;
 }
 
-void destroyBuffer(VkDevice device, Buffer* buffer)
+void destroyBuffer(VkDevice device, DeviceAllocator* allocator, Buffer* buffer)
 {
-    vkFreeMemory(device, buffer->memory, 0);
     vkDestroyBuffer(device, buffer->buffer, 0);
+    deviceFree(allocator, &buffer->allocation);
+}
+
+// Resizable BAR and unified memory let the host map a device local heap as
+// large as the largest one; otherwise at most a 256 MiB window is mappable,
+// which is not worth spending on geometry
+int isDeviceMemoryMappable(const VkPhysicalDeviceMemoryProperties* memProps)
+{
+    VkDeviceSize largestHeap = 0;
+
+    for (uint32_t i = 0; i < memProps->memoryHeapCount; i++)
+        if (memProps->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            largestHeap = memProps->memoryHeaps[i].size > largestHeap ? memProps->memoryHeaps[i].size : largestHeap;
+
+    const VkMemoryPropertyFlags mappable = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    for (uint32_t i = 0; i < memProps->memoryTypeCount; i++)
+        if ((memProps->memoryTypes[i].propertyFlags & mappable) == mappable && memProps->memoryHeaps[memProps->memoryTypes[i].heapIndex].size >= largestHeap)
+            return 1;
+
+    return 0;
 }
 
-VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, VkShaderModule vs, VkShaderModule fs, VkPipelineLayout layout)
+typedef struct
 {
-    const VkPipelineShaderStageCreateInfo stages[] =
+    VkShaderStageFlagBits   stage;
+    VkShaderModule          module;
+} ShaderStage;
+
+// Vertex and fragment shaders, or task, mesh and fragment shaders; depth
+// only pipelines take a vertex shader alone and test and write depth.
+// constants[i] specializes constant_id i, as for compute pipelines. Strips
+// are drawn with primitive restart.
+VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, const ShaderStage* shaders, uint32_t shaderCount, VkPipelineLayout layout, const uint32_t* constants, uint32_t constantCount, VkPrimitiveTopology topology, VkBool32 depthOnly)
+{
+    VkSpecializationMapEntry specializationEntries[4];
+    assert(constantCount <= countof(specializationEntries));
+
+    for (uint32_t i = 0; i < constantCount; i++)
+        specializationEntries[i] = (VkSpecializationMapEntry){ i, i * sizeof(uint32_t), sizeof(uint32_t) };
+
+    const VkSpecializationInfo specializationInfo =
     {
+        .mapEntryCount = constantCount,
+        .pMapEntries = specializationEntries,
+        .dataSize = constantCount * sizeof(uint32_t),
+        .pData = constants,
+    };
+
+    VkPipelineShaderStageCreateInfo stages[3];
+    assert(shaderCount <= countof(stages));
+
+    for (uint32_t i = 0; i < shaderCount; i++)
+        stages[i] = (VkPipelineShaderStageCreateInfo)
         {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-            .stage = VK_SHADER_STAGE_VERTEX_BIT,
-            .module = vs,
-            .pName = "main",
-        },
-        {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-            .module = fs,
+            .stage = shaders[i].stage,
+            .module = shaders[i].module,
             .pName = "main",
-        },
-    };
+            .pSpecializationInfo = &specializationInfo,
+        };
 
     const VkPipelineVertexInputStateCreateInfo vertexInput =
     {
@@ -370,7 +523,8 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache
     const VkPipelineInputAssemblyStateCreateInfo inputAssembly =
     {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        .topology = topology,
+        .primitiveRestartEnable = topology == VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
     };
 
     const VkPipelineViewportStateCreateInfo viewportState =
@@ -380,9 +534,14 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache
         .scissorCount = 1,
     };
 
+    // OBJ faces wind counter-clockwise seen from the front; the projection
+    // flips y and looks down +z, which mirrors them to clockwise on screen.
+    // Meshlet cone culling relies on back faces being culled here as well.
     const VkPipelineRasterizationStateCreateInfo rasterizationState =
     {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .cullMode = VK_CULL_MODE_BACK_BIT,
+        .frontFace = VK_FRONT_FACE_CLOCKWISE,
         .lineWidth = 1.0f,
     };
 
@@ -395,6 +554,9 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache
     const VkPipelineDepthStencilStateCreateInfo depthStencilState =
     {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+        .depthTestEnable = depthOnly,
+        .depthWriteEnable = depthOnly,
+        .depthCompareOp = VK_COMPARE_OP_LESS,
     };
 
     const VkPipelineColorBlendAttachmentState colorAttachmentState =
@@ -408,7 +570,7 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache
     const VkPipelineColorBlendStateCreateInfo colorBlendState =
     {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-        .attachmentCount = 1,
+        .attachmentCount = depthOnly ? 0 : 1,
         .pAttachments = &colorAttachmentState,
     };
 
@@ -424,7 +586,7 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache
     const VkGraphicsPipelineCreateInfo createInfo =
     {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        .stageCount = countof(stages),
+        .stageCount = shaderCount,
         .pStages = stages,
         .pVertexInputState = &vertexInput,
         .pInputAssemblyState = &inputAssembly,
@@ -444,6 +606,111 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache
     return pipeline;
 }
 
+// constants[i] specializes constant_id i; all are 32 bits wide
+VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule cs, VkPipelineLayout layout, const uint32_t* constants, uint32_t constantCount)
+{
+    VkSpecializationMapEntry specializationEntries[4];
+    assert(constantCount <= countof(specializationEntries));
+
+    for (uint32_t i = 0; i < constantCount; i++)
+        specializationEntries[i] = (VkSpecializationMapEntry){ i, i * sizeof(uint32_t), sizeof(uint32_t) };
+
+    const VkSpecializationInfo specializationInfo =
+    {
+        .mapEntryCount = constantCount,
+        .pMapEntries = specializationEntries,
+        .dataSize = constantCount * sizeof(uint32_t),
+        .pData = constants,
+    };
+
+    const VkComputePipelineCreateInfo createInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage =
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = cs,
+            .pName = "main",
+            .pSpecializationInfo = constantCount ? &specializationInfo : 0,
+        },
+        .layout = layout,
+    };
+
+    VkPipeline pipeline = 0;
+    VK_CHECK(vkCreateComputePipelines(device, pipelineCache, 1, &createInfo, 0, &pipeline));
+
+    return pipeline;
+}
+
+// Builds a CSR of the corners around every vertex from the index buffer, then
+// sums the face normals of each vertex without one in its own thread, with a
+// barrier after every pass. Buffers are bound as normals.comp expects:
+// vertices, indices, offsets (cleared here), cursors and corners.
+void recordNormalGeneration(VkCommandBuffer commandBuffer, PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR, VkPipelineLayout layout, const VkPipeline pipelines[4], const VkDescriptorBufferInfo bufferInfos[5], const VertexConstants* constants)
+{
+    VkWriteDescriptorSet descriptors[5];
+
+    for (uint32_t i = 0; i < countof(descriptors); i++)
+        descriptors[i] = (VkWriteDescriptorSet)
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstBinding = i,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &bufferInfos[i],
+        };
+
+    vkCmdFillBuffer(commandBuffer, bufferInfos[2].buffer, 0, VK_WHOLE_SIZE, 0);
+
+    const VkMemoryBarrier clearBarrier =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, 0, 0, 0);
+
+    const uint32_t groupCounts[4] =
+    {
+        [NORMAL_PASS_COUNT] = (constants->indexCount + NORMAL_GROUP_SIZE - 1) / NORMAL_GROUP_SIZE,
+        [NORMAL_PASS_SCAN] = 1,
+        [NORMAL_PASS_FILL] = (constants->indexCount + NORMAL_GROUP_SIZE - 1) / NORMAL_GROUP_SIZE,
+        [NORMAL_PASS_NORMALS] = (constants->vertexCount + NORMAL_GROUP_SIZE - 1) / NORMAL_GROUP_SIZE,
+    };
+
+    const VkMemoryBarrier passBarrier =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+
+    for (uint32_t pass = 0; pass < countof(groupCounts); pass++)
+    {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[pass]);
+
+        vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, countof(descriptors), descriptors);
+        vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(*constants), constants);
+
+        vkCmdDispatch(commandBuffer, groupCounts[pass], 1, 1);
+
+        if (pass + 1 < countof(groupCounts))
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &passBarrier, 0, 0, 0, 0);
+    }
+
+    // The normals are drawn with, and read back on the host when checked
+    const VkMemoryBarrier normalBarrier =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT,
+    };
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &normalBarrier, 0, 0, 0, 0);
+}
+
 VkSurfaceKHR createSurface(VkInstance instance, GLFWwindow* window)
 {
     const VkWin32SurfaceCreateInfoKHR createInfo =
@@ -517,7 +784,80 @@ VkRenderPass createRenderPass(VkDevice device, VkFormat format)
     return renderPass;
 }
 
-VkImageView createImageView(VkDevice device, VkImage image, VkFormat format)
+// A single depth attachment, cleared and kept, for position only passes. The
+// dependency orders depth writes after those of an earlier pass into the
+// same image.
+VkRenderPass createDepthRenderPass(VkDevice device, VkFormat format)
+{
+    const VkAttachmentDescription attachment =
+    {
+        .format = format,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    };
+
+    const VkAttachmentReference depthAttachment =
+    {
+        .attachment = 0,
+        .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    };
+
+    const VkSubpassDescription subpass =
+    {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .pDepthStencilAttachment = &depthAttachment,
+    };
+
+    const VkSubpassDependency dependency =
+    {
+        .srcSubpass = VK_SUBPASS_EXTERNAL,
+        .dstSubpass = 0,
+        .srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+        .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+    };
+
+    const VkRenderPassCreateInfo createInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &attachment,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = 1,
+        .pDependencies = &dependency,
+    };
+
+    VkRenderPass renderPass = 0;
+    VK_CHECK(vkCreateRenderPass(device, &createInfo, 0, &renderPass));
+
+    return renderPass;
+}
+
+// The first depth format of the two the spec guarantees one of that the device can render to
+VkFormat getDepthFormat(VkPhysicalDevice physicalDevice)
+{
+    const VkFormat candidates[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32 };
+
+    for (uint32_t i = 0; i < countof(candidates); i++)
+    {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, candidates[i], &props);
+
+        if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+            return candidates[i];
+    }
+
+    return VK_FORMAT_UNDEFINED;
+}
+
+VkImageView createImageView(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspectMask)
 {
     const VkImageViewCreateInfo createInfo =
     {
@@ -525,7 +865,7 @@ VkImageView createImageView(VkDevice device, VkImage image, VkFormat format)
         .image = image,
         .viewType = VK_IMAGE_VIEW_TYPE_2D,
         .format = format,
-        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .subresourceRange.aspectMask = aspectMask,
         .subresourceRange.levelCount = 1,
         .subresourceRange.layerCount = 1,
     };
@@ -555,6 +895,50 @@ VkFramebuffer createFramebuffer(VkDevice device, VkRenderPass renderPass, VkImag
     return framebuffer;
 }
 
+typedef struct
+{
+    VkImage             image;
+    VkImageView         imageView;
+    DeviceAllocation    allocation;
+} Image;
+
+// Images are render targets in device local memory; only the GPU touches them
+void createImage(Image* image, VkDevice device, DeviceAllocator* allocator, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspectMask)
+{
+    const VkImageCreateInfo createInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent = { width, height, 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+
+    VK_CHECK(vkCreateImage(device, &createInfo, 0, &image->image));
+
+    VkMemoryRequirements memReq;
+    vkGetImageMemoryRequirements(device, image->image, &memReq);
+
+    int rc = deviceAlloc(allocator, &image->allocation, &memReq, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, DEVICE_MEMORY_OPTIMAL, DEVICE_MEMORY_TARGET);
+    assert(rc);
+
+    VK_CHECK(vkBindImageMemory(device, image->image, image->allocation.memory, image->allocation.offset));
+
+    image->imageView = createImageView(device, image->image, format, aspectMask);
+}
+
+void destroyImage(VkDevice device, DeviceAllocator* allocator, Image* image)
+{
+    vkDestroyImageView(device, image->imageView, 0);
+    vkDestroyImage(device, image->image, 0);
+    deviceFree(allocator, &image->allocation);
+}
+
 typedef struct
 {
     VkSwapchainKHR  swapchain;
@@ -599,7 +983,7 @@ void createSwapchain(Swapchain* swapchain, VkDevice device, VkSurfaceKHR surface
     swapchain->imageViews = calloc(swapchain->imageCount, sizeof(*swapchain->imageViews));
     for (uint32_t i = 0; i < swapchain->imageCount; i++)
     {
-        swapchain->imageViews[i] = createImageView(device, swapchain->images[i], format);
+        swapchain->imageViews[i] = createImageView(device, swapchain->images[i], format, VK_IMAGE_ASPECT_COLOR_BIT);
         assert(swapchain->imageViews[i]);
     }
 
@@ -661,6 +1045,27 @@ VkSemaphore createSemaphore(VkDevice device)
     return semaphore;
 }
 
+// Starts at 0
+VkSemaphore createTimelineSemaphore(VkDevice device)
+{
+    const VkSemaphoreTypeCreateInfo typeInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+    };
+
+    const VkSemaphoreCreateInfo createInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &typeInfo,
+    };
+
+    VkSemaphore semaphore = 0;
+    VK_CHECK(vkCreateSemaphore(device, &createInfo, 0, &semaphore));
+
+    return semaphore;
+}
+
 VkCommandPool createCommandPool(VkDevice device, uint32_t familyIndex)
 {
     const VkCommandPoolCreateInfo createInfo =
@@ -676,165 +1081,1549 @@ VkCommandPool createCommandPool(VkDevice device, uint32_t familyIndex)
     return commandPool;
 }
 
-Vertex* loadObj(const char* path, size_t* pSize)
+VkQueryPool createQueryPool(VkDevice device, VkQueryType type, VkQueryPipelineStatisticFlags statistics, uint32_t count)
 {
-    fastObjMesh* obj = fast_obj_read(path);
-    if (!obj)
-        return 0;
+    const VkQueryPoolCreateInfo createInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = type,
+        .queryCount = count,
+        .pipelineStatistics = statistics,
+    };
 
-    size_t index_count = 0;
+    VkQueryPool queryPool = 0;
+    VK_CHECK(vkCreateQueryPool(device, &createInfo, 0, &queryPool));
 
-    for (uint32_t i = 0; i < obj->face_count; i++)
-        index_count += 3 * (obj->face_vertices[i] - 2);
+    return queryPool;
+}
 
-    Vertex* vertices = calloc(index_count, sizeof(*vertices));
-    *pSize = index_count * sizeof(Vertex);
+// Staging memory for uploads, in two halves: one is filled while the
+// copies out of the other run
+#define UPLOAD_STAGING_SIZE (16 * 1024 * 1024)
+
+// Fills device local buffers through host visible staging memory and
+// vkCmdCopyBuffer. Buffers the host can map are written in place instead,
+// so the same calls cover discrete GPUs with and without resizable BAR and
+// unified memory.
+//
+// Copies run on a transfer only queue where the device has one, so they
+// overlap graphics work. Each submission signals the next value of a
+// timeline semaphore. uploadSubmit publishes what was copied so far:
+// graphics submissions wait for publishedValue and record uploadAcquire,
+// which takes ownership of the copied ranges from the transfer family.
+typedef struct
+{
+    VkDevice                device;
+    VkQueue                 queue;
+    uint32_t                familyIndex;
+    uint32_t                graphicsFamilyIndex;
+    Buffer                  staging;
+    VkCommandPool           commandPools[2];
+    VkCommandBuffer         commandBuffers[2];
+    uint64_t                halfValues[2];      // signaled once the copies out of each half are done
+    uint32_t                half;
+    size_t                  offset;             // into the current half
+    int                     recording;
+
+    VkSemaphore             semaphore;
+    uint64_t                submittedValue;
+    uint64_t                publishedValue;
+
+    // Ranges copied on another family: [0, releasedCount) are released and
+    // wait for uploadAcquire, the rest are released by the next uploadSubmit
+    VkBufferMemoryBarrier*  transfers;
+    size_t                  transferCount;
+    size_t                  releasedCount;
+    size_t                  transferCapacity;
+
+    size_t                  stagedBytes;
+    size_t                  directBytes;
+} Uploader;
+
+void createUploader(Uploader* uploader, VkDevice device, DeviceAllocator* allocator, VkQueue queue, uint32_t familyIndex, uint32_t graphicsFamilyIndex)
+{
+    *uploader = (Uploader){ .device = device, .queue = queue, .familyIndex = familyIndex, .graphicsFamilyIndex = graphicsFamilyIndex };
 
-    size_t vertex_offset = 0;
-    size_t index_offset = 0;
+    createBuffer(&uploader->staging, device, allocator, UPLOAD_STAGING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, DEVICE_MEMORY_STAGING);
 
-    for (uint32_t i = 0; i < obj->face_count; i++)
+    for (int i = 0; i < 2; i++)
     {
-        for (uint32_t j = 0; j < obj->face_vertices[i]; j++)
+        uploader->commandPools[i] = createCommandPool(device, familyIndex);
+        assert(uploader->commandPools[i]);
+
+        const VkCommandBufferAllocateInfo allocateInfo =
         {
-            fastObjIndex gi = obj->indices[index_offset + j];
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = uploader->commandPools[i],
+            .commandBufferCount = 1,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        };
 
-            // triangulate polygons on the fly
-            if (j >= 3)
-            {
-                vertices[vertex_offset + 0] = vertices[vertex_offset - 3];
-                vertices[vertex_offset + 1] = vertices[vertex_offset - 1];
-                vertex_offset += 2;
-            }
+        VK_CHECK(vkAllocateCommandBuffers(device, &allocateInfo, &uploader->commandBuffers[i]));
+    }
 
-            Vertex* v = &vertices[vertex_offset++];
+    uploader->semaphore = createTimelineSemaphore(device);
+    assert(uploader->semaphore);
+}
 
-            v->position[0] = obj->positions[gi.p * 3 + 0];
-            v->position[1] = obj->positions[gi.p * 3 + 1];
-            v->position[2] = obj->positions[gi.p * 3 + 2];
+void waitForUploads(Uploader* uploader, uint64_t value)
+{
+    const VkSemaphoreWaitInfo waitInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &uploader->semaphore,
+        .pValues = &value,
+    };
 
-            v->normal[0] = obj->normals[gi.n * 3 + 0];
-            v->normal[1] = obj->normals[gi.n * 3 + 1];
-            v->normal[2] = obj->normals[gi.n * 3 + 2];
+    VK_CHECK(vkWaitSemaphores(uploader->device, &waitInfo, ~0ull));
+}
 
-            v->texcoord[0] = obj->texcoords[gi.t * 2 + 0];
-            v->texcoord[1] = obj->texcoords[gi.t * 2 + 1];
-        }
+void beginUploads(Uploader* uploader)
+{
+    if (uploader->recording)
+        return;
 
-        index_offset += obj->face_vertices[i];
-    }
+    // The half is reused once the copies out of it are done
+    waitForUploads(uploader, uploader->halfValues[uploader->half]);
+    VK_CHECK(vkResetCommandPool(uploader->device, uploader->commandPools[uploader->half], 0));
 
-    assert(vertex_offset == index_offset);
+    const VkCommandBufferBeginInfo beginInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
 
-    fast_obj_destroy(obj);
+    VK_CHECK(vkBeginCommandBuffer(uploader->commandBuffers[uploader->half], &beginInfo));
 
-    return vertices;
+    uploader->recording = 1;
 }
 
-int main(int argc, char* argv[])
+void submitUploads(Uploader* uploader, int publish)
 {
-    (void) argc, argv;
+    VkCommandBuffer commandBuffer = uploader->commandBuffers[uploader->half];
 
-    int rc = glfwInit();
-    if (rc == 0)
-        return 1;
+    if (uploader->familyIndex == uploader->graphicsFamilyIndex)
+    {
+        // Copies are made visible to anything that reads the buffers later
+        const VkMemoryBarrier uploadBarrier =
+        {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+        };
 
-    VkInstance instance = createInstance();
-    assert(instance);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &uploadBarrier, 0, 0, 0, 0);
+    }
+    else if (publish && uploader->transferCount > uploader->releasedCount)
+    {
+        // Ranges are released to the graphics family only when published,
+        // so ranges copied across several submissions stay with the
+        // transfer family until then
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, 0,
+            (uint32_t)(uploader->transferCount - uploader->releasedCount), uploader->transfers + uploader->releasedCount, 0, 0);
+
+        uploader->releasedCount = uploader->transferCount;
+    }
+
+    VK_CHECK(vkEndCommandBuffer(commandBuffer));
+
+    uint64_t signalValue = ++uploader->submittedValue;
+
+    const VkTimelineSemaphoreSubmitInfo timelineInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &signalValue,
+    };
+
+    const VkSubmitInfo submitInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timelineInfo,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBuffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &uploader->semaphore,
+    };
+
+    VK_CHECK(vkQueueSubmit(uploader->queue, 1, &submitInfo, 0));
+
+    uploader->halfValues[uploader->half] = signalValue;
+    uploader->half ^= 1;
+    uploader->offset = 0;
+    uploader->recording = 0;
+}
+
+// Ranges written on the transfer family are handed to the graphics family
+// later; adjacent ranges of a buffer are merged
+void addUploadTransfer(Uploader* uploader, VkBuffer buffer, size_t offset, size_t size)
+{
+    if (uploader->familyIndex == uploader->graphicsFamilyIndex)
+        return;
+
+    if (uploader->transferCount > uploader->releasedCount)
+    {
+        VkBufferMemoryBarrier* last = &uploader->transfers[uploader->transferCount - 1];
+
+        if (last->buffer == buffer && last->offset + last->size == offset)
+        {
+            last->size += size;
+            return;
+        }
+    }
+
+    if (uploader->transferCount == uploader->transferCapacity)
+    {
+        uploader->transferCapacity = uploader->transferCapacity ? uploader->transferCapacity * 2 : 64;
+        uploader->transfers = realloc(uploader->transfers, uploader->transferCapacity * sizeof(VkBufferMemoryBarrier));
+        assert(uploader->transfers);
+    }
+
+    uploader->transfers[uploader->transferCount++] = (VkBufferMemoryBarrier)
+    {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+        .srcQueueFamilyIndex = uploader->familyIndex,
+        .dstQueueFamilyIndex = uploader->graphicsFamilyIndex,
+        .buffer = buffer,
+        .offset = offset,
+        .size = size,
+    };
+}
+
+void uploadBuffer(Uploader* uploader, const Buffer* buffer, size_t offset, const void* data, size_t size)
+{
+    assert(offset + size <= buffer->size);
+
+    if (buffer->data)
+    {
+        memcpy((char*)buffer->data + offset, data, size);
+        uploader->directBytes += size;
+        return;
+    }
+
+    const size_t halfSize = UPLOAD_STAGING_SIZE / 2;
+
+    while (size)
+    {
+        if (uploader->offset == halfSize)
+            submitUploads(uploader, 0);
+
+        beginUploads(uploader);
+
+        size_t chunk = size < halfSize - uploader->offset ? size : halfSize - uploader->offset;
+        size_t stagingOffset = uploader->half * halfSize + uploader->offset;
+
+        memcpy((char*)uploader->staging.data + stagingOffset, data, chunk);
+
+        const VkBufferCopy region = { stagingOffset, offset, chunk };
+        vkCmdCopyBuffer(uploader->commandBuffers[uploader->half], uploader->staging.buffer, buffer->buffer, 1, &region);
+
+        addUploadTransfer(uploader, buffer->buffer, offset, chunk);
+
+        uploader->offset += chunk;
+        uploader->stagedBytes += chunk;
+
+        data = (const char*)data + chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+// Copies between buffers on the device, after the uploads recorded so far.
+// The source is scratch filled by unpublished uploads: it stays with the
+// transfer family and is not handed over.
+void uploadCopy(Uploader* uploader, const Buffer* src, const Buffer* dst, size_t size)
+{
+    assert(size <= src->size && size <= dst->size);
+
+    beginUploads(uploader);
+
+    VkCommandBuffer commandBuffer = uploader->commandBuffers[uploader->half];
+
+    const VkMemoryBarrier copyBarrier =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+    };
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &copyBarrier, 0, 0, 0, 0);
+
+    const VkBufferCopy region = { 0, 0, size };
+    vkCmdCopyBuffer(commandBuffer, src->buffer, dst->buffer, 1, &region);
+
+    size_t kept = uploader->releasedCount;
+
+    for (size_t i = uploader->releasedCount; i < uploader->transferCount; i++)
+        if (uploader->transfers[i].buffer != src->buffer)
+            uploader->transfers[kept++] = uploader->transfers[i];
+
+    uploader->transferCount = kept;
+
+    addUploadTransfer(uploader, dst->buffer, 0, size);
+}
+
+// Submits the copies recorded so far and publishes them; the host does not wait
+void uploadSubmit(Uploader* uploader)
+{
+    if (uploader->recording || uploader->transferCount > uploader->releasedCount)
+    {
+        beginUploads(uploader);
+        submitUploads(uploader, 1);
+    }
+
+    uploader->publishedValue = uploader->submittedValue;
+}
+
+// As uploadSubmit, and waits for the copies on the host
+void uploadFlush(Uploader* uploader)
+{
+    uploadSubmit(uploader);
+    waitForUploads(uploader, uploader->publishedValue);
+}
+
+// Submits and waits for the copies recorded so far without publishing them,
+// so their ranges stay with the transfer family and can be written again
+void uploadFinish(Uploader* uploader)
+{
+    if (uploader->recording)
+        submitUploads(uploader, 0);
+
+    waitForUploads(uploader, uploader->submittedValue);
+}
+
+// Records the graphics side of the ownership transfers published so far,
+// in a command buffer submitted after waiting for publishedValue
+void uploadAcquire(Uploader* uploader, VkCommandBuffer commandBuffer)
+{
+    if (uploader->releasedCount == 0)
+        return;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, 0,
+        (uint32_t)uploader->releasedCount, uploader->transfers, 0, 0);
+
+    memmove(uploader->transfers, uploader->transfers + uploader->releasedCount, (uploader->transferCount - uploader->releasedCount) * sizeof(VkBufferMemoryBarrier));
+
+    uploader->transferCount -= uploader->releasedCount;
+    uploader->releasedCount = 0;
+}
+
+void destroyUploader(Uploader* uploader, DeviceAllocator* allocator)
+{
+    uploadFlush(uploader);
+
+    for (int i = 0; i < 2; i++)
+        vkDestroyCommandPool(uploader->device, uploader->commandPools[i], 0);
+
+    vkDestroySemaphore(uploader->device, uploader->semaphore, 0);
+    destroyBuffer(uploader->device, allocator, &uploader->staging);
+
+    free(uploader->transfers);
+}
+
+// Per-frame data lives in a ring of FRAME_RING_SIZE bytes; up to
+// FRAME_RING_FRAMES frames may hold parts of it at once
+#define FRAME_RING_SIZE (1024 * 1024)
+#define FRAME_RING_FRAMES 8
+
+// Hands out aligned ranges of a persistently mapped buffer for data the
+// host writes every frame, without allocating. A frame's ranges are
+// reclaimed once the timeline value its submission signals is reached;
+// only a full ring makes the host wait. Positions are running byte counts,
+// so head - tail is the number of bytes in flight.
+typedef struct
+{
+    VkDevice    device;
+    VkSemaphore semaphore;
+    Buffer      buffer;
+    size_t      alignment;
+
+    uint64_t    head;
+    uint64_t    tail;
+    uint64_t    frameStart;
+
+    uint64_t    frameValues[FRAME_RING_FRAMES];
+    uint64_t    frameEnds[FRAME_RING_FRAMES];
+    uint32_t    frameFirst;
+    uint32_t    frameCount;
+
+    size_t      frameHighWater;     // most bytes one frame took, wrap padding included
+    size_t      highWater;          // most bytes in flight
+} FrameRing;
+
+void createFrameRing(FrameRing* ring, VkDevice device, DeviceAllocator* allocator, VkSemaphore semaphore, size_t alignment)
+{
+    *ring = (FrameRing){ .device = device, .semaphore = semaphore, .alignment = alignment };
+
+    createBuffer(&ring->buffer, device, allocator, FRAME_RING_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, DEVICE_MEMORY_FRAME);
+}
+
+void destroyFrameRing(FrameRing* ring, DeviceAllocator* allocator)
+{
+    destroyBuffer(ring->device, allocator, &ring->buffer);
+}
+
+// Reclaims the frames whose submissions have signaled completedValue
+void frameRingRetire(FrameRing* ring, uint64_t completedValue)
+{
+    while (ring->frameCount && ring->frameValues[ring->frameFirst] <= completedValue)
+    {
+        ring->tail = ring->frameEnds[ring->frameFirst];
+        ring->frameFirst = (ring->frameFirst + 1) % FRAME_RING_FRAMES;
+        ring->frameCount--;
+    }
+}
+
+void frameRingWaitOldest(FrameRing* ring)
+{
+    assert(ring->frameCount);
+
+    uint64_t value = ring->frameValues[ring->frameFirst];
+
+    const VkSemaphoreWaitInfo waitInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &ring->semaphore,
+        .pValues = &value,
+    };
+
+    VK_CHECK(vkWaitSemaphores(ring->device, &waitInfo, ~0ull));
+
+    frameRingRetire(ring, value);
+}
+
+// Returns where to write size bytes for the current frame, and describes
+// the range for a push descriptor
+void* frameRingAlloc(FrameRing* ring, size_t size, VkDescriptorBufferInfo* info)
+{
+    assert(size <= FRAME_RING_SIZE);
+
+    size_t offset = (size_t)(ring->head % FRAME_RING_SIZE);
+    size_t aligned = (offset + ring->alignment - 1) & ~(ring->alignment - 1);
+
+    // Ranges do not wrap; the end of the ring is skipped instead
+    if (aligned + size > FRAME_RING_SIZE)
+        aligned = FRAME_RING_SIZE;
+
+    uint64_t start = ring->head + (aligned - offset);
+
+    if (aligned == FRAME_RING_SIZE)
+        aligned = 0;
+
+    while (start + size - ring->tail > FRAME_RING_SIZE)
+        frameRingWaitOldest(ring);
+
+    ring->head = start + size;
+
+    size_t inFlight = (size_t)(ring->head - ring->tail);
+    ring->highWater = inFlight > ring->highWater ? inFlight : ring->highWater;
+
+    *info = (VkDescriptorBufferInfo){ ring->buffer.buffer, aligned, size };
+
+    return (char*)ring->buffer.data + aligned;
+}
+
+// Closes the current frame; its ranges are reclaimed once value is signaled
+void frameRingEnd(FrameRing* ring, uint64_t value)
+{
+    if (ring->frameCount == FRAME_RING_FRAMES)
+        frameRingWaitOldest(ring);
+
+    uint32_t index = (ring->frameFirst + ring->frameCount++) % FRAME_RING_FRAMES;
+
+    ring->frameValues[index] = value;
+    ring->frameEnds[index] = ring->head;
+
+    size_t frameBytes = (size_t)(ring->head - ring->frameStart);
+    ring->frameHighWater = frameBytes > ring->frameHighWater ? frameBytes : ring->frameHighWater;
+
+    ring->frameStart = ring->head;
+}
+
+// Draws take 32-bit vertex and index counts; larger meshes from the 64-bit
+// loader build are turned away before anything is uploaded for them
+int checkDrawLimits(const Mesh* mesh)
+{
+    if (mesh->vertexCount <= UINT32_MAX && mesh->indexCount <= UINT32_MAX)
+        return 1;
+
+    printf("Mesh has %zu vertices and %zu indices, more than a draw can address\n", mesh->vertexCount, mesh->indexCount);
+    return 0;
+}
+
+// Vertices the stream buffers start out with; they double whenever a batch
+// does not fit
+#define STREAM_VERTEX_CAPACITY (4 * 1024 * 1024)
+
+// Where streamed batches go: the vertex buffer, and with a depth pass also
+// a stream of their positions as three floats each, gathered in scratch.
+// Both hold capacity vertices.
+typedef struct
+{
+    Uploader*             uploader;
+    Buffer*               vertices;
+    Buffer*               positions;
+    float*                scratch;
+
+    VkDevice              device;
+    DeviceAllocator*      allocator;
+    VkBufferUsageFlags    vertexUsage;
+    VkBufferUsageFlags    positionUsage;
+    VkMemoryPropertyFlags preferred;
+    size_t                capacity;
+} VertexUpload;
+
+// Moves the first used bytes of a stream buffer into a new one of size bytes;
+// the old buffer is destroyed once the copy is done
+void growStreamBuffer(VertexUpload* upload, Buffer* buffer, size_t used, size_t size, VkBufferUsageFlags usage)
+{
+    Buffer old = *buffer;
+
+    createBuffer(buffer, upload->device, upload->allocator, size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, upload->preferred, DEVICE_MEMORY_GEOMETRY);
+
+    if (used)
+        uploadCopy(upload->uploader, &old, buffer, used);
+
+    uploadFinish(upload->uploader);
+
+    destroyBuffer(upload->device, upload->allocator, &old);
+}
+
+// Batches are copied out of the ring slot before this returns, so there is
+// nothing to wait for when the slot is refilled
+void uploadVertices(void* context, uint32_t slot, const Vertex* vertices, size_t count, size_t offset)
+{
+    (void) slot;
+
+    VertexUpload* upload = context;
+
+    if (offset + count > upload->capacity)
+    {
+        size_t capacity = upload->capacity;
+        while (capacity < offset + count)
+            capacity *= 2;
+
+        growStreamBuffer(upload, upload->vertices, offset * sizeof(Vertex), capacity * sizeof(Vertex), upload->vertexUsage);
+
+        if (upload->positions)
+            growStreamBuffer(upload, upload->positions, offset * 3 * sizeof(float), capacity * 3 * sizeof(float), upload->positionUsage);
+
+        upload->capacity = capacity;
+    }
+
+    uploadBuffer(upload->uploader, upload->vertices, offset * sizeof(Vertex), vertices, count * sizeof(Vertex));
+
+    if (upload->positions)
+    {
+        for (size_t i = 0; i < count; i++)
+            memcpy(&upload->scratch[i * 3], vertices[i].position, 3 * sizeof(float));
+
+        uploadBuffer(upload->uploader, upload->positions, offset * 3 * sizeof(float), upload->scratch, count * 3 * sizeof(float));
+    }
+}
+
+void waitForUpload(void* context, uint32_t slot)
+{
+    (void) context, slot;
+}
+
+// Nothing streams while frames are drawn yet, so there is nothing to back off; the crossing is logged
+void reportBudgetExceeded(void* context, uint32_t heapIndex, VkDeviceSize usage, VkDeviceSize budget)
+{
+    (void) context;
+
+    printf("Device memory: heap %u over budget, %.1f of %.1f MiB in use\n", heapIndex, (double) usage / (1024.0 * 1024.0), (double) budget / (1024.0 * 1024.0));
+}
+
+// Usage against budget for each heap, and this process's share of it by category
+void printMemoryBudget(const DeviceAllocator* allocator)
+{
+    DeviceMemoryBudget budget;
+    deviceAllocatorBudget(allocator, &budget);
+
+    const double mib = 1024.0 * 1024.0;
+
+    for (uint32_t i = 0; i < budget.heapCount; i++)
+    {
+        const VkDeviceSize* bytes = budget.categoryBytes[i];
+
+        printf("Heap %u: %.1f of %.1f MiB budget%s, %.1f MiB in blocks: geometry %.1f, staging %.1f, frame %.1f, targets %.1f, scratch %.1f\n",
+            i, (double) budget.usage[i] / mib, (double) budget.budget[i] / mib, budget.driverBudget ? "" : " (estimated)", (double) budget.blockBytes[i] / mib,
+            (double) bytes[DEVICE_MEMORY_GEOMETRY] / mib, (double) bytes[DEVICE_MEMORY_STAGING] / mib, (double) bytes[DEVICE_MEMORY_FRAME] / mib,
+            (double) bytes[DEVICE_MEMORY_TARGET] / mib, (double) bytes[DEVICE_MEMORY_SCRATCH] / mib);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // --stream loads the mesh through a staging ring of --staging-budget=<MiB> instead of in one piece.
+    // --meshlets draws meshlets culled by a compute pass, and --mesh-shading culls
+    // and draws them in task and mesh shaders where the device supports it.
+    // --lod-threshold=<pixels> is the screen space error allowed when picking a LOD.
+    // --check-normals compares normals generated on the GPU with a CPU reference.
+    // --depth-pass draws the mesh into an offscreen depth target from a separate
+    // position stream before each frame, and times that against full vertices.
+    // --strips draws indexed meshes as triangle strips with primitive restart
+    // instead of lists; both report the average GPU time of the draw.
+    // --read-ahead parses the OBJ on one thread from reads kept in flight by the
+    // file queue, instead of mapping it and parsing it across threads.
+    int streamMode = 0;
+    size_t stagingBudget = 16 * 1024 * 1024;
+    int meshletMode = 0;
+    int meshShadingMode = 0;
+    float lodThreshold = 1.f;
+    int checkNormals = 0;
+    int depthPass = 0;
+    int stripMode = 0;
+    int readAhead = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--stream") == 0)
+            streamMode = 1;
+        else if (strncmp(argv[i], "--staging-budget=", 17) == 0)
+            stagingBudget = (size_t)atoi(argv[i] + 17) * 1024 * 1024;
+        else if (strcmp(argv[i], "--meshlets") == 0)
+            meshletMode = 1;
+        else if (strcmp(argv[i], "--mesh-shading") == 0)
+            meshShadingMode = 1;
+        else if (strncmp(argv[i], "--lod-threshold=", 16) == 0)
+            lodThreshold = (float)atof(argv[i] + 16);
+        else if (strcmp(argv[i], "--check-normals") == 0)
+            checkNormals = 1;
+        else if (strcmp(argv[i], "--depth-pass") == 0)
+            depthPass = 1;
+        else if (strcmp(argv[i], "--strips") == 0)
+            stripMode = 1;
+        else if (strcmp(argv[i], "--read-ahead") == 0)
+            readAhead = 1;
+    }
+
+    // Meshlets are built from the index stream and the vertices on the host,
+    // and streamed meshes have neither
+    if (streamMode && (meshletMode || meshShadingMode))
+    {
+        printf("Meshlets need a welded mesh, ignoring --meshlets and --mesh-shading with --stream\n");
+        meshletMode = meshShadingMode = 0;
+    }
+
+    // Meshlets index their triangles as a list
+    if (stripMode && (meshletMode || meshShadingMode))
+    {
+        printf("Meshlets are drawn as lists, ignoring --strips with --meshlets and --mesh-shading\n");
+        stripMode = 0;
+    }
+
+    // Asset reads are started up front and overlap instance and device setup
+    FileQueue* io = fileQueueCreate(16);
+    assert(io);
+
+    FileLoad triangleVSLoad, triangleFSLoad;
+
+    int rc = fileLoadBegin(io, &triangleVSLoad, "bin/trig.vert.spv");
+    assert(rc);
+
+    rc = fileLoadBegin(io, &triangleFSLoad, "bin/trig.frag.spv");
+    assert(rc);
+
+    // Whether the mesh needs its normals generated is only known once it is
+    // loaded, so that shader is always read
+    FileLoad normalsCSLoad;
+
+    rc = fileLoadBegin(io, &normalsCSLoad, "bin/normals.comp.spv");
+    assert(rc);
+
+    FileLoad depthVSLoad;
+
+    if (depthPass)
+    {
+        rc = fileLoadBegin(io, &depthVSLoad, "bin/depth.vert.spv");
+        assert(rc);
+    }
+
+    // The mesh shaders are read even if the device turns out not to support them
+    FileLoad cullCSLoad, meshletTSLoad, meshletMSLoad;
+
+    if (meshletMode || meshShadingMode)
+    {
+        rc = fileLoadBegin(io, &cullCSLoad, "bin/cull.comp.spv");
+        assert(rc);
+    }
+
+    if (meshShadingMode)
+    {
+        rc = fileLoadBegin(io, &meshletTSLoad, "bin/meshlet.task.spv");
+        assert(rc);
+
+        rc = fileLoadBegin(io, &meshletMSLoad, "bin/meshlet.mesh.spv");
+        assert(rc);
+    }
+
+    rc = glfwInit();
+    if (rc == 0)
+        return 1;
+
+    VkInstance instance = createInstance();
+    assert(instance);
+
+#ifndef NDEBUG
+    VkDebugReportCallbackEXT debugCallback = registerDebugCallback(instance);
+    assert(debugCallback);
+#endif
+
+    VkPhysicalDevice physicalDevice = pickPhysicalDevice(instance);
+    assert(physicalDevice);
+
+    uint32_t familyIndex = getGraphicsQueueFamily(physicalDevice);
+    assert(familyIndex != VK_QUEUE_FAMILY_IGNORED);
+
+    uint32_t transferFamilyIndex = getTransferQueueFamily(physicalDevice);
+
+    int meshShaderExtension = hasDeviceExtension(physicalDevice, VK_EXT_MESH_SHADER_EXTENSION_NAME);
+    int memoryBudget = hasDeviceExtension(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    VkPhysicalDeviceMeshShaderFeaturesEXT supportedMeshFeatures =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+    };
+
+    VkPhysicalDeviceVulkan12Features supportedFeatures12 =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = meshShaderExtension ? &supportedMeshFeatures : 0,
+    };
+
+    VkPhysicalDeviceFeatures2 supportedFeatures =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supportedFeatures12,
+    };
+
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
+
+    if (!supportedFeatures12.timelineSemaphore)
+    {
+        printf("Timeline semaphores not supported\n");
+        return 1;
+    }
+
+    VkBool32 meshShading = meshShadingMode && supportedMeshFeatures.taskShader && supportedMeshFeatures.meshShader;
+
+    if (meshShadingMode && !meshShading)
+    {
+        printf("Mesh shaders not supported, culling meshlets in a compute pass instead\n");
+        meshletMode = 1;
+    }
+
+    VkPhysicalDeviceMeshShaderFeaturesEXT meshFeatures =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+        .taskShader = meshShading,
+        .meshShader = meshShading,
+    };
+
+    // Uploads signal a timeline semaphore
+    VkPhysicalDeviceVulkan12Features features12 =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = meshShading ? &meshFeatures : 0,
+        .timelineSemaphore = VK_TRUE,
+    };
+
+    // Vertex shader invocations are counted where pipeline statistics are
+    // available, and culled meshlets are drawn with one indirect call where
+    // multi-draw is
+    const VkPhysicalDeviceFeatures2 features =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &features12,
+        .features.pipelineStatisticsQuery = supportedFeatures.features.pipelineStatisticsQuery,
+        .features.multiDrawIndirect = supportedFeatures.features.multiDrawIndirect,
+    };
+
+    VkDevice device = createDevice(physicalDevice, familyIndex, transferFamilyIndex, &features, meshShading, memoryBudget);
+    assert(device);
+
+    VkPhysicalDeviceProperties deviceProps;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProps);
+
+    // Buffers and images are placed in large blocks of device memory, and
+    // heaps getting close to their budget are reported as they cross it
+    DeviceAllocator* allocator = deviceAllocatorCreate(physicalDevice, device, memoryBudget);
+    assert(allocator);
+
+    deviceAllocatorSetBudgetCallback(allocator, reportBudgetExceeded, 0);
+
+    // Geometry lives in device local memory. Where the host can map all of
+    // it, it is written in place rather than staged; buffers the host reads
+    // back stay in host memory.
+    VkPhysicalDeviceMemoryProperties memProps;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProps);
+
+    int directUploads = isDeviceMemoryMappable(&memProps);
+
+    const VkMemoryPropertyFlags hostMemory = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    const VkMemoryPropertyFlags geometryPreferred = directUploads ? hostMemory : 0;
+
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    GLFWwindow* window = glfwCreateWindow(1600, 900, "Vulkan Renderer", 0, 0);
+    assert(window);
+
+    VkSurfaceKHR surface = createSurface(instance, window);
+    assert(surface);
+
+    VkFormat surfaceFormat = getSurfaceFormat(physicalDevice, surface);
+
+    VkRenderPass renderPass = createRenderPass(device, surfaceFormat);
+    assert(renderPass);
+
+    VkShaderModule triangleVS = loadShader(device, io, &triangleVSLoad);
+    assert(triangleVS);
+
+    VkShaderModule triangleFS = loadShader(device, io, &triangleFSLoad);
+    assert(triangleFS);
+
+    VkShaderModule depthVS = 0;
+
+    if (depthPass)
+    {
+        depthVS = loadShader(device, io, &depthVSLoad);
+        assert(depthVS);
+    }
+
+    VkShaderModule cullCS = 0;
+    VkShaderModule meshletTS = 0;
+    VkShaderModule meshletMS = 0;
+
+    if (meshletMode || meshShadingMode)
+    {
+        cullCS = loadShader(device, io, &cullCSLoad);
+        assert(cullCS);
+    }
+
+    if (meshShading)
+    {
+        meshletTS = loadShader(device, io, &meshletTSLoad);
+        assert(meshletTS);
+
+        meshletMS = loadShader(device, io, &meshletMSLoad);
+        assert(meshletMS);
+    }
+    else if (meshShadingMode)
+    {
+        size_t len = 0;
+        free(fileLoadEnd(io, &meshletTSLoad, &len));
+        free(fileLoadEnd(io, &meshletMSLoad, &len));
+    }
+
+    // TODO: this is critical for performance!
+    VkPipelineCache pipelineCache = 0;
+
+    // Vertices, and the frame's data from the frame ring
+    VkDescriptorSetLayout setLayout = createDescriptorSetLayout(device, 2, VK_SHADER_STAGE_VERTEX_BIT);
+    assert(setLayout);
+
+    VkPipelineLayout triangleLayout = createPipelineLayout(device, setLayout, VK_SHADER_STAGE_VERTEX_BIT);
+    assert(triangleLayout);
+
+    // Streamed batches are uploaded before the bounds the packed positions are
+    // relative to are known, so only whole meshes are packed
+    VkBool32 packedVertices = !streamMode;
+
+    const ShaderStage triangleShaders[] =
+    {
+        { VK_SHADER_STAGE_VERTEX_BIT, triangleVS },
+        { VK_SHADER_STAGE_FRAGMENT_BIT, triangleFS },
+    };
+
+    VkPipeline trianglePipeline = createGraphicsPipeline(device, pipelineCache, renderPass, triangleShaders, countof(triangleShaders), triangleLayout, &packedVertices, 1, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_FALSE);
+    assert(trianglePipeline);
+
+    VkPipeline stripPipeline = 0;
+
+    if (stripMode)
+    {
+        stripPipeline = createGraphicsPipeline(device, pipelineCache, renderPass, triangleShaders, countof(triangleShaders), triangleLayout, &packedVertices, 1, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP, VK_FALSE);
+        assert(stripPipeline);
+    }
+
+    // The depth pass reads vertices at binding 0 and the position stream at
+    // binding 1, with a pipeline for each, and the frame's data at binding 2; the one reading full vertices is
+    // only there to compare with. It renders to a target of its own, like a
+    // shadow map would.
+    VkDescriptorSetLayout depthSetLayout = 0;
+    VkPipelineLayout depthLayout = 0;
+    VkPipeline depthPipelines[2] = {0};
+    VkRenderPass depthRenderPass = 0;
+    Image depthTarget = {0};
+    VkFramebuffer depthFramebuffer = 0;
+    VkQueryPool depthTimestampPool = 0;
+
+    if (depthPass)
+    {
+        depthSetLayout = createDescriptorSetLayout(device, 3, VK_SHADER_STAGE_VERTEX_BIT);
+        assert(depthSetLayout);
+
+        depthLayout = createPipelineLayout(device, depthSetLayout, VK_SHADER_STAGE_VERTEX_BIT);
+        assert(depthLayout);
+
+        VkFormat depthFormat = getDepthFormat(physicalDevice);
+        assert(depthFormat != VK_FORMAT_UNDEFINED);
+
+        depthRenderPass = createDepthRenderPass(device, depthFormat);
+        assert(depthRenderPass);
+
+        const ShaderStage depthShaders[] =
+        {
+            { VK_SHADER_STAGE_VERTEX_BIT, depthVS },
+        };
+
+        for (uint32_t i = 0; i < countof(depthPipelines); i++)
+        {
+            // constant_id 3 in depth.vert picks the position stream
+            const uint32_t constants[] = { packedVertices, 0, 0, i == DEPTH_PASS_POSITION_STREAM };
+
+            depthPipelines[i] = createGraphicsPipeline(device, pipelineCache, depthRenderPass, depthShaders, countof(depthShaders), depthLayout, constants, countof(constants), VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_TRUE);
+            assert(depthPipelines[i]);
+        }
+
+        createImage(&depthTarget, device, allocator, DEPTH_PASS_SIZE, DEPTH_PASS_SIZE, depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+        depthFramebuffer = createFramebuffer(device, depthRenderPass, depthTarget.imageView, DEPTH_PASS_SIZE, DEPTH_PASS_SIZE);
+        assert(depthFramebuffer);
+
+        depthTimestampPool = createQueryPool(device, VK_QUERY_TYPE_TIMESTAMP, 0, 3);
+        assert(depthTimestampPool);
+    }
+
+    // Culling reads meshlets at binding 0 and the frame's data at binding 2, and
+    // writes one indirect draw per meshlet at binding 1
+    VkDescriptorSetLayout cullSetLayout = 0;
+    VkPipelineLayout cullLayout = 0;
+    VkPipeline cullPipeline = 0;
+
+    if (meshletMode)
+    {
+        cullSetLayout = createDescriptorSetLayout(device, 3, VK_SHADER_STAGE_COMPUTE_BIT);
+        assert(cullSetLayout);
+
+        cullLayout = createPipelineLayout(device, cullSetLayout, VK_SHADER_STAGE_COMPUTE_BIT);
+        assert(cullLayout);
+
+        cullPipeline = createComputePipeline(device, pipelineCache, cullCS, cullLayout, 0, 0);
+        assert(cullPipeline);
+    }
+
+    // Task and mesh shaders read vertices, meshlets, meshlet vertices and
+    // meshlet triangles at bindings 0 to 3, and the frame's data at binding 4
+    VkDescriptorSetLayout meshletSetLayout = 0;
+    VkPipelineLayout meshletLayout = 0;
+    VkPipeline meshletPipeline = 0;
+
+    if (meshShading)
+    {
+        meshletSetLayout = createDescriptorSetLayout(device, 5, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT);
+        assert(meshletSetLayout);
+
+        meshletLayout = createPipelineLayout(device, meshletSetLayout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT);
+        assert(meshletLayout);
+
+        const ShaderStage meshletShaders[] =
+        {
+            { VK_SHADER_STAGE_TASK_BIT_EXT, meshletTS },
+            { VK_SHADER_STAGE_MESH_BIT_EXT, meshletMS },
+            { VK_SHADER_STAGE_FRAGMENT_BIT, triangleFS },
+        };
+
+        meshletPipeline = createGraphicsPipeline(device, pipelineCache, renderPass, meshletShaders, countof(meshletShaders), meshletLayout, &packedVertices, 1, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_FALSE);
+        assert(meshletPipeline);
+    }
+
+    int windowWidth, windowHeight;
+    glfwGetWindowSize(window, &windowWidth, &windowHeight);
+
+    Swapchain swapchain;
+    createSwapchain(&swapchain, device, surface, familyIndex, surfaceFormat, windowWidth, windowHeight, renderPass, 0);
+
+    VkSemaphore acquireSemaphore = createSemaphore(device);
+    assert(acquireSemaphore);
+
+    VkSemaphore releaseSemaphore = createSemaphore(device);
+    assert(releaseSemaphore);
+
+    // Frame submissions signal their index, which tells the frame ring what the GPU is done with
+    VkSemaphore frameSemaphore = createTimelineSemaphore(device);
+    assert(frameSemaphore);
+
+    size_t frameAlignment = deviceProps.limits.minStorageBufferOffsetAlignment > deviceProps.limits.minUniformBufferOffsetAlignment
+        ? deviceProps.limits.minStorageBufferOffsetAlignment : deviceProps.limits.minUniformBufferOffsetAlignment;
+
+    FrameRing frameRing;
+    createFrameRing(&frameRing, device, allocator, frameSemaphore, frameAlignment);
+
+    VkQueue queue = 0;
+    vkGetDeviceQueue(device, familyIndex, 0, &queue);
+
+    VkCommandPool commandPool = createCommandPool(device, familyIndex);
+    assert(commandPool);
+
+    const VkCommandBufferAllocateInfo allocateInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = commandPool,
+        .commandBufferCount = 1,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    };
+
+    VkCommandBuffer commandBuffer = 0;
+    VK_CHECK(vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer));
+
+    // Mesh shading runs no vertex shaders, so there is nothing to count
+    VkQueryPool statisticsPool = 0;
+    if (features.features.pipelineStatisticsQuery && !meshShading)
+    {
+        statisticsPool = createQueryPool(device, VK_QUERY_TYPE_PIPELINE_STATISTICS, VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT, 1);
+        assert(statisticsPool);
+    }
+
+    // Every frame's draw is timed, and the average is reported every DRAW_TIMING_FRAMES frames
+    VkQueryPool drawTimestampPool = createQueryPool(device, VK_QUERY_TYPE_TIMESTAMP, 0, 2);
+    assert(drawTimestampPool);
+
+    Arena meshArena;
+    rc = arenaCreate(&meshArena, 1024 * 1024 * 1024);
+    assert(rc);
+
+    // Uploads go through the transfer queue where there is one, and the graphics queue otherwise
+    VkQueue transferQueue = queue;
+
+    if (transferFamilyIndex != VK_QUEUE_FAMILY_IGNORED)
+        vkGetDeviceQueue(device, transferFamilyIndex, 0, &transferQueue);
+
+    Uploader uploader;
+    createUploader(&uploader, device, allocator, transferQueue, transferFamilyIndex != VK_QUEUE_FAMILY_IGNORED ? transferFamilyIndex : familyIndex, familyIndex);
+
+    // The position stream holds what the depth pass reads: floats for
+    // streamed meshes, which are not packed, and PackedPosition otherwise
+    Buffer vb = {0};
+    Buffer positionBuffer = {0};
+    size_t positionSize = packedVertices ? sizeof(PackedPosition) : 3 * sizeof(float);
+
+    const VkBufferUsageFlags vertexUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    const VkBufferUsageFlags positionUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    Mesh mesh;
+
+    if (streamMode)
+    {
+        // The vertex count of a streamed mesh is known once it is loaded, so
+        // it goes into buffers of STREAM_VERTEX_CAPACITY vertices first,
+        // grown as needed, and is copied into exactly sized ones after
+        createBuffer(&vb, device, allocator, STREAM_VERTEX_CAPACITY * sizeof(Vertex), vertexUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, geometryPreferred, DEVICE_MEMORY_GEOMETRY);
+
+        if (depthPass)
+            createBuffer(&positionBuffer, device, allocator, STREAM_VERTEX_CAPACITY * positionSize, positionUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, geometryPreferred, DEVICE_MEMORY_GEOMETRY);
+
+        const uint32_t slotCount = 4;
+
+        StagingRing ring =
+        {
+            .slotSize = stagingBudget / slotCount / sizeof(Vertex),
+            .slotCount = slotCount,
+            .upload = uploadVertices,
+            .wait = waitForUpload,
+        };
+
+        assert(ring.slotSize > 0);
+        ring.vertices = malloc(ring.slotCount * ring.slotSize * sizeof(Vertex));
+        assert(ring.vertices);
+
+        VertexUpload upload =
+        {
+            .uploader = &uploader,
+            .vertices = &vb,
+            .positions = depthPass ? &positionBuffer : 0,
+            .device = device,
+            .allocator = allocator,
+            .vertexUsage = vertexUsage,
+            .positionUsage = positionUsage,
+            .preferred = geometryPreferred,
+            .capacity = STREAM_VERTEX_CAPACITY,
+        };
+
+        if (depthPass)
+        {
+            upload.scratch = malloc(ring.slotSize * 3 * sizeof(float));
+            assert(upload.scratch);
+        }
+
+        ring.context = &upload;
+
+        rc = streamMesh(&mesh, &meshArena, "data/kitten.obj", &ring, readAhead ? io : 0);
+        assert(rc);
+
+        if (!checkDrawLimits(&mesh))
+            return 1;
+
+        free(upload.scratch);
+        free(ring.vertices);
+
+        Buffer streamed[2] = { vb, positionBuffer };
+
+        createBuffer(&vb, device, allocator, mesh.vertexCount * sizeof(Vertex), vertexUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, geometryPreferred, DEVICE_MEMORY_GEOMETRY);
+        uploadCopy(&uploader, &streamed[0], &vb, vb.size);
+
+        if (depthPass)
+        {
+            createBuffer(&positionBuffer, device, allocator, mesh.vertexCount * positionSize, positionUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, geometryPreferred, DEVICE_MEMORY_GEOMETRY);
+            uploadCopy(&uploader, &streamed[1], &positionBuffer, positionBuffer.size);
+        }
+
+        uploadFlush(&uploader);
+
+        destroyBuffer(device, allocator, &streamed[0]);
+
+        if (depthPass)
+            destroyBuffer(device, allocator, &streamed[1]);
+    }
+    else
+    {
+        // Without --read-ahead an OBJ is mapped, parsed across threads and
+        // gathered across threads; a valid cache skips all of it
+        double loadStart = glfwGetTime();
+
+        rc = loadMesh(&mesh, &meshArena, "data/kitten.obj", readAhead ? io : 0);
+        assert(rc);
+
+        printf("Mesh load: %.2f ms, %s\n", (glfwGetTime() - loadStart) * 1000.0,
+            mesh.mapping ? "from cache" : readAhead ? "parsed from reads ahead" : "mapped and parsed in parallel");
+
+        if (!checkDrawLimits(&mesh))
+            return 1;
+
+        // Vertices are packed on the host into memory that is uploaded from
+        PackedVertex* packed = malloc(mesh.vertexCount * sizeof(PackedVertex));
+        assert(packed);
+
+        PackedVertexError packError = packVertices(packed, mesh.vertices, mesh.vertexCount, mesh.boundsMin, mesh.boundsMax);
+
+        createBuffer(&vb, device, allocator, mesh.vertexCount * sizeof(PackedVertex), vertexUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, geometryPreferred, DEVICE_MEMORY_GEOMETRY);
+        uploadBuffer(&uploader, &vb, 0, packed, vb.size);
+
+        free(packed);
+
+        printf("Packed vertices: %zu bytes, max error position %g, normal %.2f degrees, texcoord %g\n", sizeof(PackedVertex), packError.position, packError.normal, packError.texcoord);
+
+        if (depthPass)
+        {
+            PackedPosition* positions = malloc(mesh.vertexCount * sizeof(PackedPosition));
+            assert(positions);
+
+            packPositions(positions, mesh.vertices, mesh.vertexCount, mesh.boundsMin, mesh.boundsMax);
+
+            createBuffer(&positionBuffer, device, allocator, mesh.vertexCount * sizeof(PackedPosition), positionUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, geometryPreferred, DEVICE_MEMORY_GEOMETRY);
+            uploadBuffer(&uploader, &positionBuffer, 0, positions, positionBuffer.size);
+
+            free(positions);
+        }
+    }
+
+    VertexConstants vertexConstants = {0};
+
+    for (int k = 0; k < 3; k++)
+    {
+        vertexConstants.positionOffset[k] = mesh.boundsMin[k];
+        vertexConstants.positionScale[k] = mesh.boundsMax[k] - mesh.boundsMin[k];
+    }
+
+    // Welded meshes get a LOD chain sharing the vertex buffer; streamed ones
+    // are unindexed and drawn as they are
+    MeshLods lods = {0};
+
+    if (mesh.indexCount)
+    {
+        rc = buildLods(&lods, &mesh, &meshArena);
+        assert(rc);
+
+        for (uint32_t i = 0; i < lods.lodCount; i++)
+            printf("LOD %u: %u triangles, error %g\n", i, lods.lods[i].indexCount / 3, lods.lods[i].error);
+    }
+    else
+    {
+        lods.lods[0] = (MeshLod){ 0, (uint32_t) mesh.indexCount, 0.f };
+        lods.lodCount = 1;
+        lods.indices = mesh.indices;
+        lods.indexCount = mesh.indexCount;
+    }
+
+    // Welded meshes are drawn indexed. 16-bit indices cover up to 65535
+    // vertices, which keeps 0xffff free for a restart index. LOD 0 comes
+    // first, so meshlet draws index the buffer as if it held the mesh alone.
+    Buffer ib = {0};
+    VkIndexType indexType = mesh.vertexCount <= 0xffff ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+    if (lods.indexCount)
+    {
+        // Normal generation reads the indices as whole words
+        size_t indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+        createBuffer(&ib, device, allocator, (lods.indexCount * indexSize + 3) & ~(size_t)3, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, geometryPreferred, DEVICE_MEMORY_GEOMETRY);
+
+        if (indexType == VK_INDEX_TYPE_UINT16)
+        {
+            uint16_t* indices = calloc(ib.size / sizeof(uint16_t), sizeof(uint16_t));
+            assert(indices);
+
+            for (size_t i = 0; i < lods.indexCount; i++)
+                indices[i] = (uint16_t)lods.indices[i];
+
+            uploadBuffer(&uploader, &ib, 0, indices, ib.size);
+            free(indices);
+        }
+        else
+            uploadBuffer(&uploader, &ib, 0, lods.indices, ib.size);
+    }
+
+    // Strips go in a buffer of their own, since normal generation, meshlets
+    // and the depth pass index the lists. The restart index is the largest
+    // index of either type, which no vertex uses.
+    Buffer sb = {0};
+    MeshLods strips = {0};
+
+    if (stripMode && lods.indexCount)
+    {
+        uint32_t restartIndex = indexType == VK_INDEX_TYPE_UINT16 ? 0xffff : ~0u;
+
+        rc = buildStrips(&strips, &lods, mesh.vertexCount, restartIndex, &meshArena);
+        assert(rc);
+
+        size_t indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+        createBuffer(&sb, device, allocator, strips.indexCount * indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, geometryPreferred, DEVICE_MEMORY_GEOMETRY);
+
+        if (indexType == VK_INDEX_TYPE_UINT16)
+        {
+            uint16_t* indices = malloc(strips.indexCount * sizeof(uint16_t));
+            assert(indices);
+
+            for (size_t i = 0; i < strips.indexCount; i++)
+                indices[i] = (uint16_t)strips.indices[i];
+
+            uploadBuffer(&uploader, &sb, 0, indices, sb.size);
+            free(indices);
+        }
+        else
+            uploadBuffer(&uploader, &sb, 0, strips.indices, sb.size);
 
-#ifndef NDEBUG
-    VkDebugReportCallbackEXT debugCallback = registerDebugCallback(instance);
-    assert(debugCallback);
-#endif
+        size_t restarts = 0;
+        for (size_t i = 0; i < strips.lods[0].indexCount; i++)
+            restarts += strips.indices[strips.lods[0].indexOffset + i] == restartIndex;
 
-    VkPhysicalDevice physicalDevice = pickPhysicalDevice(instance);
-    assert(physicalDevice);
+        printf("Strips: LOD 0 takes %u indices in %zu strips against %u as a list; all LODs take %zu bytes against %zu\n",
+            strips.lods[0].indexCount, restarts + 1, lods.lods[0].indexCount, strips.indexCount * indexSize, lods.indexCount * indexSize);
+    }
+    else if (stripMode)
+    {
+        printf("Strips need an indexed mesh, drawing the unindexed stream as a list\n");
+        stripMode = 0;
+    }
 
-    uint32_t familyIndex = getGraphicsQueueFamily(physicalDevice);
-    assert(familyIndex != VK_QUEUE_FAMILY_IGNORED);
+    // Geometry copies run while the mesh is analyzed and shaders are
+    // built; normal generation and draws wait for them on the GPU
+    uploadSubmit(&uploader);
 
-    VkDevice device = createDevice(physicalDevice, familyIndex);
-    assert(device);
+    VertexCacheStatistics cacheStatistics = analyzeVertexCache(mesh.indices, mesh.indexCount, mesh.vertexCount, MESH_VERTEX_CACHE_SIZE);
+    VertexFetchStatistics fetchStatistics = analyzeVertexFetch(mesh.indices, mesh.indexCount, mesh.vertexCount, packedVertices ? sizeof(PackedVertex) : sizeof(Vertex), MESH_VERTEX_CACHE_SIZE);
 
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    printf("Mesh: %zu vertices, %zu indices, ACMR %.3f, ATVR %.3f, overfetch %.3f\n", mesh.vertexCount, mesh.indexCount, cacheStatistics.acmr, cacheStatistics.atvr, fetchStatistics.overfetch);
 
-    GLFWwindow* window = glfwCreateWindow(1600, 900, "Vulkan Renderer", 0, 0);
-    assert(window);
+    // Bytes the vertex cache model fetches for one draw of LOD 0, from the
+    // position stream and from full vertices
+    if (depthPass && mesh.indexCount)
+    {
+        size_t vertexSize = packedVertices ? sizeof(PackedVertex) : sizeof(Vertex);
 
-    VkSurfaceKHR surface = createSurface(instance, window);
-    assert(surface);
+        VertexFetchStatistics positionFetch = analyzeVertexFetch(mesh.indices, mesh.indexCount, mesh.vertexCount, positionSize, MESH_VERTEX_CACHE_SIZE);
+        VertexFetchStatistics vertexFetch = analyzeVertexFetch(mesh.indices, mesh.indexCount, mesh.vertexCount, vertexSize, MESH_VERTEX_CACHE_SIZE);
 
-    VkFormat surfaceFormat = getSurfaceFormat(physicalDevice, surface);
+        printf("Depth pass: fetches %.1f KB per draw from %zu byte positions, %.1f KB from %zu byte vertices\n",
+            positionFetch.overfetch * (double) (mesh.vertexCount * positionSize) / 1024.0, positionSize,
+            vertexFetch.overfetch * (double) (mesh.vertexCount * vertexSize) / 1024.0, vertexSize);
+    }
 
-    VkRenderPass renderPass = createRenderPass(device, surfaceFormat);
-    assert(renderPass);
+    vertexConstants.vertexCount = (uint32_t) mesh.vertexCount;
+    vertexConstants.indexCount = (uint32_t) mesh.indexCount;
 
-    VkShaderModule triangleVS = loadShader(device, "bin/trig.vert.spv");
-    assert(triangleVS);
-    
-    VkShaderModule triangleFS = loadShader(device, "bin/trig.frag.spv");
-    assert(triangleFS);
+    PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR =
+        (PFN_vkCmdPushDescriptorSetKHR)vkGetInstanceProcAddr(instance, "vkCmdPushDescriptorSetKHR");
 
-    // TODO: this is critical for performance!
-    VkPipelineCache pipelineCache = 0;
+    // OBJs without vn records leave normals at zero, and a compute pass fills
+    // them in from LOD 0's indices; vertices that have a normal are left alone.
+    // Streamed meshes are unindexed and got flat normals while streaming.
+    size_t missingNormals = 0;
 
-    VkDescriptorSetLayout setLayout = createDescriptorSetLayout(device);
-    assert(setLayout);
+    if (!streamMode)
+        for (size_t i = 0; i < mesh.vertexCount; i++)
+            missingNormals += mesh.vertices[i].normal[0] == 0.f && mesh.vertices[i].normal[1] == 0.f && mesh.vertices[i].normal[2] == 0.f;
 
-    VkPipelineLayout triangleLayout = createPipelineLayout(device, setLayout);
-    assert(triangleLayout);
+    if (mesh.indexCount && missingNormals)
+    {
+        VkShaderModule normalsCS = loadShader(device, io, &normalsCSLoad);
+        assert(normalsCS);
 
-    VkPipeline trianglePipeline = createGraphicsPipeline(device, pipelineCache, renderPass, triangleVS, triangleFS, triangleLayout);
-    assert(trianglePipeline);
+        VkDescriptorSetLayout normalsSetLayout = createDescriptorSetLayout(device, 5, VK_SHADER_STAGE_COMPUTE_BIT);
+        assert(normalsSetLayout);
 
-    int windowWidth, windowHeight;
-    glfwGetWindowSize(window, &windowWidth, &windowHeight);
+        VkPipelineLayout normalsLayout = createPipelineLayout(device, normalsSetLayout, VK_SHADER_STAGE_COMPUTE_BIT);
+        assert(normalsLayout);
 
-    Swapchain swapchain;
-    createSwapchain(&swapchain, device, surface, familyIndex, surfaceFormat, windowWidth, windowHeight, renderPass, 0);
+        VkPipeline normalsPipelines[4];
 
-    VkSemaphore acquireSemaphore = createSemaphore(device);
-    assert(acquireSemaphore);
+        for (uint32_t pass = 0; pass < countof(normalsPipelines); pass++)
+        {
+            const uint32_t constants[] = { packedVertices, indexType == VK_INDEX_TYPE_UINT16, pass };
 
-    VkSemaphore releaseSemaphore = createSemaphore(device);
-    assert(releaseSemaphore);
+            normalsPipelines[pass] = createComputePipeline(device, pipelineCache, normalsCS, normalsLayout, constants, countof(constants));
+            assert(normalsPipelines[pass]);
+        }
 
-    VkQueue queue = 0;
-    vkGetDeviceQueue(device, familyIndex, 0, &queue);
+        Buffer offsetBuffer, cursorBuffer, cornerBuffer;
+        createBuffer(&offsetBuffer, device, allocator, (mesh.vertexCount + 1) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, DEVICE_MEMORY_SCRATCH);
+        createBuffer(&cursorBuffer, device, allocator, mesh.vertexCount * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, DEVICE_MEMORY_SCRATCH);
+        createBuffer(&cornerBuffer, device, allocator, mesh.indexCount * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, DEVICE_MEMORY_SCRATCH);
 
-    VkCommandPool commandPool = createCommandPool(device, familyIndex);
-    assert(commandPool);
+        const VkDescriptorBufferInfo normalsBufferInfos[] =
+        {
+            { vb.buffer, 0, vb.size },
+            { ib.buffer, 0, ib.size },
+            { offsetBuffer.buffer, 0, offsetBuffer.size },
+            { cursorBuffer.buffer, 0, cursorBuffer.size },
+            { cornerBuffer.buffer, 0, cornerBuffer.size },
+        };
 
-    const VkCommandBufferAllocateInfo allocateInfo =
+        VkQueryPool timestampPool = createQueryPool(device, VK_QUERY_TYPE_TIMESTAMP, 0, 2);
+        assert(timestampPool);
+
+        const VkCommandBufferBeginInfo beginInfo =
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+
+        // The vertex buffer is read back through host memory unless it is mapped
+        Buffer readback = vb;
+
+        if (checkNormals && !vb.data)
+            createBuffer(&readback, device, allocator, vb.size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, hostMemory, VK_MEMORY_PROPERTY_HOST_CACHED_BIT, DEVICE_MEMORY_STAGING);
+
+        VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+        uploadAcquire(&uploader, commandBuffer);
+
+        vkCmdResetQueryPool(commandBuffer, timestampPool, 0, 2);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, 0);
+
+        recordNormalGeneration(commandBuffer, vkCmdPushDescriptorSetKHR, normalsLayout, normalsPipelines, normalsBufferInfos, &vertexConstants);
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, 1);
+
+        if (readback.buffer != vb.buffer)
+        {
+            const VkMemoryBarrier readbackBarrier =
+            {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+            };
+
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &readbackBarrier, 0, 0, 0, 0);
+
+            const VkBufferCopy region = { 0, 0, vb.size };
+            vkCmdCopyBuffer(commandBuffer, vb.buffer, readback.buffer, 1, &region);
+
+            const VkMemoryBarrier hostBarrier =
+            {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+            };
+
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, 0, 0, 0);
+        }
+
+        VK_CHECK(vkEndCommandBuffer(commandBuffer));
+
+        // Waits for the geometry copies on the transfer queue
+        const VkPipelineStageFlags uploadStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+        const VkTimelineSemaphoreSubmitInfo timelineInfo =
+        {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = 1,
+            .pWaitSemaphoreValues = &uploader.publishedValue,
+        };
+
+        const VkSubmitInfo submitInfo =
+        {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = &timelineInfo,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &uploader.semaphore,
+            .pWaitDstStageMask = &uploadStageMask,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &commandBuffer,
+        };
+
+        VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, 0));
+        VK_CHECK(vkDeviceWaitIdle(device));
+
+        uint64_t timestamps[2] = {0};
+        VK_CHECK(vkGetQueryPoolResults(device, timestampPool, 0, 2, sizeof(timestamps), timestamps, sizeof(timestamps[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+        printf("Normals: generated on the GPU in %.3f ms for %zu vertices without one\n",
+            (double) (timestamps[1] - timestamps[0]) * deviceProps.limits.timestampPeriod * 1e-6, missingNormals);
+
+        if (checkNormals)
+        {
+            float* reference = malloc(mesh.vertexCount * 3 * sizeof(float));
+            assert(reference);
+
+            double start = glfwGetTime();
+            computeNormals(reference, mesh.vertices, mesh.vertexCount, mesh.indices, mesh.indexCount);
+            double end = glfwGetTime();
+
+            float minDot = 1.f;
+
+            for (size_t i = 0; i < mesh.vertexCount; i++)
+            {
+                const float* n = mesh.vertices[i].normal;
+
+                if (n[0] != 0.f || n[1] != 0.f || n[2] != 0.f)
+                    continue;
+
+                Vertex generated;
+
+                if (packedVertices)
+                    unpackVertex(&generated, (const PackedVertex*)readback.data + i, mesh.boundsMin, mesh.boundsMax);
+                else
+                    generated = ((const Vertex*)readback.data)[i];
+
+                const float* r = &reference[i * 3];
+                minDot = fminf(minDot, generated.normal[0] * r[0] + generated.normal[1] * r[1] + generated.normal[2] * r[2]);
+            }
+
+            printf("Normals: CPU reference took %.3f ms, GPU normals within %.2f degrees of it\n",
+                (end - start) * 1e3, acosf(fminf(fmaxf(minDot, -1.f), 1.f)) * (180.f / 3.14159265f));
+
+            free(reference);
+        }
+
+        if (readback.buffer != vb.buffer)
+            destroyBuffer(device, allocator, &readback);
+
+        vkDestroyQueryPool(device, timestampPool, 0);
+
+        destroyBuffer(device, allocator, &cornerBuffer);
+        destroyBuffer(device, allocator, &cursorBuffer);
+        destroyBuffer(device, allocator, &offsetBuffer);
+
+        for (uint32_t pass = 0; pass < countof(normalsPipelines); pass++)
+            vkDestroyPipeline(device, normalsPipelines[pass], 0);
+
+        vkDestroyPipelineLayout(device, normalsLayout, 0);
+        vkDestroyDescriptorSetLayout(device, normalsSetLayout, 0);
+        vkDestroyShaderModule(device, normalsCS, 0);
+    }
+    else
     {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = commandPool,
-        .commandBufferCount = 1,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-    };
+        size_t len = 0;
+        free(fileLoadEnd(io, &normalsCSLoad, &len));
+    }
 
-    VkCommandBuffer commandBuffer = 0;
-    VK_CHECK(vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer));
+    Meshlets meshlets = {0};
+    Buffer meshletBuffer = {0};
+    Buffer meshletVertexBuffer = {0};
+    Buffer meshletTriangleBuffer = {0};
+    Buffer drawCommandBuffer = {0};
 
-    VkPhysicalDeviceMemoryProperties memProps;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProps);
+    if (meshletMode || meshShading)
+    {
+        rc = buildMeshlets(&meshlets, &mesh, &meshArena);
+        assert(rc);
 
-    size_t vertices_size = 0;
-    Vertex* vertices = loadObj("data/kitten.obj", &vertices_size);
+        createBuffer(&meshletBuffer, device, allocator, meshlets.meshletCount * sizeof(Meshlet), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, geometryPreferred, DEVICE_MEMORY_GEOMETRY);
+        uploadBuffer(&uploader, &meshletBuffer, 0, meshlets.meshlets, meshletBuffer.size);
 
-    size_t vertex_count = vertices_size / sizeof(Vertex);
+        if (meshShading)
+        {
+            createBuffer(&meshletVertexBuffer, device, allocator, meshlets.vertexCount * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, geometryPreferred, DEVICE_MEMORY_GEOMETRY);
+            uploadBuffer(&uploader, &meshletVertexBuffer, 0, meshlets.vertices, meshletVertexBuffer.size);
 
-    Buffer vb = {0};
-    createBuffer(&vb, device, &memProps, 128 * 1024 * 1024, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+            // The triangle stream is padded to whole words for the shader
+            size_t triangleBytes = (meshlets.triangleCount * 3 + 3) & ~(size_t)3;
+            createBuffer(&meshletTriangleBuffer, device, allocator, triangleBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, geometryPreferred, DEVICE_MEMORY_GEOMETRY);
+            uploadBuffer(&uploader, &meshletTriangleBuffer, 0, meshlets.triangles, triangleBytes);
+        }
+        else
+        {
+            createBuffer(&drawCommandBuffer, device, allocator, meshlets.meshletCount * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, hostMemory, 0, DEVICE_MEMORY_SCRATCH);
+        }
+
+        printf("Meshlets: %zu, %.1f vertices and %.1f triangles on average\n", meshlets.meshletCount,
+            (double) meshlets.vertexCount / (double) meshlets.meshletCount, (double) meshlets.triangleCount / (double) meshlets.meshletCount);
+    }
 
-    memcpy(vb.data, vertices, vertices_size);
+    vertexConstants.meshletCount = (uint32_t) meshlets.meshletCount;
 
-    PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR =
-        (PFN_vkCmdPushDescriptorSetKHR)vkGetInstanceProcAddr(instance, "vkCmdPushDescriptorSetKHR");
+    // Meshlet copies are waited for by the first frame
+    uploadSubmit(&uploader);
+
+    printf("Uploads: %.1f MiB staged on the %s queue, %.1f MiB written in place (device local memory is%s mappable)\n",
+        (double) uploader.stagedBytes / (1024.0 * 1024.0), transferFamilyIndex != VK_QUEUE_FAMILY_IGNORED ? "transfer" : "graphics",
+        (double) uploader.directBytes / (1024.0 * 1024.0), directUploads ? "" : " not");
+
+    DeviceMemoryStats memoryStats;
+    deviceAllocatorStats(allocator, &memoryStats);
+
+    printf("Device memory: %u allocations in %u blocks from %u vkAllocateMemory calls, %.1f of %.1f MiB in use\n",
+        memoryStats.allocationCount, memoryStats.blockCount, memoryStats.driverAllocationCount,
+        (double) memoryStats.allocatedBytes / (1024.0 * 1024.0), (double) memoryStats.blockBytes / (1024.0 * 1024.0));
+
+    printMemoryBudget(allocator);
+
+    size_t vertex_count = mesh.vertexCount;
+    size_t index_count = mesh.indexCount;
+    MeshLods lodLevels = { .lodCount = lods.lodCount };
+    memcpy(lodLevels.lods, lods.lods, sizeof(lods.lods));
+    MeshLods stripLevels = { .lodCount = strips.lodCount };
+    memcpy(stripLevels.lods, strips.lods, sizeof(strips.lods));
+    uint32_t meshletCount = (uint32_t) meshlets.meshletCount;
+
+    destroyMesh(&mesh);
+    arenaDestroy(&meshArena);
+
+    // All startup assets are in
+    fileQueueDestroy(io);
+
+    PFN_vkCmdDrawMeshTasksEXT vkCmdDrawMeshTasksEXT =
+        (PFN_vkCmdDrawMeshTasksEXT)vkGetInstanceProcAddr(instance, "vkCmdDrawMeshTasksEXT");
+
+    // Without multi-draw every meshlet gets its own indirect call
+    uint32_t drawsPerCall = features.features.multiDrawIndirect ? deviceProps.limits.maxDrawIndirectCount : 1;
 
     glfwShowWindow(window);
 
+    int reportedStatistics = 0;
+    int reportedDepthPass = 0;
+    double drawTime = 0.0;
+    uint32_t drawTimeFrames = 0;
+    uint32_t lod = ~0u;
+    uint64_t frameIndex = 0;
+
     while (!glfwWindowShouldClose(window))
     {
         glfwPollEvents();
@@ -848,6 +2637,18 @@ int main(int argc, char* argv[])
 
         resizeSwapchainIfNecessary(&swapchain, physicalDevice, device, surface, familyIndex, surfaceFormat, renderPass);
 
+        // The projection maps one mesh unit to half the viewport height
+        uint32_t selectedLod = selectLod(&lodLevels, (float) swapchain.height * 0.5f, lodThreshold);
+
+        if (selectedLod != lod)
+        {
+            lod = selectedLod;
+            printf("Drawing LOD %u: %u triangles\n", lod, lodLevels.lods[lod].indexCount / 3);
+        }
+
+        // The driver's figures move with other processes too
+        deviceAllocatorUpdateBudget(allocator);
+
         uint32_t imageIndex = 0;
         VK_CHECK(vkAcquireNextImageKHR(device, swapchain.swapchain, ~0ull, acquireSemaphore, 0, &imageIndex));
         VK_CHECK(vkResetCommandPool(device, commandPool, 0));
@@ -860,6 +2661,161 @@ int main(int argc, char* argv[])
 
         VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
 
+        uploadAcquire(&uploader, commandBuffer);
+
+        uint64_t completedFrame = 0;
+        VK_CHECK(vkGetSemaphoreCounterValue(device, frameSemaphore, &completedFrame));
+        frameRingRetire(&frameRing, completedFrame);
+
+        // Every pass transforms and culls with this: mesh units straight to
+        // clip space, y flipped and depth offset by 0.05. It is built on the
+        // stack, as the ring may be write-combined memory.
+        FrameData frameData =
+        {
+            .viewProjection =
+            {
+                1.f, 0.f, 0.f, 0.f,
+                0.f, -1.f, 0.f, 0.f,
+                0.f, 0.f, 1.f, 0.f,
+                0.f, 0.f, 0.05f, 1.f,
+            },
+        };
+
+        setViewDirection(&frameData);
+
+        VkDescriptorBufferInfo frameInfo;
+        FrameData* frame = frameRingAlloc(&frameRing, sizeof(FrameData), &frameInfo);
+        *frame = frameData;
+
+        if (statisticsPool)
+            vkCmdResetQueryPool(commandBuffer, statisticsPool, 0, 1);
+
+        vkCmdResetQueryPool(commandBuffer, drawTimestampPool, 0, 2);
+
+        if (meshletMode)
+        {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+
+            const VkDescriptorBufferInfo cullBufferInfos[] =
+            {
+                { meshletBuffer.buffer, 0, meshletBuffer.size },
+                { drawCommandBuffer.buffer, 0, drawCommandBuffer.size },
+                frameInfo,
+            };
+
+            const VkWriteDescriptorSet cullDescriptors[] =
+            {
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstBinding = 0,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pBufferInfo = &cullBufferInfos[0],
+                },
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstBinding = 1,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pBufferInfo = &cullBufferInfos[1],
+                },
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstBinding = 2,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pBufferInfo = &cullBufferInfos[2],
+                },
+            };
+
+            vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullLayout, 0, countof(cullDescriptors), cullDescriptors);
+            vkCmdPushConstants(commandBuffer, cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(vertexConstants), &vertexConstants);
+
+            vkCmdDispatch(commandBuffer, (meshletCount + MESHLET_CULL_GROUP_SIZE - 1) / MESHLET_CULL_GROUP_SIZE, 1, 1);
+
+            const VkMemoryBarrier cullBarrier =
+            {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+            };
+
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &cullBarrier, 0, 0, 0, 0);
+        }
+
+        // The first frame also draws from full vertices, timing both pipelines
+        if (depthPass)
+        {
+            if (!reportedDepthPass)
+            {
+                vkCmdResetQueryPool(commandBuffer, depthTimestampPool, 0, 3);
+                vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, depthTimestampPool, 0);
+            }
+
+            const VkDescriptorBufferInfo depthBufferInfos[] =
+            {
+                { vb.buffer, 0, vb.size },
+                { positionBuffer.buffer, 0, positionBuffer.size },
+                frameInfo,
+            };
+
+            VkWriteDescriptorSet depthDescriptors[countof(depthBufferInfos)];
+
+            for (uint32_t i = 0; i < countof(depthBufferInfos); i++)
+                depthDescriptors[i] = (VkWriteDescriptorSet)
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstBinding = i,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pBufferInfo = &depthBufferInfos[i],
+                };
+
+            const VkClearValue clearDepth = { .depthStencil = { 1.f, 0 } };
+
+            const VkRenderPassBeginInfo depthBeginInfo =
+            {
+                .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+                .renderPass = depthRenderPass,
+                .framebuffer = depthFramebuffer,
+                .renderArea.extent.width = DEPTH_PASS_SIZE,
+                .renderArea.extent.height = DEPTH_PASS_SIZE,
+                .clearValueCount = 1,
+                .pClearValues = &clearDepth,
+            };
+
+            VkViewport depthViewport = { 0, 0, (float) DEPTH_PASS_SIZE, (float) DEPTH_PASS_SIZE, 0, 1 };
+            VkRect2D depthScissor = { {0, 0}, {DEPTH_PASS_SIZE, DEPTH_PASS_SIZE} };
+
+            for (uint32_t pass = reportedDepthPass ? DEPTH_PASS_POSITION_STREAM : DEPTH_PASS_FULL_VERTICES; pass <= DEPTH_PASS_POSITION_STREAM; pass++)
+            {
+                vkCmdBeginRenderPass(commandBuffer, &depthBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+                vkCmdSetViewport(commandBuffer, 0, 1, &depthViewport);
+                vkCmdSetScissor(commandBuffer, 0, 1, &depthScissor);
+
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPipelines[pass]);
+
+                vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthLayout, 0, countof(depthDescriptors), depthDescriptors);
+                vkCmdPushConstants(commandBuffer, depthLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(vertexConstants), &vertexConstants);
+
+                if (index_count)
+                {
+                    vkCmdBindIndexBuffer(commandBuffer, ib.buffer, 0, indexType);
+                    vkCmdDrawIndexed(commandBuffer, lodLevels.lods[lod].indexCount, 1, lodLevels.lods[lod].indexOffset, 0, 0);
+                }
+                else
+                {
+                    vkCmdDraw(commandBuffer, (uint32_t) vertex_count, 1, 0, 0);
+                }
+
+                vkCmdEndRenderPass(commandBuffer);
+
+                if (!reportedDepthPass)
+                    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, depthTimestampPool, pass + 1);
+            }
+        }
+
         const VkClearColorValue color = { 48.f / 255.f, 10.f / 255.f, 36.f / 255.f, 1 };
         const VkClearValue clearColor = { color };
 
@@ -879,53 +2835,134 @@ int main(int argc, char* argv[])
         VkViewport viewport = { 0, 0, (float) swapchain.width, (float) swapchain.height, 0, 1 };
         VkRect2D scissor = { {0, 0}, {swapchain.width, swapchain.height} };
 
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipeline);
-
         vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
         vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-        const VkDescriptorBufferInfo bufferInfo =
+        const VkDescriptorBufferInfo bufferInfos[] =
         {
-            .buffer = vb.buffer,
-            .offset = 0,
-            .range = vb.size,
+            { vb.buffer, 0, vb.size },
+            { meshletBuffer.buffer, 0, meshletBuffer.size },
+            { meshletVertexBuffer.buffer, 0, meshletVertexBuffer.size },
+            { meshletTriangleBuffer.buffer, 0, meshletTriangleBuffer.size },
+            frameInfo,
         };
 
-        const VkWriteDescriptorSet descriptors[] =
-        {
+        VkWriteDescriptorSet descriptors[countof(bufferInfos)];
+
+        for (uint32_t i = 0; i < countof(bufferInfos); i++)
+            descriptors[i] = (VkWriteDescriptorSet)
             {
                 .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstBinding = 0,
+                .dstBinding = i,
                 .descriptorCount = 1,
                 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                .pBufferInfo = &bufferInfo,
-            },
-        };
+                .pBufferInfo = &bufferInfos[i],
+            };
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, drawTimestampPool, 0);
 
-        vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, triangleLayout, 0, countof(descriptors), descriptors);
+        if (meshShading)
+        {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletPipeline);
+
+            vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletLayout, 0, countof(descriptors), descriptors);
+            vkCmdPushConstants(commandBuffer, meshletLayout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(vertexConstants), &vertexConstants);
+
+            vkCmdDrawMeshTasksEXT(commandBuffer, (meshletCount + MESHLET_TASK_GROUP_SIZE - 1) / MESHLET_TASK_GROUP_SIZE, 1, 1);
+        }
+        else
+        {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, stripMode ? stripPipeline : trianglePipeline);
+
+            const VkWriteDescriptorSet triangleDescriptors[] =
+            {
+                descriptors[0],
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstBinding = 1,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pBufferInfo = &frameInfo,
+                },
+            };
+
+            vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, triangleLayout, 0, countof(triangleDescriptors), triangleDescriptors);
+            vkCmdPushConstants(commandBuffer, triangleLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(vertexConstants), &vertexConstants);
+
+            if (statisticsPool)
+                vkCmdBeginQuery(commandBuffer, statisticsPool, 0, 0);
+
+            if (meshletMode)
+            {
+                vkCmdBindIndexBuffer(commandBuffer, ib.buffer, 0, indexType);
+
+                for (uint32_t i = 0; i < meshletCount; i += drawsPerCall)
+                {
+                    uint32_t drawCount = meshletCount - i < drawsPerCall ? meshletCount - i : drawsPerCall;
+                    vkCmdDrawIndexedIndirect(commandBuffer, drawCommandBuffer.buffer, i * sizeof(VkDrawIndexedIndirectCommand), drawCount, sizeof(VkDrawIndexedIndirectCommand));
+                }
+            }
+            else if (stripMode)
+            {
+                vkCmdBindIndexBuffer(commandBuffer, sb.buffer, 0, indexType);
+                vkCmdDrawIndexed(commandBuffer, stripLevels.lods[lod].indexCount, 1, stripLevels.lods[lod].indexOffset, 0, 0);
+            }
+            else if (index_count)
+            {
+                vkCmdBindIndexBuffer(commandBuffer, ib.buffer, 0, indexType);
+                vkCmdDrawIndexed(commandBuffer, lodLevels.lods[lod].indexCount, 1, lodLevels.lods[lod].indexOffset, 0, 0);
+            }
+            else
+            {
+                vkCmdDraw(commandBuffer, (uint32_t) vertex_count, 1, 0, 0);
+            }
 
-        vkCmdDraw(commandBuffer, (uint32_t) vertex_count, 1, 0, 0);
+            if (statisticsPool)
+                vkCmdEndQuery(commandBuffer, statisticsPool, 0);
+        }
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, drawTimestampPool, 1);
 
         vkCmdEndRenderPass(commandBuffer);
 
         VK_CHECK(vkEndCommandBuffer(commandBuffer));
 
-        const VkPipelineStageFlags submitStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        // Frames also wait for the uploads published so far, which costs
+        // nothing once they are done, and signal their index for the frame
+        // ring. Values for the binary semaphores are ignored.
+        const VkSemaphore waitSemaphores[] = { acquireSemaphore, uploader.semaphore };
+        const VkPipelineStageFlags submitStageMasks[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+        const uint64_t waitValues[] = { 0, uploader.publishedValue };
+
+        const VkSemaphore signalSemaphores[] = { releaseSemaphore, frameSemaphore };
+        const uint64_t signalValues[] = { 0, ++frameIndex };
+
+        const VkTimelineSemaphoreSubmitInfo timelineInfo =
+        {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = countof(waitValues),
+            .pWaitSemaphoreValues = waitValues,
+            .signalSemaphoreValueCount = countof(signalValues),
+            .pSignalSemaphoreValues = signalValues,
+        };
 
         const VkSubmitInfo submitInfo =
         {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .waitSemaphoreCount = 1,
-            .pWaitSemaphores = &acquireSemaphore,
-            .pWaitDstStageMask = &submitStageMask,
+            .pNext = &timelineInfo,
+            .waitSemaphoreCount = countof(waitSemaphores),
+            .pWaitSemaphores = waitSemaphores,
+            .pWaitDstStageMask = submitStageMasks,
             .commandBufferCount = 1,
             .pCommandBuffers = &commandBuffer,
-            .signalSemaphoreCount = 1,
-            .pSignalSemaphores = &releaseSemaphore,
+            .signalSemaphoreCount = countof(signalSemaphores),
+            .pSignalSemaphores = signalSemaphores,
         };
 
         VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, 0));
 
+        frameRingEnd(&frameRing, frameIndex);
+
         const VkPresentInfoKHR presentInfo =
         {
             .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -939,10 +2976,91 @@ int main(int argc, char* argv[])
         VK_CHECK(vkQueuePresentKHR(queue, &presentInfo));
 
         VK_CHECK(vkDeviceWaitIdle(device));
+
+        // An unindexed draw shades every corner, 3 per triangle; the post-transform
+        // cache brings indexed draws well below that
+        if (statisticsPool && !reportedStatistics)
+        {
+            uint64_t invocations = 0;
+            VK_CHECK(vkGetQueryPoolResults(device, statisticsPool, 0, 1, sizeof(invocations), &invocations, sizeof(invocations), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+            size_t corners = index_count ? lodLevels.lods[lod].indexCount : vertex_count;
+
+            // The culling pass left its draws in host visible memory
+            if (meshletMode)
+            {
+                const VkDrawIndexedIndirectCommand* commands = drawCommandBuffer.data;
+                size_t visible = 0;
+
+                corners = 0;
+
+                for (size_t i = 0; i < meshletCount; i++)
+                    if (commands[i].instanceCount)
+                    {
+                        visible++;
+                        corners += commands[i].indexCount;
+                    }
+
+                printf("Meshlets: %zu of %u drawn after frustum and cone culling\n", visible, meshletCount);
+            }
+            printf("Vertex shader invocations: %llu for %zu triangles (%.2f per triangle)\n", (unsigned long long) invocations, corners / 3, corners ? 3.0 * (double) invocations / (double) corners : 0.0);
+
+            reportedStatistics = 1;
+        }
+
+        uint64_t drawTimestamps[2] = {0};
+        VK_CHECK(vkGetQueryPoolResults(device, drawTimestampPool, 0, 2, sizeof(drawTimestamps), drawTimestamps, sizeof(drawTimestamps[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+        drawTime += (double) (drawTimestamps[1] - drawTimestamps[0]) * deviceProps.limits.timestampPeriod * 1e-6;
+
+        if (++drawTimeFrames == DRAW_TIMING_FRAMES)
+        {
+            printf("Draw: %.3f ms on average over %u frames, as %s\n", drawTime / drawTimeFrames, drawTimeFrames,
+                meshShading ? "meshlets" : meshletMode ? "culled meshlets" : stripMode ? "strips" : index_count ? "lists" : "an unindexed list");
+
+            printf("Frame ring: at most %zu bytes per frame and %zu of %zu bytes in flight\n", frameRing.frameHighWater, frameRing.highWater, (size_t) FRAME_RING_SIZE);
+
+            printMemoryBudget(allocator);
+
+            drawTime = 0.0;
+            drawTimeFrames = 0;
+        }
+
+        if (depthPass && !reportedDepthPass)
+        {
+            uint64_t timestamps[3] = {0};
+            VK_CHECK(vkGetQueryPoolResults(device, depthTimestampPool, 0, 3, sizeof(timestamps), timestamps, sizeof(timestamps[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+            double period = deviceProps.limits.timestampPeriod * 1e-6;
+
+            printf("Depth pass: %.3f ms reading %zu byte vertices, %.3f ms reading %zu byte positions\n",
+                (double) (timestamps[1] - timestamps[0]) * period, packedVertices ? sizeof(PackedVertex) : sizeof(Vertex),
+                (double) (timestamps[2] - timestamps[1]) * period, positionSize);
+
+            reportedDepthPass = 1;
+        }
     }
 
-    /* destroyBuffer(device, &ib); */
-    destroyBuffer(device, &vb);
+    if (meshletBuffer.buffer)
+        destroyBuffer(device, allocator, &meshletBuffer);
+    if (meshletVertexBuffer.buffer)
+        destroyBuffer(device, allocator, &meshletVertexBuffer);
+    if (meshletTriangleBuffer.buffer)
+        destroyBuffer(device, allocator, &meshletTriangleBuffer);
+    if (drawCommandBuffer.buffer)
+        destroyBuffer(device, allocator, &drawCommandBuffer);
+
+    if (ib.buffer)
+        destroyBuffer(device, allocator, &ib);
+    if (positionBuffer.buffer)
+        destroyBuffer(device, allocator, &positionBuffer);
+    if (sb.buffer)
+        destroyBuffer(device, allocator, &sb);
+    destroyBuffer(device, allocator, &vb);
+
+    if (statisticsPool)
+        vkDestroyQueryPool(device, statisticsPool, 0);
+    vkDestroyQueryPool(device, drawTimestampPool, 0);
 
     vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
     vkDestroyCommandPool(device, commandPool, 0);
@@ -950,8 +3068,49 @@ int main(int argc, char* argv[])
     vkDestroySemaphore(device, acquireSemaphore, 0);
     vkDestroySemaphore(device, releaseSemaphore, 0);
 
+    destroyUploader(&uploader, allocator);
+
+    destroyFrameRing(&frameRing, allocator);
+    vkDestroySemaphore(device, frameSemaphore, 0);
+
     destroySwapchain(device, &swapchain);
 
+    if (meshletPipeline)
+    {
+        vkDestroyPipeline(device, meshletPipeline, 0);
+        vkDestroyPipelineLayout(device, meshletLayout, 0);
+        vkDestroyDescriptorSetLayout(device, meshletSetLayout, 0);
+        vkDestroyShaderModule(device, meshletMS, 0);
+        vkDestroyShaderModule(device, meshletTS, 0);
+    }
+
+    if (depthPass)
+    {
+        vkDestroyQueryPool(device, depthTimestampPool, 0);
+        vkDestroyFramebuffer(device, depthFramebuffer, 0);
+        destroyImage(device, allocator, &depthTarget);
+
+        for (uint32_t i = 0; i < countof(depthPipelines); i++)
+            vkDestroyPipeline(device, depthPipelines[i], 0);
+
+        vkDestroyRenderPass(device, depthRenderPass, 0);
+        vkDestroyPipelineLayout(device, depthLayout, 0);
+        vkDestroyDescriptorSetLayout(device, depthSetLayout, 0);
+        vkDestroyShaderModule(device, depthVS, 0);
+    }
+
+    if (cullPipeline)
+    {
+        vkDestroyPipeline(device, cullPipeline, 0);
+        vkDestroyPipelineLayout(device, cullLayout, 0);
+        vkDestroyDescriptorSetLayout(device, cullSetLayout, 0);
+    }
+
+    if (cullCS)
+        vkDestroyShaderModule(device, cullCS, 0);
+
+    if (stripPipeline)
+        vkDestroyPipeline(device, stripPipeline, 0);
     vkDestroyPipeline(device, trianglePipeline, 0);
     vkDestroyPipelineLayout(device, triangleLayout, 0);
     vkDestroyDescriptorSetLayout(device, setLayout, 0);
@@ -963,6 +3122,8 @@ int main(int argc, char* argv[])
 
     glfwDestroyWindow(window);
 
+    deviceAllocatorDestroy(allocator);
+
     vkDestroyDevice(device, 0);
 
 #ifndef NDEBUG
@@ -0,0 +1,1394 @@
+#include "mesh.h"
+
+#include <assert.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <pthread.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define MESH_GATHER_SSE2 1
+#endif
+
+#include "fast_obj.h"
+#include "meshopt.h"
+
+#define MESH_CACHE_MAGIC 0x4843534d // 'MSCH'
+// Caches from the 64-bit loader build hold wider submesh ranges
+#ifdef FAST_OBJ_64BIT
+#define MESH_CACHE_VERSION 0x10006
+#else
+#define MESH_CACHE_VERSION 6
+#endif
+#define MESH_CACHE_ALIGN 16
+
+// Faces are gathered on up to this many threads, each taking at least
+// MESH_GATHER_MIN_FACES faces so small meshes stay on the calling thread
+#define MESH_GATHER_MAX_THREADS 32
+#define MESH_GATHER_MIN_FACES 65536
+
+typedef struct
+{
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    vertexSize;
+    uint32_t    pathLength;
+
+    // Source file the cache was built from
+    uint64_t    sourceSize;
+    int64_t     sourceMtime;
+    uint64_t    sourceHash;
+
+    // Byte offsets from the start of the file
+    uint64_t    vertexOffset;
+    uint64_t    vertexCount;
+    uint64_t    indexOffset;
+    uint64_t    indexCount;
+    uint64_t    submeshOffset;
+    uint64_t    submeshCount;
+
+    float       boundsMin[3];
+    float       boundsMax[3];
+
+    uint64_t    fileSize;
+
+    // Covers everything after the header, then the header with this field zeroed
+    uint64_t    hash;
+} MeshCacheHeader;
+
+typedef struct
+{
+    uint64_t        lanes[4];
+    unsigned char   tail[32];
+    size_t          tailSize;
+    uint64_t        size;
+} HashState;
+
+typedef struct
+{
+    FILE*           file;
+    char            tempPath[1024];
+    const char*     cachePath;
+    MeshCacheHeader header;
+    HashState       hash;
+    uint64_t        offset;
+    int             failed;
+} MeshCacheWriter;
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+#define HASH_P1 0x9e3779b185ebca87ull
+#define HASH_P2 0xc2b2ae3d27d4eb4full
+
+// Four independent multiply-rotate lanes over 8 byte words; not cryptographic,
+// only cheap enough to check a whole cache on every start
+static void hashBlock(uint64_t lanes[4], const unsigned char* p)
+{
+    for (int j = 0; j < 4; j++)
+    {
+        uint64_t w;
+        memcpy(&w, p + j * 8, 8);
+        lanes[j] = rotl64(lanes[j] + w * HASH_P2, 31) * HASH_P1;
+    }
+}
+
+static void hashBegin(HashState* state, uint64_t seed)
+{
+    state->lanes[0] = seed + HASH_P1;
+    state->lanes[1] = seed + HASH_P2;
+    state->lanes[2] = seed;
+    state->lanes[3] = seed - HASH_P1;
+    state->tailSize = 0;
+    state->size = 0;
+}
+
+static void hashUpdate(HashState* state, const void* data, size_t size)
+{
+    const unsigned char* p = data;
+
+    if (size == 0)
+        return;
+
+    state->size += size;
+
+    if (state->tailSize)
+    {
+        size_t n = 32 - state->tailSize < size ? 32 - state->tailSize : size;
+
+        memcpy(state->tail + state->tailSize, p, n);
+        state->tailSize += n;
+        p += n;
+        size -= n;
+
+        if (state->tailSize < 32)
+            return;
+
+        hashBlock(state->lanes, state->tail);
+        state->tailSize = 0;
+    }
+
+    for (; size >= 32; p += 32, size -= 32)
+        hashBlock(state->lanes, p);
+
+    memcpy(state->tail, p, size);
+    state->tailSize = size;
+}
+
+static uint64_t hashEnd(const HashState* state)
+{
+    uint64_t r = state->size;
+
+    for (int j = 0; j < 4; j++)
+        r = (r ^ rotl64(state->lanes[j] * HASH_P2, 31) * HASH_P1) * HASH_P1 + HASH_P2;
+
+    for (size_t i = 0; i < state->tailSize; i++)
+        r = rotl64(r ^ (state->tail[i] * HASH_P1), 11) * HASH_P2;
+
+    r ^= r >> 33;
+    r *= HASH_P2;
+    r ^= r >> 29;
+    r *= HASH_P1;
+    r ^= r >> 32;
+
+    return r;
+}
+
+static uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+    HashState state;
+    hashBegin(&state, seed);
+    hashUpdate(&state, data, size);
+    return hashEnd(&state);
+}
+
+static size_t alignOffset(size_t offset)
+{
+    return (offset + MESH_CACHE_ALIGN - 1) & ~(size_t)(MESH_CACHE_ALIGN - 1);
+}
+
+static int statFile(const char* path, uint64_t* size, int64_t* mtime)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0)
+        return 0;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return 0;
+#endif
+
+    *size = (uint64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+    return 1;
+}
+
+static void* mapFile(const char* path, size_t* size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (file == INVALID_HANDLE_VALUE)
+        return 0;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0 || (uint64_t)fileSize.QuadPart > SIZE_MAX)
+    {
+        CloseHandle(file);
+        return 0;
+    }
+
+    // The view keeps the file open after both handles are closed
+    HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+    CloseHandle(file);
+
+    if (!mapping)
+        return 0;
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    *size = (size_t)fileSize.QuadPart;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || (uint64_t)st.st_size > SIZE_MAX)
+    {
+        close(fd);
+        return 0;
+    }
+
+    void* data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return 0;
+
+    *size = (size_t)st.st_size;
+    return data;
+#endif
+}
+
+static void unmapFile(void* data, size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+static int hashFile(const char* path, uint64_t* hash)
+{
+    uint64_t size;
+    int64_t mtime;
+    if (!statFile(path, &size, &mtime))
+        return 0;
+
+    // Empty files cannot be mapped
+    if (size == 0)
+    {
+        *hash = hashBytes(0, 0, 0);
+        return 1;
+    }
+
+    size_t mappedSize = 0;
+    void* data = mapFile(path, &mappedSize);
+    if (!data)
+        return 0;
+
+    *hash = hashBytes(data, mappedSize, 0);
+
+    unmapFile(data, mappedSize);
+    return 1;
+}
+
+// The header goes last so the cache can be written front to back and its header patched
+static uint64_t hashCacheHeader(const MeshCacheHeader* header, uint64_t seed)
+{
+    MeshCacheHeader copy = *header;
+    copy.hash = 0;
+
+    return hashBytes(&copy, sizeof(copy), seed);
+}
+
+static uint64_t hashCache(const void* data, size_t size)
+{
+    MeshCacheHeader header;
+    memcpy(&header, data, sizeof(header));
+
+    return hashCacheHeader(&header, hashBytes((const char*)data + sizeof(header), size - sizeof(header), 0));
+}
+
+static void expandBounds(float boundsMin[3], float boundsMax[3], const float position[3])
+{
+    for (int k = 0; k < 3; k++)
+    {
+        boundsMin[k] = position[k] < boundsMin[k] ? position[k] : boundsMin[k];
+        boundsMax[k] = position[k] > boundsMax[k] ? position[k] : boundsMax[k];
+    }
+}
+
+static int checkStream(const MeshCacheHeader* header, uint64_t offset, uint64_t count, size_t elementSize)
+{
+    if (offset % MESH_CACHE_ALIGN != 0 || offset > header->fileSize)
+        return 0;
+
+    return count <= (header->fileSize - offset) / elementSize;
+}
+
+// fast_obj file callbacks over a read-ahead FileReader; user data is the FileQueue
+static void* readerOpen(const char* path, void* userData)
+{
+    FileReader* reader = malloc(sizeof(FileReader));
+
+    if (reader && fileReaderOpen(reader, userData, path))
+        return reader;
+
+    free(reader);
+    return 0;
+}
+
+static void readerClose(void* file, void* userData)
+{
+    (void)userData;
+
+    fileReaderClose(file);
+    free(file);
+}
+
+static size_t readerRead(void* file, void* dst, size_t bytes, void* userData)
+{
+    (void)userData;
+
+    return fileReaderRead(file, dst, bytes);
+}
+
+// fast_obj takes ULONG_MAX as too large to read whole
+static unsigned long readerSize(void* file, void* userData)
+{
+    (void)userData;
+
+    uint64_t size = ((FileReader*)file)->file.size;
+    return size < ULONG_MAX ? (unsigned long)size : ULONG_MAX;
+}
+
+// Without a queue the file is mapped and parsed in place
+static fastObjMesh* readObjFaces(const char* path, FileQueue* io, fastObjFaceCallback callback, void* userData)
+{
+    if (!io)
+        return fast_obj_read_faces(path, callback, userData);
+
+    const fastObjCallbacks callbacks =
+    {
+        .file_open = readerOpen,
+        .file_close = readerClose,
+        .file_read = readerRead,
+        .file_size = readerSize,
+    };
+
+    return fast_obj_read_faces_with_callbacks(path, &callbacks, io, callback, userData);
+}
+
+static Vertex makeVertex(const fastObjMesh* obj, fastObjIndex gi)
+{
+    // faces gathered during the parse only see attributes parsed before them;
+    // references out of range fall back to the zero element instead of
+    // reading past the end
+    if (gi.p >= obj->position_count)
+        gi.p = 0;
+    if (gi.n >= obj->normal_count)
+        gi.n = 0;
+    if (gi.t >= obj->texcoord_count)
+        gi.t = 0;
+
+    Vertex v;
+
+    v.position[0] = obj->positions[gi.p * 3 + 0];
+    v.position[1] = obj->positions[gi.p * 3 + 1];
+    v.position[2] = obj->positions[gi.p * 3 + 2];
+
+    // Corners without a normal keep a zero one until normals are generated,
+    // rather than fast_obj's +z placeholder
+    v.normal[0] = gi.n ? obj->normals[gi.n * 3 + 0] : 0.f;
+    v.normal[1] = gi.n ? obj->normals[gi.n * 3 + 1] : 0.f;
+    v.normal[2] = gi.n ? obj->normals[gi.n * 3 + 2] : 0.f;
+
+    v.texcoord[0] = obj->texcoords[gi.t * 2 + 0];
+    v.texcoord[1] = obj->texcoords[gi.t * 2 + 1];
+
+    return v;
+}
+
+// Consecutive faces with the same material form one submesh. Without an arena
+// the submeshes are kept on the heap.
+static void addFaceToSubmesh(Mesh* mesh, Arena* arena, size_t* capacity, uint32_t material, size_t offset, unsigned int count)
+{
+    if (mesh->submeshCount == 0 || mesh->submeshes[mesh->submeshCount - 1].material != material)
+    {
+        if (mesh->submeshCount == *capacity)
+        {
+            *capacity = *capacity ? *capacity * 2 : 16;
+            mesh->submeshes = arena ? arenaRealloc(arena, mesh->submeshes, *capacity * sizeof(Submesh)) : realloc(mesh->submeshes, *capacity * sizeof(Submesh));
+            assert(mesh->submeshes);
+        }
+
+        Submesh* sm = &mesh->submeshes[mesh->submeshCount++];
+
+        sm->offset = (MeshUInt)offset;
+        sm->count = 0;
+        sm->material = material;
+    }
+
+    mesh->submeshes[mesh->submeshCount - 1].count += 3 * (count - 2);
+}
+
+typedef struct
+{
+    Arena*  arena;
+    Mesh*   mesh;
+    size_t  vertexCapacity;
+    size_t  submeshCapacity;
+    int     failed;
+} ObjGather;
+
+// Triangulates and gathers each face straight into the vertex stream as it
+// is parsed, so fast_obj never builds its index and per-face arrays
+static void gatherFace(const fastObjMesh* obj, const fastObjIndex* indices, unsigned int count, unsigned int material, void* userData)
+{
+    ObjGather* gather = userData;
+    Mesh* mesh = gather->mesh;
+
+    if (count < 3)
+        return;
+
+    size_t required = mesh->vertexCount + 3 * (count - 2);
+
+    // Submesh ranges address the unwelded stream with MeshUInt
+    if (gather->failed || required > MESH_UINT_MAX)
+    {
+        gather->failed = 1;
+        return;
+    }
+
+    if (required > gather->vertexCapacity)
+    {
+        // The counting pass gives the exact total for the first allocation;
+        // growing is only needed without it or with degenerate faces
+        size_t capacity = gather->vertexCapacity * 2;
+        if (gather->vertexCapacity == 0 && obj->index_count > 2 * (size_t)obj->face_count)
+            capacity = 3 * (obj->index_count - 2 * (size_t)obj->face_count);
+
+        capacity = capacity > required ? capacity : required;
+
+        Vertex* vertices = arenaRealloc(gather->arena, mesh->vertices, capacity * sizeof(Vertex));
+        if (!vertices)
+        {
+            gather->failed = 1;
+            return;
+        }
+
+        mesh->vertices = vertices;
+        gather->vertexCapacity = capacity;
+    }
+
+    // Submeshes wait on the heap so the vertex stream stays on top of the arena
+    // and grows in place when there is no size hint
+    addFaceToSubmesh(mesh, 0, &gather->submeshCapacity, material, mesh->vertexCount, count);
+
+    // triangulate polygons as a fan around the first corner
+    Vertex* first = &mesh->vertices[mesh->vertexCount];
+
+    for (unsigned int j = 0; j < count; j++)
+    {
+        Vertex v = makeVertex(obj, indices[j]);
+        expandBounds(mesh->boundsMin, mesh->boundsMax, v.position);
+
+        if (j >= 3)
+        {
+            mesh->vertices[mesh->vertexCount + 0] = *first;
+            mesh->vertices[mesh->vertexCount + 1] = mesh->vertices[mesh->vertexCount - 1];
+            mesh->vertexCount += 2;
+        }
+
+        mesh->vertices[mesh->vertexCount++] = v;
+    }
+}
+
+typedef struct
+{
+    const fastObjMesh*  obj;
+    Vertex*             vertices;
+
+    size_t              faceBegin;
+    size_t              faceEnd;
+    size_t              indexOffset;    // first corner of faceBegin in obj->indices
+    size_t              vertexOffset;   // first output vertex
+    size_t              vertexCount;    // output vertices of the range
+
+    // Submeshes and bounds of the range alone, merged once every range is done
+    Mesh                part;
+    size_t              submeshCapacity;
+} GatherRange;
+
+static void countRange(GatherRange* range)
+{
+    const unsigned int* faceVertices = range->obj->face_vertices;
+
+    size_t indexCount = 0;
+    size_t vertexCount = 0;
+
+    for (size_t f = range->faceBegin; f < range->faceEnd; f++)
+    {
+        unsigned int count = faceVertices[f];
+
+        indexCount += count;
+        vertexCount += count >= 3 ? 3 * (size_t)(count - 2) : 0;
+    }
+
+    // indexOffset holds the range's corner count until the prefix sum
+    range->indexOffset = indexCount;
+    range->vertexCount = vertexCount;
+}
+
+// Same result as makeVertex; two 16 byte stores per vertex instead of eight
+// scalar ones. Position and normal loads read one float past the element,
+// so the last element of either array takes the scalar path, as do corners
+// without a normal.
+static void gatherVertex(Vertex* v, const fastObjMesh* obj, fastObjIndex gi)
+{
+#ifdef MESH_GATHER_SSE2
+    if (gi.p + 1 < obj->position_count && gi.n != 0 && gi.n + 1 < obj->normal_count && gi.t < obj->texcoord_count)
+    {
+        __m128 p = _mm_loadu_ps(&obj->positions[gi.p * 3]);
+        __m128 n = _mm_loadu_ps(&obj->normals[gi.n * 3]);
+        __m128 t = _mm_castpd_ps(_mm_load_sd((const double*)&obj->texcoords[gi.t * 2]));
+
+        // [pz pz nx nx], then [px py pz nx] and [ny nz tu tv]
+        __m128 zx = _mm_shuffle_ps(p, n, _MM_SHUFFLE(0, 0, 2, 2));
+
+        _mm_storeu_ps(&v->position[0], _mm_shuffle_ps(p, zx, _MM_SHUFFLE(2, 0, 1, 0)));
+        _mm_storeu_ps(&v->normal[1], _mm_shuffle_ps(n, t, _MM_SHUFFLE(1, 0, 2, 1)));
+        return;
+    }
+#endif
+
+    *v = makeVertex(obj, gi);
+}
+
+static void gatherRange(GatherRange* range)
+{
+    const fastObjMesh* obj = range->obj;
+    const fastObjIndex* indices = obj->indices + range->indexOffset;
+
+    Vertex* out = range->vertices + range->vertexOffset;
+    size_t offset = range->vertexOffset;
+
+    for (size_t f = range->faceBegin; f < range->faceEnd; f++)
+    {
+        unsigned int count = obj->face_vertices[f];
+
+        if (count >= 3)
+        {
+            addFaceToSubmesh(&range->part, 0, &range->submeshCapacity, obj->face_materials[f], offset, count);
+
+            // triangulate polygons as a fan around the first corner
+            Vertex* first = out;
+
+            gatherVertex(&out[0], obj, indices[0]);
+            gatherVertex(&out[1], obj, indices[1]);
+            gatherVertex(&out[2], obj, indices[2]);
+
+            expandBounds(range->part.boundsMin, range->part.boundsMax, out[0].position);
+            expandBounds(range->part.boundsMin, range->part.boundsMax, out[1].position);
+            expandBounds(range->part.boundsMin, range->part.boundsMax, out[2].position);
+
+            out += 3;
+
+            for (unsigned int j = 3; j < count; j++)
+            {
+                out[0] = *first;
+                out[1] = out[-1];
+                gatherVertex(&out[2], obj, indices[j]);
+
+                expandBounds(range->part.boundsMin, range->part.boundsMax, out[2].position);
+
+                out += 3;
+            }
+
+            offset += 3 * (size_t)(count - 2);
+        }
+
+        indices += count;
+    }
+}
+
+typedef void (*GatherTask)(GatherRange* range);
+
+typedef struct
+{
+    GatherTask      task;
+    GatherRange*    range;
+} GatherJob;
+
+#ifdef _WIN32
+static DWORD WINAPI gatherThread(void* param)
+{
+    GatherJob* job = param;
+    job->task(job->range);
+    return 0;
+}
+#else
+static void* gatherThread(void* param)
+{
+    GatherJob* job = param;
+    job->task(job->range);
+    return 0;
+}
+#endif
+
+// Runs the task over every range, the first on the calling thread; ranges
+// whose thread fails to start run there too
+static void runGather(GatherTask task, GatherRange* ranges, uint32_t count)
+{
+    GatherJob jobs[MESH_GATHER_MAX_THREADS];
+
+#ifdef _WIN32
+    HANDLE threads[MESH_GATHER_MAX_THREADS];
+#else
+    pthread_t threads[MESH_GATHER_MAX_THREADS];
+#endif
+    int started[MESH_GATHER_MAX_THREADS] = {0};
+
+    for (uint32_t i = 1; i < count; i++)
+    {
+        jobs[i] = (GatherJob){ task, &ranges[i] };
+
+#ifdef _WIN32
+        threads[i] = CreateThread(0, 0, gatherThread, &jobs[i], 0, 0);
+        started[i] = threads[i] != 0;
+#else
+        started[i] = pthread_create(&threads[i], 0, gatherThread, &jobs[i]) == 0;
+#endif
+    }
+
+    task(&ranges[0]);
+
+    for (uint32_t i = 1; i < count; i++)
+    {
+        if (!started[i])
+        {
+            task(&ranges[i]);
+            continue;
+        }
+
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], 0);
+#endif
+    }
+}
+
+static uint32_t gatherThreadCount(size_t faceCount)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    size_t cpus = info.dwNumberOfProcessors;
+#else
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t cpus = online > 0 ? (size_t)online : 1;
+#endif
+
+    size_t count = faceCount / MESH_GATHER_MIN_FACES;
+
+    count = count < cpus ? count : cpus;
+    count = count < MESH_GATHER_MAX_THREADS ? count : MESH_GATHER_MAX_THREADS;
+
+    return count ? (uint32_t)count : 1;
+}
+
+// Triangulates and gathers a fully parsed mesh across threads. Each thread
+// takes a contiguous range of faces; a first pass counts the corners and
+// output vertices of every range, a prefix sum over those turns them into
+// offsets, and a second pass writes each range's disjoint slice of the
+// vertex stream. Submeshes and bounds are kept per range and merged in order.
+static int gatherFaces(Mesh* mesh, Arena* arena, const fastObjMesh* obj)
+{
+    size_t faceCount = obj->face_count;
+    uint32_t rangeCount = gatherThreadCount(faceCount);
+
+    GatherRange ranges[MESH_GATHER_MAX_THREADS];
+
+    for (uint32_t i = 0; i < rangeCount; i++)
+    {
+        ranges[i] = (GatherRange)
+        {
+            .obj = obj,
+            .faceBegin = faceCount * i / rangeCount,
+            .faceEnd = faceCount * (i + 1) / rangeCount,
+        };
+
+        for (int k = 0; k < 3; k++)
+        {
+            ranges[i].part.boundsMin[k] = FLT_MAX;
+            ranges[i].part.boundsMax[k] = -FLT_MAX;
+        }
+    }
+
+    runGather(countRange, ranges, rangeCount);
+
+    size_t indexOffset = 0;
+    size_t vertexOffset = 0;
+
+    for (uint32_t i = 0; i < rangeCount; i++)
+    {
+        size_t indexCount = ranges[i].indexOffset;
+
+        ranges[i].indexOffset = indexOffset;
+        ranges[i].vertexOffset = vertexOffset;
+
+        indexOffset += indexCount;
+        vertexOffset += ranges[i].vertexCount;
+    }
+
+    // Submesh ranges address the unwelded stream with MeshUInt
+    if (vertexOffset > MESH_UINT_MAX || indexOffset > obj->index_count)
+        return 0;
+
+    Vertex* vertices = vertexOffset ? arenaAlloc(arena, vertexOffset * sizeof(Vertex)) : 0;
+    if (vertexOffset && !vertices)
+        return 0;
+
+    for (uint32_t i = 0; i < rangeCount; i++)
+        ranges[i].vertices = vertices;
+
+    runGather(gatherRange, ranges, rangeCount);
+
+    mesh->vertices = vertices;
+    mesh->vertexCount = vertexOffset;
+
+    size_t submeshCapacity = 0;
+    int ok = 1;
+
+    for (uint32_t i = 0; i < rangeCount; i++)
+    {
+        const Mesh* part = &ranges[i].part;
+
+        for (size_t j = 0; j < part->submeshCount && ok; j++)
+        {
+            const Submesh* sm = &part->submeshes[j];
+
+            // a run of one material may straddle two ranges
+            if (mesh->submeshCount && mesh->submeshes[mesh->submeshCount - 1].material == sm->material)
+            {
+                mesh->submeshes[mesh->submeshCount - 1].count += sm->count;
+                continue;
+            }
+
+            if (mesh->submeshCount == submeshCapacity)
+            {
+                submeshCapacity = submeshCapacity ? submeshCapacity * 2 : 16;
+
+                Submesh* submeshes = realloc(mesh->submeshes, submeshCapacity * sizeof(Submesh));
+                ok = submeshes != 0;
+
+                if (!ok)
+                    break;
+
+                mesh->submeshes = submeshes;
+            }
+
+            mesh->submeshes[mesh->submeshCount++] = *sm;
+        }
+
+        for (int k = 0; k < 3; k++)
+        {
+            mesh->boundsMin[k] = part->boundsMin[k] < mesh->boundsMin[k] ? part->boundsMin[k] : mesh->boundsMin[k];
+            mesh->boundsMax[k] = part->boundsMax[k] > mesh->boundsMax[k] ? part->boundsMax[k] : mesh->boundsMax[k];
+        }
+
+        free(part->submeshes);
+    }
+
+    return ok;
+}
+
+static uint64_t hashVertex(const Vertex* vertex)
+{
+    uint64_t words[sizeof(Vertex) / 8];
+    memcpy(words, vertex, sizeof(Vertex));
+
+    uint64_t h = HASH_P2;
+
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+        h = rotl64(h ^ (words[i] * HASH_P2), 31) * HASH_P1;
+
+    return h ^ (h >> 29);
+}
+
+// Welds bitwise identical corners into one vertex and replaces the stream
+// with unique vertices plus an index per corner. Vertices are compacted in
+// place; the stream shrinks in place when it is the top of the arena. Without
+// heap memory for the table the mesh is left unindexed, which draws the same.
+static int weldMesh(Mesh* mesh, Arena* arena)
+{
+    size_t count = mesh->vertexCount;
+
+    if (count == 0)
+        return 1;
+
+    // Open addressing with linear probing, at most 2/3 full
+    size_t tableSize = 1;
+    while (tableSize < count + count / 2)
+        tableSize *= 2;
+
+    uint32_t* table = malloc(tableSize * sizeof(uint32_t));
+    uint32_t* remap = malloc(count * sizeof(uint32_t));
+
+    if (!table || !remap)
+    {
+        free(table);
+        free(remap);
+        return 1;
+    }
+
+    memset(table, 0xff, tableSize * sizeof(uint32_t));
+
+    Vertex* vertices = mesh->vertices;
+    uint32_t unique = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t slot = (size_t)hashVertex(&vertices[i]) & (tableSize - 1);
+
+        while (table[slot] != ~0u && memcmp(&vertices[table[slot]], &vertices[i], sizeof(Vertex)) != 0)
+            slot = (slot + 1) & (tableSize - 1);
+
+        if (table[slot] == ~0u)
+        {
+            // Index values stay 32-bit, with ~0u left free for the table
+            if (unique == ~0u)
+            {
+                free(table);
+                free(remap);
+                return 0;
+            }
+
+            table[slot] = unique;
+            vertices[unique++] = vertices[i];
+        }
+
+        remap[i] = table[slot];
+    }
+
+    free(table);
+
+    Vertex* shrunk = arenaRealloc(arena, vertices, unique * sizeof(Vertex));
+    uint32_t* indices = shrunk ? arenaAlloc(arena, count * sizeof(uint32_t)) : 0;
+
+    if (indices)
+        memcpy(indices, remap, count * sizeof(uint32_t));
+
+    free(remap);
+
+    mesh->vertices = shrunk;
+    mesh->vertexCount = unique;
+    mesh->indices = indices;
+    mesh->indexCount = count;
+
+    return indices != 0;
+}
+
+int loadObj(Mesh* mesh, Arena* arena, const char* path, FileQueue* io)
+{
+    memset(mesh, 0, sizeof(*mesh));
+
+    for (int k = 0; k < 3; k++)
+    {
+        mesh->boundsMin[k] = FLT_MAX;
+        mesh->boundsMax[k] = -FLT_MAX;
+    }
+
+    // A mapped file is parsed across threads into fast_obj's arrays, which are
+    // then gathered across threads too. The chunk arrays are built on the
+    // workers' heaps, and the presized arrays they are merged into come out
+    // of the arena so the caller releases everything at once. A file read
+    // through the queue is parsed on one thread, and each face is gathered as
+    // it is parsed so the index and per-face arrays are never built; its
+    // attribute arrays keep growing with no counting pass and stay on the heap
+    // rather than leaving copies behind in the arena.
+    Arena* previousArena = arenaBind(io ? 0 : arena);
+
+    ObjGather gather = { .arena = arena, .mesh = mesh };
+
+    fastObjMesh* obj = io ? readObjFaces(path, io, gatherFace, &gather) : fast_obj_read_parallel(path, 0);
+
+    if (obj && !io)
+        gather.failed = !gatherFaces(mesh, arena, obj);
+
+    if (obj)
+        fast_obj_destroy(obj);
+
+    arenaBind(previousArena);
+
+    // Corners shared between faces become one vertex; submesh ranges stay the
+    // same and now address the index stream
+    int welded = obj && !gather.failed && weldMesh(mesh, arena);
+
+    Submesh* submeshes = mesh->submeshes;
+
+    mesh->submeshes = welded ? arenaAlloc(arena, mesh->submeshCount * sizeof(Submesh)) : 0;
+
+    if (mesh->submeshes && submeshes)
+        memcpy(mesh->submeshes, submeshes, mesh->submeshCount * sizeof(Submesh));
+
+    free(submeshes);
+
+    // Meshes beyond the arena or 32-bit vertex addressing fail as a whole
+    if (!mesh->submeshes)
+    {
+        memset(mesh, 0, sizeof(*mesh));
+        return 0;
+    }
+
+    if (mesh->vertexCount == 0)
+    {
+        memset(mesh->boundsMin, 0, sizeof(mesh->boundsMin));
+        memset(mesh->boundsMax, 0, sizeof(mesh->boundsMax));
+    }
+
+    return 1;
+}
+
+int loadMeshCache(Mesh* mesh, const char* cachePath, const char* sourcePath)
+{
+    memset(mesh, 0, sizeof(*mesh));
+
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    if (!statFile(sourcePath, &sourceSize, &sourceMtime))
+        return 0;
+
+    size_t size = 0;
+    char* data = mapFile(cachePath, &size);
+    if (!data)
+        return 0;
+
+    MeshCacheHeader header;
+    size_t pathLength = strlen(sourcePath);
+
+    int valid = size >= sizeof(header);
+
+    if (valid)
+    {
+        memcpy(&header, data, sizeof(header));
+
+        valid = header.magic == MESH_CACHE_MAGIC &&
+            header.version == MESH_CACHE_VERSION &&
+            header.vertexSize == sizeof(Vertex) &&
+            header.fileSize == size &&
+            header.pathLength == pathLength &&
+            pathLength <= size - sizeof(header) &&
+            memcmp(data + sizeof(header), sourcePath, pathLength) == 0 &&
+            header.sourceSize == sourceSize &&
+            checkStream(&header, header.vertexOffset, header.vertexCount, sizeof(Vertex)) &&
+            checkStream(&header, header.indexOffset, header.indexCount, sizeof(uint32_t)) &&
+            checkStream(&header, header.submeshOffset, header.submeshCount, sizeof(Submesh));
+    }
+
+    // A touched but unchanged source keeps its cache
+    if (valid && header.sourceMtime != sourceMtime)
+    {
+        uint64_t sourceHash;
+        valid = hashFile(sourcePath, &sourceHash) && sourceHash == header.sourceHash;
+    }
+
+    if (valid)
+        valid = hashCache(data, size) == header.hash;
+
+    if (!valid)
+    {
+        unmapFile(data, size);
+        return 0;
+    }
+
+    mesh->vertices = (Vertex*)(data + header.vertexOffset);
+    mesh->vertexCount = (size_t)header.vertexCount;
+    mesh->indices = (uint32_t*)(data + header.indexOffset);
+    mesh->indexCount = (size_t)header.indexCount;
+    mesh->submeshes = (Submesh*)(data + header.submeshOffset);
+    mesh->submeshCount = (size_t)header.submeshCount;
+
+    memcpy(mesh->boundsMin, header.boundsMin, sizeof(header.boundsMin));
+    memcpy(mesh->boundsMax, header.boundsMax, sizeof(header.boundsMax));
+
+    mesh->mapping = data;
+    mesh->mappingSize = size;
+
+    return 1;
+}
+
+static void cacheWrite(MeshCacheWriter* writer, const void* data, size_t size)
+{
+    if (writer->failed || size == 0)
+        return;
+
+    if (fwrite(data, 1, size, writer->file) != size)
+        writer->failed = 1;
+
+    hashUpdate(&writer->hash, data, size);
+    writer->offset += size;
+}
+
+static void cachePad(MeshCacheWriter* writer)
+{
+    static const char zeros[MESH_CACHE_ALIGN];
+
+    cacheWrite(writer, zeros, alignOffset((size_t)writer->offset) - (size_t)writer->offset);
+}
+
+// Starts a cache file that vertices can be appended to as they are produced
+static int beginMeshCache(MeshCacheWriter* writer, const char* cachePath, const char* sourcePath)
+{
+    memset(writer, 0, sizeof(*writer));
+
+    MeshCacheHeader* header = &writer->header;
+
+    header->magic = MESH_CACHE_MAGIC;
+    header->version = MESH_CACHE_VERSION;
+    header->vertexSize = sizeof(Vertex);
+    header->pathLength = (uint32_t)strlen(sourcePath);
+
+    if (!statFile(sourcePath, &header->sourceSize, &header->sourceMtime) || !hashFile(sourcePath, &header->sourceHash))
+        return 0;
+
+    // Write to a temporary file first so a crash never leaves a truncated cache behind
+    if (snprintf(writer->tempPath, sizeof(writer->tempPath), "%s.tmp", cachePath) >= (int)sizeof(writer->tempPath))
+        return 0;
+
+    writer->file = fopen(writer->tempPath, "wb");
+    if (!writer->file)
+        return 0;
+
+    writer->cachePath = cachePath;
+
+    // Placeholder, patched once the stream sizes are known
+    if (fwrite(header, sizeof(*header), 1, writer->file) != 1)
+        writer->failed = 1;
+
+    writer->offset = sizeof(*header);
+    hashBegin(&writer->hash, 0);
+
+    cacheWrite(writer, sourcePath, header->pathLength);
+    cachePad(writer);
+
+    header->vertexOffset = writer->offset;
+    return 1;
+}
+
+static void appendMeshCache(MeshCacheWriter* writer, const Vertex* vertices, size_t count)
+{
+    cacheWrite(writer, vertices, count * sizeof(Vertex));
+    writer->header.vertexCount += count;
+}
+
+static void abortMeshCache(MeshCacheWriter* writer)
+{
+    fclose(writer->file);
+    remove(writer->tempPath);
+}
+
+static int endMeshCache(MeshCacheWriter* writer, const Mesh* mesh)
+{
+    MeshCacheHeader* header = &writer->header;
+
+    cachePad(writer);
+    header->indexOffset = writer->offset;
+    header->indexCount = mesh->indexCount;
+    cacheWrite(writer, mesh->indices, mesh->indexCount * sizeof(uint32_t));
+
+    cachePad(writer);
+    header->submeshOffset = writer->offset;
+    header->submeshCount = mesh->submeshCount;
+    cacheWrite(writer, mesh->submeshes, mesh->submeshCount * sizeof(Submesh));
+
+    memcpy(header->boundsMin, mesh->boundsMin, sizeof(header->boundsMin));
+    memcpy(header->boundsMax, mesh->boundsMax, sizeof(header->boundsMax));
+
+    header->fileSize = writer->offset;
+    header->hash = hashCacheHeader(header, hashEnd(&writer->hash));
+
+    if (!writer->failed && (fseek(writer->file, 0, SEEK_SET) != 0 || fwrite(header, sizeof(*header), 1, writer->file) != 1))
+        writer->failed = 1;
+
+    if (fclose(writer->file) != 0)
+        writer->failed = 1;
+
+    if (writer->failed)
+    {
+        remove(writer->tempPath);
+        return 0;
+    }
+
+#ifdef _WIN32
+    // rename does not replace existing files on Windows
+    remove(writer->cachePath);
+#endif
+
+    if (rename(writer->tempPath, writer->cachePath) != 0)
+    {
+        remove(writer->tempPath);
+        return 0;
+    }
+
+    return 1;
+}
+
+int writeMeshCache(const Mesh* mesh, const char* cachePath, const char* sourcePath)
+{
+    MeshCacheWriter writer;
+    if (!beginMeshCache(&writer, cachePath, sourcePath))
+        return 0;
+
+    appendMeshCache(&writer, mesh->vertices, mesh->vertexCount);
+
+    return endMeshCache(&writer, mesh);
+}
+
+// Welded caches only; a non-empty mesh without indices never came from loadMesh
+static int loadIndexedMeshCache(Mesh* mesh, const char* cachePath, const char* sourcePath)
+{
+    if (!loadMeshCache(mesh, cachePath, sourcePath))
+        return 0;
+
+    if (mesh->indexCount == 0 && mesh->vertexCount != 0)
+    {
+        destroyMesh(mesh);
+        return 0;
+    }
+
+    return 1;
+}
+
+int loadMesh(Mesh* mesh, Arena* arena, const char* path, FileQueue* io)
+{
+    char cachePath[1024];
+    int cacheable = snprintf(cachePath, sizeof(cachePath), "%s.meshcache", path) < (int)sizeof(cachePath);
+
+    if (cacheable && loadIndexedMeshCache(mesh, cachePath, path))
+        return 1;
+
+    if (!loadObj(mesh, arena, path, io))
+        return 0;
+
+    // Normals missing from the OBJ are generated on the GPU from the index
+    // stream; hard edges need their own vertices first. Without the memory
+    // the mesh is simply smooth everywhere.
+    splitCreases(mesh, arena, MESH_NORMAL_CREASE_ANGLE);
+
+    // The optimised triangle and vertex order is what gets cached
+    optimizeMesh(mesh, MESH_VERTEX_CACHE_SIZE, MESH_OVERDRAW_THRESHOLD);
+    optimizeVertexFetch(mesh);
+
+    // A failed write only costs the next start a reparse
+    if (cacheable)
+        writeMeshCache(mesh, cachePath, path);
+
+    return 1;
+}
+
+void destroyMesh(Mesh* mesh)
+{
+    // Streams from loadObj live in the caller's arena
+    if (mesh->mapping)
+        unmapFile(mesh->mapping, mesh->mappingSize);
+
+    memset(mesh, 0, sizeof(*mesh));
+}
+
+typedef struct
+{
+    StagingRing*        ring;
+    Arena*              arena;
+    Mesh*               mesh;
+    size_t              submeshCapacity;
+    MeshCacheWriter*    cache;
+
+    uint32_t            slot;
+    size_t              fill;
+    size_t              offset;
+    int                 failed;
+} MeshStream;
+
+static void streamFlush(MeshStream* stream)
+{
+    StagingRing* ring = stream->ring;
+
+    if (stream->fill == 0)
+        return;
+
+    const Vertex* batch = ring->vertices + stream->slot * ring->slotSize;
+
+    if (stream->cache)
+        appendMeshCache(stream->cache, batch, stream->fill);
+
+    ring->upload(ring->context, stream->slot, batch, stream->fill, stream->offset);
+
+    stream->offset += stream->fill;
+    stream->fill = 0;
+
+    stream->slot = (stream->slot + 1) % ring->slotCount;
+    ring->wait(ring->context, stream->slot);
+}
+
+static void streamVertex(MeshStream* stream, const Vertex* vertex)
+{
+    StagingRing* ring = stream->ring;
+
+    if (stream->fill == ring->slotSize)
+        streamFlush(stream);
+
+    ring->vertices[stream->slot * ring->slotSize + stream->fill++] = *vertex;
+
+    expandBounds(stream->mesh->boundsMin, stream->mesh->boundsMax, vertex->position);
+}
+
+// Streamed meshes have no index stream to generate smooth normals from, so
+// corners without a normal get the triangle's
+static void fillFlatNormals(Vertex triangle[3])
+{
+    const float* p0 = triangle[0].position;
+    const float* p1 = triangle[1].position;
+    const float* p2 = triangle[2].position;
+
+    float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+
+    float n[3] =
+    {
+        e1[1] * e2[2] - e1[2] * e2[1],
+        e1[2] * e2[0] - e1[0] * e2[2],
+        e1[0] * e2[1] - e1[1] * e2[0],
+    };
+
+    float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+    for (int k = 0; k < 3; k++)
+        n[k] = length > 0.f ? n[k] / length : (k == 2 ? 1.f : 0.f);
+
+    for (int i = 0; i < 3; i++)
+        if (triangle[i].normal[0] == 0.f && triangle[i].normal[1] == 0.f && triangle[i].normal[2] == 0.f)
+            memcpy(triangle[i].normal, n, sizeof(n));
+}
+
+static void streamFace(const fastObjMesh* obj, const fastObjIndex* indices, unsigned int count, unsigned int material, void* userData)
+{
+    MeshStream* stream = userData;
+    Mesh* mesh = stream->mesh;
+
+    if (count < 3)
+        return;
+
+    // Submesh ranges address the stream with MeshUInt
+    if (stream->failed || stream->offset + stream->fill + 3 * (count - 2) > MESH_UINT_MAX)
+    {
+        stream->failed = 1;
+        return;
+    }
+
+    addFaceToSubmesh(mesh, stream->arena, &stream->submeshCapacity, material, stream->offset + stream->fill, count);
+
+    // triangulate polygons as a fan around the first corner, like loadObj
+    Vertex first = makeVertex(obj, indices[0]);
+    Vertex previous = makeVertex(obj, indices[1]);
+
+    for (unsigned int j = 2; j < count; j++)
+    {
+        Vertex v = makeVertex(obj, indices[j]);
+
+        Vertex triangle[3] = { first, previous, v };
+        fillFlatNormals(triangle);
+
+        streamVertex(stream, &triangle[0]);
+        streamVertex(stream, &triangle[1]);
+        streamVertex(stream, &triangle[2]);
+
+        previous = v;
+    }
+}
+
+int streamMesh(Mesh* mesh, Arena* arena, const char* path, StagingRing* ring, FileQueue* io)
+{
+    memset(mesh, 0, sizeof(*mesh));
+
+    MeshStream stream = { .ring = ring, .arena = arena, .mesh = mesh };
+
+    // Streamed vertices are unwelded with flat normals, so they get a cache of
+    // their own; a welded cache from loadMesh is never replayed, which keeps
+    // streamed meshes unindexed whatever caches sit next to the source
+    char cachePath[1024];
+    int cacheable = snprintf(cachePath, sizeof(cachePath), "%s.streamcache", path) < (int)sizeof(cachePath);
+
+    // A valid cache is replayed through the ring in slot sized batches
+    Mesh cached;
+    if (cacheable && loadMeshCache(&cached, cachePath, path))
+    {
+        Submesh* submeshes = arenaAlloc(arena, cached.submeshCount * sizeof(Submesh));
+
+        if (!submeshes)
+        {
+            destroyMesh(&cached);
+            return 0;
+        }
+
+        for (size_t i = 0; i < cached.vertexCount; i += ring->slotSize)
+        {
+            stream.fill = cached.vertexCount - i < ring->slotSize ? cached.vertexCount - i : ring->slotSize;
+            memcpy(ring->vertices + stream.slot * ring->slotSize, cached.vertices + i, stream.fill * sizeof(Vertex));
+            streamFlush(&stream);
+        }
+
+        mesh->vertexCount = cached.vertexCount;
+        mesh->submeshes = submeshes;
+        mesh->submeshCount = cached.submeshCount;
+
+        memcpy(submeshes, cached.submeshes, cached.submeshCount * sizeof(Submesh));
+        memcpy(mesh->boundsMin, cached.boundsMin, sizeof(mesh->boundsMin));
+        memcpy(mesh->boundsMax, cached.boundsMax, sizeof(mesh->boundsMax));
+
+        destroyMesh(&cached);
+        return 1;
+    }
+
+    MeshCacheWriter cache;
+    if (cacheable && beginMeshCache(&cache, cachePath, path))
+        stream.cache = &cache;
+
+    for (int k = 0; k < 3; k++)
+    {
+        mesh->boundsMin[k] = FLT_MAX;
+        mesh->boundsMax[k] = -FLT_MAX;
+    }
+
+    // The OBJ's own arrays stay on the heap and are freed as soon as parsing ends
+    fastObjMesh* obj = readObjFaces(path, io, streamFace, &stream);
+    if (obj && stream.failed)
+    {
+        fast_obj_destroy(obj);
+        obj = 0;
+    }
+
+    if (!obj)
+    {
+        if (stream.cache)
+            abortMeshCache(stream.cache);
+
+        memset(mesh, 0, sizeof(*mesh));
+        return 0;
+    }
+
+    streamFlush(&stream);
+
+    fast_obj_destroy(obj);
+
+    mesh->vertexCount = stream.offset;
+
+    if (mesh->vertexCount == 0)
+    {
+        memset(mesh->boundsMin, 0, sizeof(mesh->boundsMin));
+        memset(mesh->boundsMax, 0, sizeof(mesh->boundsMax));
+    }
+
+    // A failed write only costs the next start a reparse
+    if (stream.cache)
+        endMeshCache(stream.cache, mesh);
+
+    return 1;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "fileio.h"
+
+typedef struct
+{
+    float position[3];
+    float normal[3];
+    float texcoord[2];
+} Vertex;
+
+// Corners of the unwelded vertex stream and of the index stream; the 64-bit
+// loader build widens them so meshes past 4G corners load, while index
+// values and the default build stay 32-bit
+#ifdef FAST_OBJ_64BIT
+typedef uint64_t MeshUInt;
+#define MESH_UINT_MAX UINT64_MAX
+#else
+typedef uint32_t MeshUInt;
+#define MESH_UINT_MAX UINT32_MAX
+#endif
+
+typedef struct
+{
+    MeshUInt offset;    // first index, or first vertex when the mesh has no indices
+    MeshUInt count;
+    uint32_t material;
+} Submesh;
+
+typedef struct
+{
+    Vertex*     vertices;
+    size_t      vertexCount;
+
+    uint32_t*   indices;
+    size_t      indexCount;
+
+    Submesh*    submeshes;
+    size_t      submeshCount;
+
+    float       boundsMin[3];
+    float       boundsMax[3];
+
+    // Set when the streams point into a mapped cache file
+    void*       mapping;
+    size_t      mappingSize;
+} Mesh;
+
+// Parses and triangulates an OBJ, then welds identical corners into unique
+// vertices and an index stream; all streams are allocated from the arena.
+// With a file queue the OBJ is read ahead in blocks while earlier ones are
+// parsed, and each face is gathered into the vertex stream as it is read.
+// Otherwise it is mapped, parsed across threads and gathered across threads
+// into disjoint ranges of the vertex stream.
+int loadObj(Mesh* mesh, Arena* arena, const char* path, FileQueue* io);
+
+// Binary cache of a processed mesh, keyed by the source file's path, size,
+// mtime and content hash. Loading maps the cache and points the mesh streams
+// into it; stale or corrupt caches are rejected.
+int loadMeshCache(Mesh* mesh, const char* cachePath, const char* sourcePath);
+int writeMeshCache(const Mesh* mesh, const char* cachePath, const char* sourcePath);
+
+// Loads <path>.meshcache if it is valid, otherwise parses and optimises the
+// OBJ and writes the cache
+int loadMesh(Mesh* mesh, Arena* arena, const char* path, FileQueue* io);
+void destroyMesh(Mesh* mesh);
+
+// Fixed-size ring of vertex batches owned by the caller. Slots are filled in
+// order and handed to upload; wait is called on a slot before it is refilled.
+// All slots start out free, and the caller waits for outstanding uploads once
+// streaming returns.
+typedef struct
+{
+    Vertex*     vertices;   // slotCount * slotSize vertices
+    size_t      slotSize;
+    uint32_t    slotCount;
+
+    void        (*upload)(void* context, uint32_t slot, const Vertex* vertices, size_t count, size_t offset);
+    void        (*wait)(void* context, uint32_t slot);
+    void*       context;
+} StagingRing;
+
+// Triangulates faces while the OBJ is parsed and emits the vertices through the
+// ring, so the full index and vertex arrays never exist in host memory; only
+// the OBJ's attribute arrays grow with the source. A valid <path>.streamcache
+// is replayed through the ring instead, and one is written on the way
+// otherwise; <path>.meshcache is ignored.
+// Streamed meshes are neither welded nor indexed. On return the mesh has
+// counts, submeshes (from the arena) and bounds but no vertex or index stream.
+int streamMesh(Mesh* mesh, Arena* arena, const char* path, StagingRing* ring, FileQueue* io);
@@ -0,0 +1,1989 @@
+#include "meshopt.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Transforms the corners of one triangle through a FIFO cache: a vertex hits
+// when it missed within the last cacheSize misses. Stamps of 0 always miss
+// while time starts above cacheSize.
+static uint32_t cacheTriangle(const uint32_t* triangle, uint32_t* stamps, uint32_t* time, uint32_t cacheSize)
+{
+    uint32_t misses = 0;
+
+    for (int k = 0; k < 3; k++)
+        if (*time - stamps[triangle[k]] > cacheSize)
+        {
+            stamps[triangle[k]] = (*time)++;
+            misses++;
+        }
+
+    return misses;
+}
+
+VertexCacheStatistics analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+    VertexCacheStatistics statistics = {0};
+
+    uint32_t* stamps = calloc(vertexCount ? vertexCount : 1, sizeof(uint32_t));
+    if (!stamps || indexCount < 3)
+    {
+        free(stamps);
+        return statistics;
+    }
+
+    uint32_t time = cacheSize + 1;
+    size_t misses = 0;
+
+    for (size_t i = 0; i + 3 <= indexCount; i += 3)
+        misses += cacheTriangle(&indices[i], stamps, &time, cacheSize);
+
+    free(stamps);
+
+    statistics.acmr = (float)misses / (float)(indexCount / 3);
+    statistics.atvr = vertexCount ? (float)misses / (float)vertexCount : 0.f;
+
+    return statistics;
+}
+
+VertexFetchStatistics analyzeVertexFetch(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexSize, uint32_t cacheSize)
+{
+    VertexFetchStatistics statistics = {0};
+
+    uint32_t* stamps = calloc(vertexCount ? vertexCount : 1, sizeof(uint32_t));
+    if (!stamps || indexCount < 3 || vertexCount == 0)
+    {
+        free(stamps);
+        return statistics;
+    }
+
+    size_t lines[MESH_VERTEX_FETCH_CACHE_LINES];
+    memset(lines, 0xff, sizeof(lines));
+
+    uint32_t time = cacheSize + 1;
+    size_t fetched = 0;
+
+    for (size_t i = 0; i + 3 <= indexCount; i += 3)
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = indices[i + k];
+
+            if (time - stamps[v] <= cacheSize)
+                continue;
+
+            stamps[v] = time++;
+
+            size_t first = v * vertexSize / 64;
+            size_t last = ((size_t)v * vertexSize + vertexSize - 1) / 64;
+
+            for (size_t line = first; line <= last; line++)
+                if (lines[line % MESH_VERTEX_FETCH_CACHE_LINES] != line)
+                {
+                    lines[line % MESH_VERTEX_FETCH_CACHE_LINES] = line;
+                    fetched += 64;
+                }
+        }
+
+    free(stamps);
+
+    statistics.overfetch = (float)fetched / (float)(vertexCount * vertexSize);
+
+    return statistics;
+}
+
+typedef struct
+{
+    float       key;
+    uint32_t    cluster;
+} ClusterKey;
+
+// Scratch for one submesh at a time, sized for the largest; vertices are
+// renumbered densely per submesh so the work stays proportional to its size
+typedef struct
+{
+    uint32_t*       localIds;       // mesh vertex -> submesh vertex, ~0u when unused
+    uint32_t*       globalIds;      // submesh vertex -> mesh vertex
+    uint32_t*       local;          // submesh indices in submesh vertices
+    uint32_t*       order;          // reordered submesh indices
+
+    uint32_t*       liveCounts;     // triangles not emitted yet, per vertex
+    uint32_t*       adjacencyOffsets;
+    uint32_t*       adjacency;      // triangles around each vertex
+    uint32_t*       stamps;
+    uint32_t*       deadEnds;
+    uint32_t*       candidates;
+    unsigned char*  emitted;
+
+    uint32_t*       clusters;       // first triangle of each cluster, then the end
+    ClusterKey*     clusterKeys;
+} OptimizeScratch;
+
+// Next vertex to fan around: the candidate that stays in cache longest after
+// its remaining triangles are emitted, otherwise the most recent dead end
+// with triangles left, otherwise the next such vertex in input order
+static uint32_t nextFanVertex(OptimizeScratch* scratch, size_t candidateCount, size_t* deadEndCount, uint32_t* cursor, uint32_t vertexCount, uint32_t time, uint32_t cacheSize)
+{
+    uint32_t best = ~0u;
+    int64_t bestPriority = -1;
+
+    for (size_t i = 0; i < candidateCount; i++)
+    {
+        uint32_t v = scratch->candidates[i];
+        uint32_t live = scratch->liveCounts[v];
+
+        if (live == 0)
+            continue;
+
+        uint32_t age = time - scratch->stamps[v];
+        int64_t priority = (uint64_t)age + 2 * (uint64_t)live <= cacheSize ? age : 0;
+
+        if (priority > bestPriority)
+        {
+            best = v;
+            bestPriority = priority;
+        }
+    }
+
+    if (best != ~0u)
+        return best;
+
+    while (*deadEndCount)
+    {
+        uint32_t v = scratch->deadEnds[--*deadEndCount];
+
+        if (scratch->liveCounts[v])
+            return v;
+    }
+
+    for (; *cursor < vertexCount; ++*cursor)
+        if (scratch->liveCounts[*cursor])
+            return *cursor;
+
+    return ~0u;
+}
+
+// Tipsify (Sander, Nehab and Barczak 2007): emits all remaining triangles
+// around one vertex at a time, choosing the next vertex among the ones just
+// emitted so the fans stay within the cache
+static void tipsify(OptimizeScratch* scratch, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+{
+    const uint32_t* indices = scratch->local;
+    size_t triangleCount = indexCount / 3;
+
+    memset(scratch->liveCounts, 0, vertexCount * sizeof(uint32_t));
+
+    for (size_t i = 0; i < indexCount; i++)
+        scratch->liveCounts[indices[i]]++;
+
+    scratch->adjacencyOffsets[0] = 0;
+
+    for (uint32_t v = 0; v < vertexCount; v++)
+        scratch->adjacencyOffsets[v + 1] = scratch->adjacencyOffsets[v] + scratch->liveCounts[v];
+
+    // stamps double as the fill cursors before they are cleared
+    memcpy(scratch->stamps, scratch->adjacencyOffsets, vertexCount * sizeof(uint32_t));
+
+    for (size_t i = 0; i < indexCount; i++)
+        scratch->adjacency[scratch->stamps[indices[i]]++] = (uint32_t)(i / 3);
+
+    memset(scratch->stamps, 0, vertexCount * sizeof(uint32_t));
+    memset(scratch->emitted, 0, triangleCount);
+
+    uint32_t time = cacheSize + 1;
+    uint32_t cursor = 0;
+    size_t deadEndCount = 0;
+    size_t outputCount = 0;
+
+    uint32_t fan = 0;
+
+    while (fan != ~0u)
+    {
+        size_t candidateCount = 0;
+
+        for (uint32_t a = scratch->adjacencyOffsets[fan]; a < scratch->adjacencyOffsets[fan + 1]; a++)
+        {
+            uint32_t t = scratch->adjacency[a];
+
+            if (scratch->emitted[t])
+                continue;
+
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t v = indices[t * 3 + k];
+
+                scratch->order[outputCount++] = v;
+                scratch->deadEnds[deadEndCount++] = v;
+                scratch->candidates[candidateCount++] = v;
+                scratch->liveCounts[v]--;
+
+                if (time - scratch->stamps[v] > cacheSize)
+                    scratch->stamps[v] = time++;
+            }
+
+            scratch->emitted[t] = 1;
+        }
+
+        fan = nextFanVertex(scratch, candidateCount, &deadEndCount, &cursor, vertexCount, time, cacheSize);
+    }
+}
+
+static void resetCache(const uint32_t* indices, size_t indexCount, uint32_t* stamps)
+{
+    for (size_t i = 0; i < indexCount; i++)
+        stamps[indices[i]] = 0;
+}
+
+// Cuts the cache optimised order into clusters: where the cache starts over
+// (a triangle misses on every corner), and within those wherever the misses
+// so far already stay within threshold of the whole cluster's ACMR. Every
+// cut restarts the cache, so drawing the clusters in any order costs at most
+// threshold times the ACMR.
+static size_t splitClusters(OptimizeScratch* scratch, size_t triangleCount, uint32_t cacheSize, float threshold)
+{
+    const uint32_t* indices = scratch->order;
+    uint32_t* stamps = scratch->stamps;
+
+    size_t hardCount = 0;
+    uint32_t time = cacheSize + 1;
+
+    resetCache(indices, triangleCount * 3, stamps);
+
+    for (size_t t = 0; t < triangleCount; t++)
+        if (cacheTriangle(&indices[t * 3], stamps, &time, cacheSize) == 3 || t == 0)
+            scratch->clusters[hardCount++] = (uint32_t)t;
+
+    // Hard cluster starts are kept at the end of the array while soft ones
+    // are written from the front; each hard cluster yields at least one
+    memmove(scratch->clusters + triangleCount - hardCount, scratch->clusters, hardCount * sizeof(uint32_t));
+
+    const uint32_t* hard = scratch->clusters + triangleCount - hardCount;
+    size_t clusterCount = 0;
+
+    for (size_t h = 0; h < hardCount; h++)
+    {
+        size_t start = hard[h];
+        size_t end = h + 1 < hardCount ? hard[h + 1] : triangleCount;
+
+        resetCache(&indices[start * 3], (end - start) * 3, stamps);
+        time = cacheSize + 1;
+
+        size_t misses = 0;
+        for (size_t t = start; t < end; t++)
+            misses += cacheTriangle(&indices[t * 3], stamps, &time, cacheSize);
+
+        float limit = threshold * (float)misses / (float)(end - start);
+
+        scratch->clusters[clusterCount++] = (uint32_t)start;
+
+        resetCache(&indices[start * 3], (end - start) * 3, stamps);
+        time = cacheSize + 1;
+
+        size_t runMisses = 0;
+        size_t runStart = start;
+
+        for (size_t t = start; t < end; t++)
+        {
+            runMisses += cacheTriangle(&indices[t * 3], stamps, &time, cacheSize);
+
+            if (t + 1 < end && (float)runMisses <= limit * (float)(t + 1 - runStart))
+            {
+                scratch->clusters[clusterCount++] = (uint32_t)(t + 1);
+
+                // Only the finished run has stamps to clear
+                resetCache(&indices[runStart * 3], (t + 1 - runStart) * 3, stamps);
+                time = cacheSize + 1;
+                runMisses = 0;
+                runStart = t + 1;
+            }
+        }
+
+        resetCache(&indices[runStart * 3], (end - runStart) * 3, stamps);
+    }
+
+    scratch->clusters[clusterCount] = (uint32_t)triangleCount;
+    return clusterCount;
+}
+
+// Descending by key; equal keys keep their cache order
+static int compareClusterKeys(const void* a, const void* b)
+{
+    const ClusterKey* ka = a;
+    const ClusterKey* kb = b;
+
+    if (ka->key != kb->key)
+        return ka->key < kb->key ? 1 : -1;
+
+    return ka->cluster < kb->cluster ? -1 : ka->cluster > kb->cluster;
+}
+
+static const float* position(const Mesh* mesh, const OptimizeScratch* scratch, uint32_t v)
+{
+    return mesh->vertices[scratch->globalIds[v]].position;
+}
+
+// View independent occlusion (Sander, Nehab and Barczak 2007): a cluster
+// whose area weighted centroid lies further out along its average normal is
+// more likely to cover the others than to be covered by them
+static void sortClusters(const Mesh* mesh, OptimizeScratch* scratch, size_t triangleCount, size_t clusterCount)
+{
+    const uint32_t* indices = scratch->order;
+
+    float meshCentroid[3] = {0};
+
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        for (int k = 0; k < 3; k++)
+            meshCentroid[k] += position(mesh, scratch, indices[i])[k];
+
+    for (int k = 0; k < 3; k++)
+        meshCentroid[k] /= (float)(triangleCount * 3);
+
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        float centroid[3] = {0};
+        float normal[3] = {0};
+        float area = 0.f;
+
+        for (size_t t = scratch->clusters[c]; t < scratch->clusters[c + 1]; t++)
+        {
+            const float* p0 = position(mesh, scratch, indices[t * 3 + 0]);
+            const float* p1 = position(mesh, scratch, indices[t * 3 + 1]);
+            const float* p2 = position(mesh, scratch, indices[t * 3 + 2]);
+
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+
+            float n[3] =
+            {
+                e1[1] * e2[2] - e1[2] * e2[1],
+                e1[2] * e2[0] - e1[0] * e2[2],
+                e1[0] * e2[1] - e1[1] * e2[0],
+            };
+
+            float weight = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+            for (int k = 0; k < 3; k++)
+            {
+                centroid[k] += (p0[k] + p1[k] + p2[k]) * (weight / 3.f);
+                normal[k] += n[k];
+            }
+
+            area += weight;
+        }
+
+        float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        float key = 0.f;
+
+        if (area > 0.f && length > 0.f)
+            for (int k = 0; k < 3; k++)
+                key += (centroid[k] / area - meshCentroid[k]) * normal[k] / length;
+
+        scratch->clusterKeys[c].key = key;
+        scratch->clusterKeys[c].cluster = (uint32_t)c;
+    }
+
+    qsort(scratch->clusterKeys, clusterCount, sizeof(ClusterKey), compareClusterKeys);
+}
+
+int optimizeMesh(Mesh* mesh, uint32_t cacheSize, float overdrawThreshold)
+{
+    if (mesh->indexCount == 0)
+        return 1;
+
+    size_t maxCount = 0;
+    for (size_t s = 0; s < mesh->submeshCount; s++)
+        if (mesh->submeshes[s].count > maxCount)
+            maxCount = mesh->submeshes[s].count;
+
+    size_t maxTriangles = maxCount / 3;
+
+    OptimizeScratch scratch =
+    {
+        .localIds = malloc(mesh->vertexCount * sizeof(uint32_t)),
+        .globalIds = malloc(maxCount * sizeof(uint32_t)),
+        .local = malloc(maxCount * sizeof(uint32_t)),
+        .order = malloc(maxCount * sizeof(uint32_t)),
+        .liveCounts = malloc(maxCount * sizeof(uint32_t)),
+        .adjacencyOffsets = malloc((maxCount + 1) * sizeof(uint32_t)),
+        .adjacency = malloc(maxCount * sizeof(uint32_t)),
+        .stamps = malloc(maxCount * sizeof(uint32_t)),
+        .deadEnds = malloc(maxCount * sizeof(uint32_t)),
+        .candidates = malloc(maxCount * sizeof(uint32_t)),
+        .emitted = malloc(maxTriangles + 1),
+        .clusters = malloc((maxTriangles + 1) * sizeof(uint32_t)),
+        .clusterKeys = malloc((maxTriangles + 1) * sizeof(ClusterKey)),
+    };
+
+    int ok = scratch.localIds && scratch.globalIds && scratch.local && scratch.order &&
+        scratch.liveCounts && scratch.adjacencyOffsets && scratch.adjacency && scratch.stamps &&
+        scratch.deadEnds && scratch.candidates && scratch.emitted &&
+        scratch.clusters && scratch.clusterKeys;
+
+    if (ok)
+        memset(scratch.localIds, 0xff, mesh->vertexCount * sizeof(uint32_t));
+
+    for (size_t s = 0; ok && s < mesh->submeshCount; s++)
+    {
+        uint32_t* indices = mesh->indices + mesh->submeshes[s].offset;
+        size_t count = mesh->submeshes[s].count / 3 * 3;
+        size_t triangleCount = count / 3;
+
+        if (triangleCount < 2)
+            continue;
+
+        uint32_t vertexCount = 0;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t v = indices[i];
+
+            if (scratch.localIds[v] == ~0u)
+            {
+                scratch.localIds[v] = vertexCount;
+                scratch.globalIds[vertexCount++] = v;
+            }
+
+            scratch.local[i] = scratch.localIds[v];
+        }
+
+        tipsify(&scratch, count, vertexCount, cacheSize);
+
+        if (overdrawThreshold > 0.f)
+        {
+            size_t clusterCount = splitClusters(&scratch, triangleCount, cacheSize, overdrawThreshold);
+            sortClusters(mesh, &scratch, triangleCount, clusterCount);
+
+            size_t i = 0;
+
+            for (size_t c = 0; c < clusterCount; c++)
+            {
+                uint32_t cluster = scratch.clusterKeys[c].cluster;
+
+                for (size_t t = scratch.clusters[cluster]; t < scratch.clusters[cluster + 1]; t++)
+                    for (int k = 0; k < 3; k++)
+                        indices[i++] = scratch.globalIds[scratch.order[t * 3 + k]];
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+                indices[i] = scratch.globalIds[scratch.order[i]];
+        }
+
+        for (uint32_t v = 0; v < vertexCount; v++)
+            scratch.localIds[scratch.globalIds[v]] = ~0u;
+    }
+
+    free(scratch.localIds);
+    free(scratch.globalIds);
+    free(scratch.local);
+    free(scratch.order);
+    free(scratch.liveCounts);
+    free(scratch.adjacencyOffsets);
+    free(scratch.adjacency);
+    free(scratch.stamps);
+    free(scratch.deadEnds);
+    free(scratch.candidates);
+    free(scratch.emitted);
+    free(scratch.clusters);
+    free(scratch.clusterKeys);
+
+    return ok;
+}
+
+int optimizeVertexFetch(Mesh* mesh)
+{
+    size_t vertexCount = mesh->vertexCount;
+
+    if (mesh->indexCount == 0)
+        return 1;
+
+    // remap[old] is the new position of each vertex
+    uint32_t* remap = malloc(vertexCount * sizeof(uint32_t));
+    if (!remap)
+        return 0;
+
+    memset(remap, 0xff, vertexCount * sizeof(uint32_t));
+
+    uint32_t next = 0;
+
+    for (size_t i = 0; i < mesh->indexCount; i++)
+    {
+        uint32_t v = mesh->indices[i];
+
+        if (remap[v] == ~0u)
+            remap[v] = next++;
+
+        mesh->indices[i] = remap[v];
+    }
+
+    for (size_t v = 0; v < vertexCount; v++)
+        if (remap[v] == ~0u)
+            remap[v] = next++;
+
+    // Walk each cycle of the permutation once, carrying the displaced vertex
+    // along; placed vertices are marked with ~0u
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        if (remap[i] == ~0u)
+            continue;
+
+        Vertex carry = mesh->vertices[i];
+        uint32_t j = remap[i];
+        remap[i] = ~0u;
+
+        while (j != i)
+        {
+            Vertex displaced = mesh->vertices[j];
+            mesh->vertices[j] = carry;
+            carry = displaced;
+
+            uint32_t k = remap[j];
+            remap[j] = ~0u;
+            j = k;
+        }
+
+        mesh->vertices[i] = carry;
+    }
+
+    free(remap);
+
+    return 1;
+}
+
+static uint32_t quantizeUnorm16(float v)
+{
+    v = v < 0.f ? 0.f : v > 1.f ? 1.f : v;
+    return (uint32_t)(v * 65535.f + 0.5f);
+}
+
+// Round to nearest, flushing values below the normal range to zero
+static uint32_t quantizeHalf(float v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude > 0x7f800000)
+        return sign | 0x7e00;           // NaN
+    if (magnitude >= 0x477ff000)
+        return sign | 0x7c00;           // rounds past the largest half
+    if (magnitude < 0x38800000)
+        return sign;
+
+    return sign | ((magnitude - 0x38000000 + 0x1000) >> 13);
+}
+
+static float decodeHalf(uint32_t h)
+{
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    float v = exponent == 0 ? ldexpf((float)mantissa, -24)
+        : exponent == 31 ? (mantissa ? NAN : INFINITY)
+        : ldexpf((float)(mantissa | 0x400), (int)exponent - 25);
+
+    return h & 0x8000 ? -v : v;
+}
+
+static float decodeSnorm8(int v)
+{
+    float f = (float)v / 127.f;
+    return f < -1.f ? -1.f : f;
+}
+
+// Same steps as the decode in trig.vert
+static void decodeOctahedral(int x, int y, float normal[3])
+{
+    normal[0] = decodeSnorm8(x);
+    normal[1] = decodeSnorm8(y);
+    normal[2] = 1.f - fabsf(normal[0]) - fabsf(normal[1]);
+
+    float t = normal[2] < 0.f ? -normal[2] : 0.f;
+    normal[0] += normal[0] >= 0.f ? -t : t;
+    normal[1] += normal[1] >= 0.f ? -t : t;
+
+    float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+    for (int k = 0; k < 3; k++)
+        normal[k] /= length;
+}
+
+// Projects onto the octahedron, folds the lower half over, and keeps the
+// rounding of the four nearest grid points that decodes closest
+static float encodeOctahedral(const float n[3], int* ox, int* oy)
+{
+    float sum = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+
+    *ox = *oy = 0;
+
+    // A missing normal gets the one code no real normal rounds to
+    if (sum == 0.f)
+    {
+        *ox = *oy = PACKED_NORMAL_MISSING;
+        return 1.f;
+    }
+
+    float x = n[0] / sum;
+    float y = n[1] / sum;
+
+    if (n[2] < 0.f)
+    {
+        float fx = (1.f - fabsf(y)) * (x >= 0.f ? 1.f : -1.f);
+        float fy = (1.f - fabsf(x)) * (y >= 0.f ? 1.f : -1.f);
+        x = fx;
+        y = fy;
+    }
+
+    float bestDot = -2.f;
+
+    for (int k = 0; k < 4; k++)
+    {
+        int cx = (int)(k & 1 ? ceilf(x * 127.f) : floorf(x * 127.f));
+        int cy = (int)(k & 2 ? ceilf(y * 127.f) : floorf(y * 127.f));
+
+        float decoded[3];
+        decodeOctahedral(cx, cy, decoded);
+
+        float dot = (decoded[0] * n[0] + decoded[1] * n[1] + decoded[2] * n[2]) / sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+        if (dot > bestDot)
+        {
+            bestDot = dot;
+            *ox = cx;
+            *oy = cy;
+        }
+    }
+
+    return bestDot;
+}
+
+// Shared by both packed streams, so they rasterize to the same depth
+static void quantizePosition(uint32_t p[3], const float position[3], const float boundsMin[3], const float scale[3])
+{
+    for (int k = 0; k < 3; k++)
+        p[k] = quantizeUnorm16(scale[k] > 0.f ? (position[k] - boundsMin[k]) / scale[k] : 0.f);
+}
+
+PackedVertexError packVertices(PackedVertex* packed, const Vertex* vertices, size_t count, const float boundsMin[3], const float boundsMax[3])
+{
+    PackedVertexError error = {0};
+    float minDot = 1.f;
+
+    float scale[3];
+    for (int k = 0; k < 3; k++)
+        scale[k] = boundsMax[k] - boundsMin[k];
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const Vertex* v = &vertices[i];
+
+        uint32_t p[3];
+        quantizePosition(p, v->position, boundsMin, scale);
+
+        for (int k = 0; k < 3; k++)
+        {
+            float decoded = boundsMin[k] + (float)p[k] / 65535.f * scale[k];
+            error.position = fmaxf(error.position, fabsf(decoded - v->position[k]));
+        }
+
+        int nx, ny;
+        minDot = fminf(minDot, encodeOctahedral(v->normal, &nx, &ny));
+
+        uint32_t t[2];
+        for (int k = 0; k < 2; k++)
+        {
+            t[k] = quantizeHalf(v->texcoord[k]);
+            error.texcoord = fmaxf(error.texcoord, fabsf(decodeHalf(t[k]) - v->texcoord[k]));
+        }
+
+        // Built locally so the destination, usually mapped device memory, is only written
+        const PackedVertex pv =
+        {
+            .positionXY = p[0] | (p[1] << 16),
+            .positionZNormal = p[2] | ((uint32_t)(nx & 0xff) << 16) | ((uint32_t)(ny & 0xff) << 24),
+            .texcoord = t[0] | (t[1] << 16),
+        };
+
+        packed[i] = pv;
+    }
+
+    error.normal = acosf(fminf(fmaxf(minDot, -1.f), 1.f)) * (180.f / 3.14159265f);
+
+    return error;
+}
+
+void packPositions(PackedPosition* positions, const Vertex* vertices, size_t count, const float boundsMin[3], const float boundsMax[3])
+{
+    float scale[3];
+    for (int k = 0; k < 3; k++)
+        scale[k] = boundsMax[k] - boundsMin[k];
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t p[3];
+        quantizePosition(p, vertices[i].position, boundsMin, scale);
+
+        const PackedPosition pp =
+        {
+            .positionXY = p[0] | (p[1] << 16),
+            .positionZ = p[2],
+        };
+
+        positions[i] = pp;
+    }
+}
+
+void unpackVertex(Vertex* vertex, const PackedVertex* packed, const float boundsMin[3], const float boundsMax[3])
+{
+    uint32_t p[3] = { packed->positionXY & 0xffff, packed->positionXY >> 16, packed->positionZNormal & 0xffff };
+
+    for (int k = 0; k < 3; k++)
+        vertex->position[k] = boundsMin[k] + (float)p[k] / 65535.f * (boundsMax[k] - boundsMin[k]);
+
+    int nx = (int8_t)(packed->positionZNormal >> 16);
+    int ny = (int8_t)(packed->positionZNormal >> 24);
+
+    if (nx == PACKED_NORMAL_MISSING && ny == PACKED_NORMAL_MISSING)
+        memset(vertex->normal, 0, sizeof(vertex->normal));
+    else
+        decodeOctahedral(nx, ny, vertex->normal);
+
+    vertex->texcoord[0] = decodeHalf(packed->texcoord & 0xffff);
+    vertex->texcoord[1] = decodeHalf(packed->texcoord >> 16);
+}
+
+// Bounding sphere around the centre of the meshlet's box, and the narrowest
+// cone around the average triangle normal; a view direction within
+// 90 degrees minus the cone's half angle of the axis sees only back faces
+static void computeMeshletBounds(Meshlet* meshlet, const Mesh* mesh, const uint32_t* vertices, const uint8_t* triangles)
+{
+    float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    for (uint32_t i = 0; i < meshlet->vertexCount; i++)
+    {
+        const float* p = mesh->vertices[vertices[i]].position;
+
+        for (int k = 0; k < 3; k++)
+        {
+            lo[k] = fminf(lo[k], p[k]);
+            hi[k] = fmaxf(hi[k], p[k]);
+        }
+    }
+
+    float radius = 0.f;
+
+    for (int k = 0; k < 3; k++)
+        meshlet->center[k] = (lo[k] + hi[k]) * 0.5f;
+
+    for (uint32_t i = 0; i < meshlet->vertexCount; i++)
+    {
+        const float* p = mesh->vertices[vertices[i]].position;
+
+        float dx = p[0] - meshlet->center[0];
+        float dy = p[1] - meshlet->center[1];
+        float dz = p[2] - meshlet->center[2];
+
+        radius = fmaxf(radius, dx * dx + dy * dy + dz * dz);
+    }
+
+    meshlet->radius = sqrtf(radius);
+
+    float normals[MESHLET_MAX_TRIANGLES][3];
+    float axis[3] = {0};
+    uint32_t normalCount = 0;
+
+    for (uint32_t t = 0; t < meshlet->triangleCount; t++)
+    {
+        const float* a = mesh->vertices[vertices[triangles[t * 3 + 0]]].position;
+        const float* b = mesh->vertices[vertices[triangles[t * 3 + 1]]].position;
+        const float* c = mesh->vertices[vertices[triangles[t * 3 + 2]]].position;
+
+        float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+
+        float* n = normals[normalCount];
+
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+        // Degenerate triangles are never rasterized
+        if (length == 0.f)
+            continue;
+
+        for (int k = 0; k < 3; k++)
+        {
+            n[k] /= length;
+            axis[k] += n[k];
+        }
+
+        normalCount++;
+    }
+
+    float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+
+    // A cutoff of 1 never culls
+    meshlet->coneAxis[0] = 0.f;
+    meshlet->coneAxis[1] = 0.f;
+    meshlet->coneAxis[2] = 1.f;
+    meshlet->coneCutoff = 1.f;
+
+    if (normalCount == 0 || length < 1e-6f)
+        return;
+
+    float minDot = 1.f;
+
+    for (int k = 0; k < 3; k++)
+        axis[k] /= length;
+
+    for (uint32_t i = 0; i < normalCount; i++)
+        minDot = fminf(minDot, axis[0] * normals[i][0] + axis[1] * normals[i][1] + axis[2] * normals[i][2]);
+
+    // Normals more than 90 degrees apart face every direction
+    if (minDot <= 0.f)
+        return;
+
+    for (int k = 0; k < 3; k++)
+        meshlet->coneAxis[k] = axis[k];
+
+    // sin of the half angle is the cos of its complement
+    meshlet->coneCutoff = sqrtf(1.f - minDot * minDot);
+}
+
+int buildMeshlets(Meshlets* meshlets, const Mesh* mesh, Arena* arena)
+{
+    *meshlets = (Meshlets){0};
+
+    size_t triangleCount = mesh->indexCount / 3;
+
+    if (triangleCount == 0)
+        return 0;
+
+    // Every meshlet holds at least one triangle and every corner adds at
+    // most one vertex; both streams are trimmed once the counts are known
+    size_t triangleBytes = (triangleCount * 3 + 3) & ~(size_t)3;
+
+    Meshlet* out = arenaAlloc(arena, triangleCount * sizeof(Meshlet));
+    uint32_t* vertices = arenaAlloc(arena, triangleCount * 3 * sizeof(uint32_t));
+    uint8_t* triangles = arenaAlloc(arena, triangleBytes);
+
+    // slots[v] is the vertex's place in the open meshlet, 0xff when absent
+    uint8_t* slots = malloc(mesh->vertexCount ? mesh->vertexCount : 1);
+
+    if (!out || !vertices || !triangles || !slots)
+    {
+        free(slots);
+        return 0;
+    }
+
+    memset(slots, 0xff, mesh->vertexCount);
+    memset(triangles, 0, triangleBytes);
+
+    size_t meshletCount = 0;
+    size_t vertexCount = 0;
+
+    for (size_t s = 0; s < mesh->submeshCount; s++)
+    {
+        const Submesh* submesh = &mesh->submeshes[s];
+
+        size_t first = submesh->offset / 3;
+        size_t last = first + submesh->count / 3;
+
+        // Submeshes never share meshlets, so one draw still maps to one material
+        Meshlet meshlet = { .vertexOffset = (uint32_t)vertexCount, .triangleOffset = (uint32_t)first };
+
+        for (size_t t = first; t <= last; t++)
+        {
+            const uint32_t* triangle = &mesh->indices[t * 3];
+
+            uint32_t extra = 0;
+
+            if (t < last)
+                for (int k = 0; k < 3; k++)
+                {
+                    uint32_t v = triangle[k];
+                    extra += slots[v] == 0xff && (k < 1 || triangle[0] != v) && (k < 2 || triangle[1] != v);
+                }
+
+            int full = meshlet.vertexCount + extra > MESHLET_MAX_VERTICES || meshlet.triangleCount == MESHLET_MAX_TRIANGLES;
+
+            if ((t == last || full) && meshlet.triangleCount)
+            {
+                computeMeshletBounds(&meshlet, mesh, &vertices[meshlet.vertexOffset], &triangles[meshlet.triangleOffset * 3]);
+                out[meshletCount++] = meshlet;
+
+                for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+                    slots[vertices[meshlet.vertexOffset + i]] = 0xff;
+
+                meshlet = (Meshlet){ .vertexOffset = (uint32_t)vertexCount, .triangleOffset = (uint32_t)t };
+            }
+
+            if (t == last)
+                break;
+
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t v = triangle[k];
+
+                if (slots[v] == 0xff)
+                {
+                    slots[v] = (uint8_t)meshlet.vertexCount++;
+                    vertices[vertexCount++] = v;
+                }
+
+                triangles[t * 3 + k] = slots[v];
+            }
+
+            meshlet.triangleCount++;
+        }
+    }
+
+    free(slots);
+
+    meshlets->meshlets = arenaRealloc(arena, out, meshletCount * sizeof(Meshlet));
+    meshlets->meshletCount = meshletCount;
+    meshlets->vertices = arenaRealloc(arena, vertices, vertexCount * sizeof(uint32_t));
+    meshlets->vertexCount = vertexCount;
+    meshlets->triangles = triangles;
+    meshlets->triangleCount = triangleCount;
+
+    return 1;
+}
+
+static void faceNormal(float n[3], const Vertex* vertices, const uint32_t* triangle)
+{
+    const float* p0 = vertices[triangle[0]].position;
+    const float* p1 = vertices[triangle[1]].position;
+    const float* p2 = vertices[triangle[2]].position;
+
+    float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static int missingNormal(const Vertex* v)
+{
+    return v->normal[0] == 0.f && v->normal[1] == 0.f && v->normal[2] == 0.f;
+}
+
+int splitCreases(Mesh* mesh, Arena* arena, float creaseAngle)
+{
+    size_t vertexCount = mesh->vertexCount;
+    size_t indexCount = mesh->indexCount / 3 * 3;
+
+    uint32_t* offsets = calloc(vertexCount + 1, sizeof(uint32_t));
+    uint32_t* corners = malloc(indexCount * sizeof(uint32_t));
+    uint32_t* remap = malloc(indexCount * sizeof(uint32_t));
+    uint32_t* sources = malloc(indexCount * sizeof(uint32_t));
+    float* clusters = malloc(indexCount * 3 * sizeof(float));
+    uint32_t* clusterVertices = malloc(indexCount * sizeof(uint32_t));
+
+    int ok = offsets && corners && remap && sources && clusters && clusterVertices;
+
+    size_t added = 0;
+
+    if (ok)
+    {
+        // Corners around every vertex that needs a normal
+        for (size_t i = 0; i < indexCount; i++)
+            if (missingNormal(&mesh->vertices[mesh->indices[i]]))
+                offsets[mesh->indices[i] + 1]++;
+
+        for (size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] += offsets[v];
+
+        for (size_t i = 0; i < indexCount; i++)
+        {
+            remap[i] = mesh->indices[i];
+
+            if (missingNormal(&mesh->vertices[mesh->indices[i]]))
+                corners[offsets[mesh->indices[i]]++] = (uint32_t)i;
+        }
+
+        float cosine = cosf(creaseAngle * (3.14159265f / 180.f));
+
+        // The fill left every offset at the end of its vertex's corners;
+        // each corner joins the first group whose summed normal is within
+        // the angle, and every group after the first gets a new vertex
+        for (size_t v = 0, begin = 0; v < vertexCount; begin = offsets[v++])
+        {
+            uint32_t clusterCount = 0;
+
+            for (size_t j = begin; j < offsets[v]; j++)
+            {
+                uint32_t corner = corners[j];
+
+                float n[3];
+                faceNormal(n, mesh->vertices, &mesh->indices[corner - corner % 3]);
+
+                float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+                // Degenerate faces add nothing to any normal
+                if (length == 0.f)
+                    continue;
+
+                uint32_t k = 0;
+
+                for (; k < clusterCount; k++)
+                {
+                    const float* c = &clusters[k * 3];
+                    float dot = (c[0] * n[0] + c[1] * n[1] + c[2] * n[2]) / length;
+
+                    if (dot >= cosine * sqrtf(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]))
+                        break;
+                }
+
+                if (k == clusterCount)
+                {
+                    memset(&clusters[k * 3], 0, 3 * sizeof(float));
+
+                    if (k == 0)
+                        clusterVertices[k] = (uint32_t)v;
+                    else
+                    {
+                        clusterVertices[k] = (uint32_t)(vertexCount + added);
+                        sources[added++] = (uint32_t)v;
+                    }
+
+                    clusterCount++;
+                }
+
+                for (int i = 0; i < 3; i++)
+                    clusters[k * 3 + i] += n[i] / length;
+
+                remap[corner] = clusterVertices[k];
+            }
+        }
+
+        ok = vertexCount + added <= UINT32_MAX;
+    }
+
+    Vertex* vertices = ok && added ? arenaAlloc(arena, (vertexCount + added) * sizeof(Vertex)) : mesh->vertices;
+
+    if (ok && vertices)
+    {
+        if (added)
+        {
+            memcpy(vertices, mesh->vertices, vertexCount * sizeof(Vertex));
+
+            for (size_t i = 0; i < added; i++)
+                vertices[vertexCount + i] = vertices[sources[i]];
+
+            memcpy(mesh->indices, remap, indexCount * sizeof(uint32_t));
+
+            mesh->vertices = vertices;
+            mesh->vertexCount = vertexCount + added;
+        }
+    }
+    else
+        ok = 0;
+
+    free(offsets);
+    free(corners);
+    free(remap);
+    free(sources);
+    free(clusters);
+    free(clusterVertices);
+
+    return ok;
+}
+
+// Angle at corner p of the triangle p, a, b
+static float cornerAngle(const float p[3], const float a[3], const float b[3])
+{
+    float e1[3] = { a[0] - p[0], a[1] - p[1], a[2] - p[2] };
+    float e2[3] = { b[0] - p[0], b[1] - p[1], b[2] - p[2] };
+
+    float l1 = sqrtf(e1[0] * e1[0] + e1[1] * e1[1] + e1[2] * e1[2]);
+    float l2 = sqrtf(e2[0] * e2[0] + e2[1] * e2[1] + e2[2] * e2[2]);
+
+    if (l1 == 0.f || l2 == 0.f)
+        return 0.f;
+
+    float dot = (e1[0] * e2[0] + e1[1] * e2[1] + e1[2] * e2[2]) / (l1 * l2);
+
+    return acosf(fminf(fmaxf(dot, -1.f), 1.f));
+}
+
+void computeNormals(float* normals, const Vertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount)
+{
+    memset(normals, 0, vertexCount * 3 * sizeof(float));
+
+    for (size_t i = 0; i + 3 <= indexCount; i += 3)
+    {
+        // Unnormalized, so the face's area is its weight
+        float n[3];
+        faceNormal(n, vertices, &indices[i]);
+
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = indices[i + k];
+
+            float angle = cornerAngle(vertices[v].position, vertices[indices[i + (k + 1) % 3]].position, vertices[indices[i + (k + 2) % 3]].position);
+
+            for (int j = 0; j < 3; j++)
+                normals[v * 3 + j] += n[j] * angle;
+        }
+    }
+
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        float* n = &normals[v * 3];
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+        if (length > 0.f)
+        {
+            n[0] /= length;
+            n[1] /= length;
+            n[2] /= length;
+        }
+        else
+        {
+            n[0] = n[1] = 0.f;
+            n[2] = 1.f;
+        }
+    }
+}
+
+// Simplification runs on positions scaled into the unit cube, which keeps the
+// quadrics well conditioned in single precision. Attributes are weighted so
+// their error adds to the positional error in those units.
+#define LOD_ATTRIBUTE_COUNT 5
+
+static const float lodNormalWeight = 0.5f;
+static const float lodTexcoordWeight = 0.5f;
+
+// Area weighted sum of squared distances to planes: p'Ap + 2b'p + c
+typedef struct
+{
+    float a00, a11, a22, a01, a02, a12;
+    float b0, b1, b2;
+    float c;
+    float w;
+} Quadric;
+
+// Area weighted gradient and offset of one attribute over a triangle's
+// plane, so the attribute interpolates as g'p + d
+typedef struct
+{
+    float gx, gy, gz, d;
+} AttributeGradient;
+
+typedef struct
+{
+    Quadric             position;
+    Quadric             attributes;     // the (g'p + d)^2 terms of every attribute
+    AttributeGradient   gradients[LOD_ATTRIBUTE_COUNT];
+} VertexQuadric;
+
+typedef struct
+{
+    float       cost;
+    uint32_t    vertex;
+} CollapseKey;
+
+static void addQuadric(Quadric* q, const float g[3], float d, float w)
+{
+    q->a00 += w * g[0] * g[0];
+    q->a11 += w * g[1] * g[1];
+    q->a22 += w * g[2] * g[2];
+    q->a01 += w * g[0] * g[1];
+    q->a02 += w * g[0] * g[2];
+    q->a12 += w * g[1] * g[2];
+    q->b0 += w * g[0] * d;
+    q->b1 += w * g[1] * d;
+    q->b2 += w * g[2] * d;
+    q->c += w * d * d;
+    q->w += w;
+}
+
+static void mergeQuadric(Quadric* q, const Quadric* r)
+{
+    q->a00 += r->a00;
+    q->a11 += r->a11;
+    q->a22 += r->a22;
+    q->a01 += r->a01;
+    q->a02 += r->a02;
+    q->a12 += r->a12;
+    q->b0 += r->b0;
+    q->b1 += r->b1;
+    q->b2 += r->b2;
+    q->c += r->c;
+    q->w += r->w;
+}
+
+static float evaluateQuadric(const Quadric* q, const float p[3])
+{
+    float x = p[0], y = p[1], z = p[2];
+
+    float r =
+        q->a00 * x * x + q->a11 * y * y + q->a22 * z * z +
+        2.f * (q->a01 * x * y + q->a02 * x * z + q->a12 * y * z) +
+        2.f * (q->b0 * x + q->b1 * y + q->b2 * z) + q->c;
+
+    return fmaxf(r, 0.f);
+}
+
+static int compareCollapseKeys(const void* a, const void* b)
+{
+    const CollapseKey* ka = a;
+    const CollapseKey* kb = b;
+
+    if (ka->cost != kb->cost)
+        return ka->cost < kb->cost ? -1 : 1;
+
+    return ka->vertex < kb->vertex ? -1 : ka->vertex > kb->vertex;
+}
+
+typedef struct
+{
+    uint32_t a, b;      // position classes, a < b
+    uint32_t forward;   // whether the triangle walks the edge from a to b
+} ClassEdge;
+
+static int compareClassEdges(const void* a, const void* b)
+{
+    const ClassEdge* ea = a;
+    const ClassEdge* eb = b;
+
+    if (ea->a != eb->a)
+        return ea->a < eb->a ? -1 : 1;
+
+    return ea->b < eb->b ? -1 : ea->b > eb->b;
+}
+
+// Groups vertices by identical position; classes[v] is the first vertex
+// with v's position
+static int classifyPositions(uint32_t* classes, const Mesh* mesh)
+{
+    size_t capacity = 1;
+    while (capacity < mesh->vertexCount * 2)
+        capacity *= 2;
+
+    uint32_t* table = malloc(capacity * sizeof(uint32_t));
+    if (!table)
+        return 0;
+
+    memset(table, 0xff, capacity * sizeof(uint32_t));
+
+    for (size_t v = 0; v < mesh->vertexCount; v++)
+    {
+        const float* p = mesh->vertices[v].position;
+
+        uint32_t bits[3];
+        memcpy(bits, p, sizeof(bits));
+
+        uint32_t h = (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        size_t slot = h & (capacity - 1);
+
+        while (table[slot] != ~0u && memcmp(mesh->vertices[table[slot]].position, p, sizeof(bits)) != 0)
+            slot = (slot + 1) & (capacity - 1);
+
+        if (table[slot] == ~0u)
+            table[slot] = (uint32_t)v;
+
+        classes[v] = table[slot];
+    }
+
+    free(table);
+
+    return 1;
+}
+
+// Locks vertices that share their position with another vertex (attribute
+// seams) and vertices on edges that are not shared by exactly two
+// consistently wound triangles (open borders and non-manifold edges)
+static int lockVertices(uint8_t* locked, const uint32_t* classes, const Mesh* mesh)
+{
+    size_t vertexCount = mesh->vertexCount;
+    size_t triangleCount = mesh->indexCount / 3;
+
+    uint32_t* members = calloc(vertexCount ? vertexCount : 1, sizeof(uint32_t));
+    ClassEdge* edges = malloc(triangleCount * 3 * sizeof(ClassEdge));
+
+    if (!members || !edges)
+    {
+        free(members);
+        free(edges);
+        return 0;
+    }
+
+    for (size_t v = 0; v < vertexCount; v++)
+        members[classes[v]]++;
+
+    size_t edgeCount = 0;
+
+    for (size_t i = 0; i < triangleCount * 3; i += 3)
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t a = classes[mesh->indices[i + k]];
+            uint32_t b = classes[mesh->indices[i + (k + 1) % 3]];
+
+            if (a != b)
+                edges[edgeCount++] = (ClassEdge){ a < b ? a : b, a < b ? b : a, a < b };
+        }
+
+    qsort(edges, edgeCount, sizeof(ClassEdge), compareClassEdges);
+
+    // members[] is reused to flag locked classes; seams have more than one member
+    for (size_t v = 0; v < vertexCount; v++)
+        if (classes[v] == v)
+            members[v] = members[v] > 1;
+
+    for (size_t i = 0; i < edgeCount;)
+    {
+        size_t j = i + 1;
+
+        while (j < edgeCount && edges[j].a == edges[i].a && edges[j].b == edges[i].b)
+            j++;
+
+        if (j - i != 2 || edges[i].forward == edges[i + 1].forward)
+            members[edges[i].a] = members[edges[i].b] = 1;
+
+        i = j;
+    }
+
+    for (size_t v = 0; v < vertexCount; v++)
+        locked[v] = (uint8_t)members[classes[v]];
+
+    free(members);
+    free(edges);
+
+    return 1;
+}
+
+static void vertexAttributes(float attributes[LOD_ATTRIBUTE_COUNT], const Vertex* v)
+{
+    attributes[0] = v->normal[0] * lodNormalWeight;
+    attributes[1] = v->normal[1] * lodNormalWeight;
+    attributes[2] = v->normal[2] * lodNormalWeight;
+    attributes[3] = v->texcoord[0] * lodTexcoordWeight;
+    attributes[4] = v->texcoord[1] * lodTexcoordWeight;
+}
+
+// Plane and attribute gradient quadrics of every triangle, weighted by area
+static void computeQuadrics(VertexQuadric* quadrics, const float* positions, const Mesh* mesh)
+{
+    for (size_t i = 0; i + 3 <= mesh->indexCount; i += 3)
+    {
+        const uint32_t* triangle = &mesh->indices[i];
+
+        const float* p0 = &positions[triangle[0] * 3];
+        const float* p1 = &positions[triangle[1] * 3];
+        const float* p2 = &positions[triangle[2] * 3];
+
+        float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+
+        float n[3] =
+        {
+            e1[1] * e2[2] - e1[2] * e2[1],
+            e1[2] * e2[0] - e1[0] * e2[2],
+            e1[0] * e2[1] - e1[1] * e2[0],
+        };
+
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+        if (length == 0.f)
+            continue;
+
+        for (int k = 0; k < 3; k++)
+            n[k] /= length;
+
+        float w = length * 0.5f;
+        float d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+
+        // The gradient g lies in the plane with g.e1 = s1 - s0 and g.e2 = s2 - s0
+        float a11 = e1[0] * e1[0] + e1[1] * e1[1] + e1[2] * e1[2];
+        float a12 = e1[0] * e2[0] + e1[1] * e2[1] + e1[2] * e2[2];
+        float a22 = e2[0] * e2[0] + e2[1] * e2[1] + e2[2] * e2[2];
+        float det = a11 * a22 - a12 * a12;
+
+        float s[3][LOD_ATTRIBUTE_COUNT];
+        for (int k = 0; k < 3; k++)
+            vertexAttributes(s[k], &mesh->vertices[triangle[k]]);
+
+        AttributeGradient gradients[LOD_ATTRIBUTE_COUNT] = {0};
+
+        if (det > 0.f)
+            for (int a = 0; a < LOD_ATTRIBUTE_COUNT; a++)
+            {
+                float ds1 = s[1][a] - s[0][a];
+                float ds2 = s[2][a] - s[0][a];
+
+                float x = (a22 * ds1 - a12 * ds2) / det;
+                float y = (a11 * ds2 - a12 * ds1) / det;
+
+                float g[3] = { x * e1[0] + y * e2[0], x * e1[1] + y * e2[1], x * e1[2] + y * e2[2] };
+
+                gradients[a] = (AttributeGradient){ g[0], g[1], g[2], s[0][a] - (g[0] * p0[0] + g[1] * p0[1] + g[2] * p0[2]) };
+            }
+
+        for (int k = 0; k < 3; k++)
+        {
+            VertexQuadric* q = &quadrics[triangle[k]];
+
+            addQuadric(&q->position, n, d, w);
+
+            for (int a = 0; a < LOD_ATTRIBUTE_COUNT; a++)
+            {
+                const AttributeGradient* g = &gradients[a];
+
+                addQuadric(&q->attributes, (const float[3]){ g->gx, g->gy, g->gz }, g->d, w);
+
+                q->gradients[a].gx += w * g->gx;
+                q->gradients[a].gy += w * g->gy;
+                q->gradients[a].gz += w * g->gz;
+                q->gradients[a].d += w * g->d;
+            }
+        }
+    }
+}
+
+// Error of moving vertex a onto vertex b, per unit of area, with the
+// attributes a ends up with being b's: sum of w (g'p + d - s)^2
+static float collapseCost(const VertexQuadric* q, const float* p, const float attributes[LOD_ATTRIBUTE_COUNT], float* positionError)
+{
+    float w = q->position.w > 0.f ? q->position.w : 1.f;
+
+    float error = evaluateQuadric(&q->attributes, p);
+    float weight = 0.f;
+
+    for (int a = 0; a < LOD_ATTRIBUTE_COUNT; a++)
+    {
+        const AttributeGradient* g = &q->gradients[a];
+
+        error -= 2.f * attributes[a] * (g->gx * p[0] + g->gy * p[1] + g->gz * p[2] + g->d);
+        weight += attributes[a] * attributes[a];
+    }
+
+    error += weight * q->attributes.w;
+
+    *positionError = evaluateQuadric(&q->position, p) / w;
+
+    return *positionError + fmaxf(error, 0.f) / w;
+}
+
+// Whether moving vertex a to position p keeps every triangle around it that
+// survives the collapse facing the same way
+static int collapseKeepsFacing(const uint32_t* indices, const uint32_t* triangles, uint32_t triangleCount, const uint32_t* classes, const float* positions, uint32_t a, uint32_t b)
+{
+    const float* target = &positions[b * 3];
+
+    for (uint32_t i = 0; i < triangleCount; i++)
+    {
+        const uint32_t* triangle = &indices[triangles[i] * 3];
+
+        int k = triangle[0] == a ? 0 : triangle[1] == a ? 1 : 2;
+
+        uint32_t v1 = triangle[(k + 1) % 3];
+        uint32_t v2 = triangle[(k + 2) % 3];
+
+        if (classes[v1] == classes[b] || classes[v2] == classes[b])
+            continue;
+
+        const float* p0 = &positions[a * 3];
+        const float* p1 = &positions[v1 * 3];
+        const float* p2 = &positions[v2 * 3];
+
+        float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        float f1[3] = { p1[0] - target[0], p1[1] - target[1], p1[2] - target[2] };
+        float f2[3] = { p2[0] - target[0], p2[1] - target[1], p2[2] - target[2] };
+
+        float n0[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        float n1[3] = { f1[1] * f2[2] - f1[2] * f2[1], f1[2] * f2[0] - f1[0] * f2[2], f1[0] * f2[1] - f1[1] * f2[0] };
+
+        if (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.f)
+            return 0;
+    }
+
+    return 1;
+}
+
+typedef struct
+{
+    float*          positions;
+    uint32_t*       classes;
+    uint8_t*        locked;
+    VertexQuadric*  quadrics;
+
+    uint32_t*       indices;        // working triangles
+    uint32_t*       collapses;      // where each vertex went, itself while it is alive
+    uint32_t*       offsets;        // vertex to triangle adjacency
+    uint32_t*       adjacency;
+    uint32_t*       targets;
+    float*          costs;
+    float*          errors;
+    CollapseKey*    keys;
+    uint8_t*        touched;
+} LodScratch;
+
+// One round of collapses: every movable vertex picks its cheapest edge, and
+// the cheaper half are applied in order as long as no two touch the same
+// triangles. Returns the new triangle count.
+static size_t collapseEdges(LodScratch* scratch, const Mesh* mesh, size_t triangleCount, size_t targetCount, float* maxError)
+{
+    size_t vertexCount = mesh->vertexCount;
+    uint32_t* indices = scratch->indices;
+
+    memset(scratch->offsets, 0, (vertexCount + 1) * sizeof(uint32_t));
+
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        scratch->offsets[indices[i] + 1]++;
+
+    for (size_t v = 0; v < vertexCount; v++)
+        scratch->offsets[v + 1] += scratch->offsets[v];
+
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        scratch->adjacency[scratch->offsets[indices[i]]++] = (uint32_t)(i / 3);
+
+    // The fill moved every offset to the end of its range
+    for (size_t v = vertexCount; v > 0; v--)
+        scratch->offsets[v] = scratch->offsets[v - 1];
+    scratch->offsets[0] = 0;
+
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        scratch->targets[v] = ~0u;
+        scratch->costs[v] = FLT_MAX;
+    }
+
+    for (size_t i = 0; i < triangleCount * 3; i++)
+    {
+        uint32_t a = indices[i];
+
+        if (scratch->locked[a])
+            continue;
+
+        for (int k = 1; k < 3; k++)
+        {
+            uint32_t b = indices[i / 3 * 3 + (i + k) % 3];
+
+            float attributes[LOD_ATTRIBUTE_COUNT];
+            vertexAttributes(attributes, &mesh->vertices[b]);
+
+            float positionError;
+            float cost = collapseCost(&scratch->quadrics[a], &scratch->positions[b * 3], attributes, &positionError);
+
+            if (cost < scratch->costs[a])
+            {
+                scratch->costs[a] = cost;
+                scratch->errors[a] = positionError;
+                scratch->targets[a] = b;
+            }
+        }
+    }
+
+    size_t keyCount = 0;
+
+    for (size_t v = 0; v < vertexCount; v++)
+        if (scratch->targets[v] != ~0u)
+            scratch->keys[keyCount++] = (CollapseKey){ scratch->costs[v], (uint32_t)v };
+
+    qsort(scratch->keys, keyCount, sizeof(CollapseKey), compareCollapseKeys);
+
+    memset(scratch->touched, 0, vertexCount);
+
+    size_t removed = 0;
+    size_t goal = triangleCount - targetCount;
+
+    for (size_t i = 0; i < (keyCount + 1) / 2 && removed < goal; i++)
+    {
+        uint32_t a = scratch->keys[i].vertex;
+        uint32_t b = scratch->targets[a];
+
+        if (scratch->touched[a] || scratch->collapses[b] != b)
+            continue;
+
+        const uint32_t* triangles = &scratch->adjacency[scratch->offsets[a]];
+        uint32_t count = scratch->offsets[a + 1] - scratch->offsets[a];
+
+        if (!collapseKeepsFacing(indices, triangles, count, scratch->classes, scratch->positions, a, b))
+            continue;
+
+        for (uint32_t t = 0; t < count; t++)
+        {
+            const uint32_t* triangle = &indices[triangles[t] * 3];
+
+            int degenerate = 0;
+
+            for (int k = 0; k < 3; k++)
+            {
+                scratch->touched[triangle[k]] = 1;
+                degenerate |= scratch->classes[triangle[k]] == scratch->classes[b];
+            }
+
+            removed += degenerate;
+        }
+
+        VertexQuadric* qa = &scratch->quadrics[a];
+        VertexQuadric* qb = &scratch->quadrics[b];
+
+        mergeQuadric(&qb->position, &qa->position);
+        mergeQuadric(&qb->attributes, &qa->attributes);
+
+        for (int k = 0; k < LOD_ATTRIBUTE_COUNT; k++)
+        {
+            qb->gradients[k].gx += qa->gradients[k].gx;
+            qb->gradients[k].gy += qa->gradients[k].gy;
+            qb->gradients[k].gz += qa->gradients[k].gz;
+            qb->gradients[k].d += qa->gradients[k].d;
+        }
+
+        scratch->collapses[a] = b;
+        *maxError = fmaxf(*maxError, scratch->errors[a]);
+    }
+
+    // Collapsed vertices were untouched when they moved, so their targets
+    // stayed put and one lookup resolves every corner
+    size_t written = 0;
+
+    for (size_t i = 0; i < triangleCount * 3; i += 3)
+    {
+        uint32_t v0 = scratch->collapses[indices[i + 0]];
+        uint32_t v1 = scratch->collapses[indices[i + 1]];
+        uint32_t v2 = scratch->collapses[indices[i + 2]];
+
+        uint32_t c0 = scratch->classes[v0];
+        uint32_t c1 = scratch->classes[v1];
+        uint32_t c2 = scratch->classes[v2];
+
+        if (c0 == c1 || c1 == c2 || c0 == c2)
+            continue;
+
+        indices[written++] = v0;
+        indices[written++] = v1;
+        indices[written++] = v2;
+    }
+
+    return written / 3;
+}
+
+int buildLods(MeshLods* lods, const Mesh* mesh, Arena* arena)
+{
+    *lods = (MeshLods){0};
+
+    size_t vertexCount = mesh->vertexCount;
+    size_t triangleCount = mesh->indexCount / 3;
+
+    if (triangleCount == 0)
+        return 0;
+
+    // Every LOD has at most half the triangles of the one before
+    uint32_t* out = arenaAlloc(arena, triangleCount * 3 * 2 * sizeof(uint32_t));
+    if (!out)
+        return 0;
+
+    LodScratch scratch =
+    {
+        .positions = malloc(vertexCount * 3 * sizeof(float)),
+        .classes = malloc(vertexCount * sizeof(uint32_t)),
+        .locked = malloc(vertexCount),
+        .quadrics = calloc(vertexCount, sizeof(VertexQuadric)),
+        .indices = malloc(triangleCount * 3 * sizeof(uint32_t)),
+        .collapses = malloc(vertexCount * sizeof(uint32_t)),
+        .offsets = malloc((vertexCount + 1) * sizeof(uint32_t)),
+        .adjacency = malloc(triangleCount * 3 * sizeof(uint32_t)),
+        .targets = malloc(vertexCount * sizeof(uint32_t)),
+        .costs = malloc(vertexCount * sizeof(float)),
+        .errors = malloc(vertexCount * sizeof(float)),
+        .keys = malloc(vertexCount * sizeof(CollapseKey)),
+        .touched = malloc(vertexCount),
+    };
+
+    int ok =
+        scratch.positions && scratch.classes && scratch.locked && scratch.quadrics &&
+        scratch.indices && scratch.collapses && scratch.offsets && scratch.adjacency &&
+        scratch.targets && scratch.costs && scratch.errors && scratch.keys && scratch.touched;
+
+    ok = ok && classifyPositions(scratch.classes, mesh) && lockVertices(scratch.locked, scratch.classes, mesh);
+
+    size_t written = 0;
+
+    if (ok)
+    {
+        float extent = 0.f;
+
+        for (int k = 0; k < 3; k++)
+            extent = fmaxf(extent, mesh->boundsMax[k] - mesh->boundsMin[k]);
+
+        float scale = extent > 0.f ? 1.f / extent : 0.f;
+
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            for (int k = 0; k < 3; k++)
+                scratch.positions[v * 3 + k] = (mesh->vertices[v].position[k] - mesh->boundsMin[k]) * scale;
+
+            scratch.collapses[v] = (uint32_t)v;
+        }
+
+        computeQuadrics(scratch.quadrics, scratch.positions, mesh);
+
+        memcpy(out, mesh->indices, triangleCount * 3 * sizeof(uint32_t));
+        memcpy(scratch.indices, mesh->indices, triangleCount * 3 * sizeof(uint32_t));
+
+        lods->lods[0] = (MeshLod){ 0, (uint32_t)(triangleCount * 3), 0.f };
+        lods->lodCount = 1;
+        written = triangleCount * 3;
+
+        size_t current = triangleCount;
+        float maxError = 0.f;
+
+        while (lods->lodCount < MESH_MAX_LODS && current / 2 >= MESH_LOD_MIN_TRIANGLES)
+        {
+            size_t target = lods->lods[lods->lodCount - 1].indexCount / 3 / 2;
+
+            size_t next = collapseEdges(&scratch, mesh, current, target, &maxError);
+
+            // Everything left is locked or would fold over
+            if (next == current)
+                break;
+
+            current = next;
+
+            if (current > target)
+                continue;
+
+            MeshLod* lod = &lods->lods[lods->lodCount++];
+
+            lod->indexOffset = (uint32_t)written;
+            lod->indexCount = (uint32_t)(current * 3);
+            lod->error = sqrtf(maxError) * extent;
+
+            memcpy(&out[written], scratch.indices, current * 3 * sizeof(uint32_t));
+            written += current * 3;
+        }
+
+        // The first LOD keeps the mesh's own order; the rest come out in
+        // collapse order, so they get the same cache optimisation
+        for (uint32_t i = 1; i < lods->lodCount && ok; i++)
+        {
+            Submesh whole = { 0, lods->lods[i].indexCount, 0 };
+
+            Mesh view =
+            {
+                .vertices = mesh->vertices,
+                .vertexCount = vertexCount,
+                .indices = &out[lods->lods[i].indexOffset],
+                .indexCount = lods->lods[i].indexCount,
+                .submeshes = &whole,
+                .submeshCount = 1,
+            };
+
+            ok = optimizeMesh(&view, MESH_VERTEX_CACHE_SIZE, 0.f);
+        }
+    }
+
+    free(scratch.positions);
+    free(scratch.classes);
+    free(scratch.locked);
+    free(scratch.quadrics);
+    free(scratch.indices);
+    free(scratch.collapses);
+    free(scratch.offsets);
+    free(scratch.adjacency);
+    free(scratch.targets);
+    free(scratch.costs);
+    free(scratch.errors);
+    free(scratch.keys);
+    free(scratch.touched);
+
+    if (!ok)
+    {
+        *lods = (MeshLods){0};
+        return 0;
+    }
+
+    lods->indices = arenaRealloc(arena, out, written * sizeof(uint32_t));
+    lods->indexCount = written;
+
+    return 1;
+}
+
+uint32_t selectLod(const MeshLods* lods, float pixelsPerUnit, float pixelThreshold)
+{
+    uint32_t lod = 0;
+
+    while (lod + 1 < lods->lodCount && lods->lods[lod + 1].error * pixelsPerUnit <= pixelThreshold)
+        lod++;
+
+    return lod;
+}
+
+// First triangle not yet in a strip with the directed edge a -> b in its
+// winding, searched in stream order among the triangles around a that come
+// before limit; writes its third vertex
+static uint32_t findStripTriangle(const uint32_t* indices, const uint32_t* offsets, const uint32_t* triangles, const uint8_t* emitted, size_t limit, uint32_t a, uint32_t b, uint32_t* third)
+{
+    for (uint32_t i = offsets[a]; i < offsets[a + 1]; i++)
+    {
+        uint32_t t = triangles[i];
+
+        if (t >= limit)
+            break;
+
+        if (emitted[t])
+            continue;
+
+        const uint32_t* triangle = &indices[t * 3];
+
+        for (int k = 0; k < 3; k++)
+            if (triangle[k] == a && triangle[(k + 1) % 3] == b)
+            {
+                *third = triangle[(k + 2) % 3];
+                return t;
+            }
+    }
+
+    return ~0u;
+}
+
+// Greedy strips without swaps: a strip grows across its last edge for as
+// long as the triangle there is free, winds the way the strip's parity needs
+// and lies within MESH_STRIP_WINDOW triangles of the first free one, so the
+// strips keep to the cache optimised order. The first free triangle then
+// starts a new strip after a restart index, rotated so it can grow where
+// possible. Returns the number of indices written, at most 4 per triangle.
+static size_t stripify(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t restartIndex, uint32_t* offsets, uint32_t* triangles, uint8_t* emitted)
+{
+    size_t triangleCount = indexCount / 3;
+
+    // Triangles around every vertex in stream order, offsets[v] to offsets[v + 1]
+    memset(offsets, 0, (vertexCount + 1) * sizeof(uint32_t));
+
+    for (size_t i = 0; i < indexCount; i++)
+        offsets[indices[i] + 1]++;
+
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] += offsets[v];
+
+    for (size_t i = 0; i < indexCount; i++)
+        triangles[offsets[indices[i]]++] = (uint32_t)(i / 3);
+
+    for (size_t v = vertexCount; v > 0; v--)
+        offsets[v] = offsets[v - 1];
+    offsets[0] = 0;
+
+    memset(emitted, 0, triangleCount);
+
+    size_t written = 0;
+    size_t next = 0;
+
+    for (;;)
+    {
+        while (next < triangleCount && emitted[next])
+            next++;
+
+        if (next == triangleCount)
+            break;
+
+        const uint32_t* triangle = &indices[next * 3];
+        emitted[next] = 1;
+
+        // Triangle 1 of a strip a, b, c, d winds c -> b -> d
+        int rotation = 0;
+
+        for (int r = 0; r < 3; r++)
+        {
+            uint32_t third;
+
+            if (findStripTriangle(indices, offsets, triangles, emitted, next + MESH_STRIP_WINDOW, triangle[(r + 2) % 3], triangle[(r + 1) % 3], &third) != ~0u)
+            {
+                rotation = r;
+                break;
+            }
+        }
+
+        if (written)
+            destination[written++] = restartIndex;
+
+        for (int k = 0; k < 3; k++)
+            destination[written++] = triangle[(rotation + k) % 3];
+
+        // Triangle i of the strip winds v[i] -> v[i + 1] when i is even and
+        // v[i + 1] -> v[i] when it is odd
+        uint32_t x = destination[written - 2];
+        uint32_t y = destination[written - 1];
+
+        for (size_t length = 1;; length++)
+        {
+            uint32_t third;
+            uint32_t t = (length & 1)
+                ? findStripTriangle(indices, offsets, triangles, emitted, next + MESH_STRIP_WINDOW, y, x, &third)
+                : findStripTriangle(indices, offsets, triangles, emitted, next + MESH_STRIP_WINDOW, x, y, &third);
+
+            if (t == ~0u)
+                break;
+
+            emitted[t] = 1;
+            destination[written++] = third;
+
+            while (next < triangleCount && emitted[next])
+                next++;
+
+            x = y;
+            y = third;
+        }
+    }
+
+    return written;
+}
+
+int buildStrips(MeshLods* strips, const MeshLods* lods, size_t vertexCount, uint32_t restartIndex, Arena* arena)
+{
+    *strips = (MeshLods){0};
+
+    if (lods->indexCount == 0)
+        return 0;
+
+    size_t maxIndexCount = 0;
+    for (uint32_t i = 0; i < lods->lodCount; i++)
+        maxIndexCount = lods->lods[i].indexCount > maxIndexCount ? lods->lods[i].indexCount : maxIndexCount;
+
+    // Trimmed once the strips are cut
+    uint32_t* out = arenaAlloc(arena, lods->indexCount / 3 * 4 * sizeof(uint32_t));
+
+    uint32_t* offsets = malloc((vertexCount + 1) * sizeof(uint32_t));
+    uint32_t* triangles = malloc(maxIndexCount * sizeof(uint32_t));
+    uint8_t* emitted = malloc(maxIndexCount / 3 + 1);
+
+    if (!out || !offsets || !triangles || !emitted)
+    {
+        free(offsets);
+        free(triangles);
+        free(emitted);
+        return 0;
+    }
+
+    size_t written = 0;
+
+    for (uint32_t i = 0; i < lods->lodCount; i++)
+    {
+        const MeshLod* lod = &lods->lods[i];
+
+        size_t count = stripify(&out[written], &lods->indices[lod->indexOffset], lod->indexCount, vertexCount, restartIndex, offsets, triangles, emitted);
+
+        strips->lods[i] = (MeshLod){ (uint32_t)written, (uint32_t)count, lod->error };
+        written += count;
+    }
+
+    free(offsets);
+    free(triangles);
+    free(emitted);
+
+    strips->lodCount = lods->lodCount;
+    strips->indices = arenaRealloc(arena, out, written * sizeof(uint32_t));
+    strips->indexCount = written;
+
+    return 1;
+}
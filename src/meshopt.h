@@ -0,0 +1,192 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mesh.h"
+
+// Post-transform cache modelled as a FIFO of this many vertices; small enough
+// to hold on any current GPU
+#define MESH_VERTEX_CACHE_SIZE 16
+
+// Vertex fetches go through a direct mapped cache of this many 64 byte lines
+#define MESH_VERTEX_FETCH_CACHE_LINES 256
+
+// How much ACMR may grow when clusters are split and reordered for overdraw
+#define MESH_OVERDRAW_THRESHOLD 1.05f
+
+// Meshlet limits: 64 vertices and 124 triangles fit the mesh shader output
+// limits of every implementation with room to spare
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// LOD chain: each level halves the triangle count of the one before, until
+// simplification stalls or the mesh is down to MESH_LOD_MIN_TRIANGLES
+#define MESH_MAX_LODS 8
+#define MESH_LOD_MIN_TRIANGLES 64
+
+// Strips only grow into triangles this far ahead of the first one not yet
+// stripped. Unlimited strips are longer but wander off the vertex cache
+// order; 32 keeps ACMR close to the list's.
+#define MESH_STRIP_WINDOW 32
+
+// Faces of OBJs without vn records meeting at more than this many degrees
+// keep separate vertices, so their generated normals leave a hard edge
+#define MESH_NORMAL_CREASE_ANGLE 60.f
+
+// Octahedral code of a missing normal in both snorm8 components; real
+// normals round to -127 at most
+#define PACKED_NORMAL_MISSING -128
+
+// 12 byte vertex decoded in trig.vert: positions as unorm16 within the mesh
+// bounds, the normal octahedral encoded in two snorm8 and texcoords as half
+// floats, packed into 32 bit words so no 16 bit storage support is needed
+typedef struct
+{
+    uint32_t positionXY;        // unorm16 x, y
+    uint32_t positionZNormal;   // unorm16 z, snorm8 octahedral normal x, y
+    uint32_t texcoord;          // half u, v
+} PackedVertex;
+
+// Position stream for passes that need nothing else, 8 bytes per vertex:
+// positions quantized exactly as in PackedVertex, with the top half of the
+// second word unused
+typedef struct
+{
+    uint32_t positionXY;        // unorm16 x, y
+    uint32_t positionZ;         // unorm16 z
+} PackedPosition;
+
+// Largest differences between decoded and float vertices
+typedef struct
+{
+    float position;     // per axis, in mesh units
+    float normal;       // in degrees
+    float texcoord;
+} PackedVertexError;
+
+typedef struct
+{
+    float acmr;     // vertices transformed per triangle: 3 without reuse, 0.5 at best
+    float atvr;     // vertices transformed per vertex: 1 at best
+} VertexCacheStatistics;
+
+typedef struct
+{
+    float overfetch;    // bytes fetched per byte of vertex data: 1 at best
+} VertexFetchStatistics;
+
+// Matches Meshlet in shaders/mesh.h. Meshlets keep their triangles in index
+// stream order, so triangleOffset * 3 is also the meshlet's first index.
+typedef struct
+{
+    float       center[3];      // bounding sphere, in mesh units
+    float       radius;
+    float       coneAxis[3];    // average facing of the triangles
+    float       coneCutoff;     // all triangles face away from view directions v with dot(v, coneAxis) > coneCutoff
+    uint32_t    vertexOffset;   // into Meshlets.vertices
+    uint32_t    triangleOffset; // into Meshlets.triangles, in triangles
+    uint32_t    vertexCount;
+    uint32_t    triangleCount;
+} Meshlet;
+
+typedef struct
+{
+    Meshlet*    meshlets;
+    size_t      meshletCount;
+
+    uint32_t*   vertices;       // mesh vertex of every meshlet vertex
+    size_t      vertexCount;
+
+    uint8_t*    triangles;      // 3 meshlet vertices per triangle, padded to whole 32 bit words
+    size_t      triangleCount;
+} Meshlets;
+
+typedef struct
+{
+    uint32_t    indexOffset;
+    uint32_t    indexCount;
+    float       error;      // estimated distance from the full mesh surface, in mesh units
+} MeshLod;
+
+typedef struct
+{
+    MeshLod     lods[MESH_MAX_LODS];    // LOD 0 is the full mesh
+    uint32_t    lodCount;
+
+    uint32_t*   indices;                // every LOD's triangles, LOD 0 first
+    size_t      indexCount;
+} MeshLods;
+
+// Replays the index stream through a FIFO cache of cacheSize vertices
+VertexCacheStatistics analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize);
+
+// Replays the index stream through the same FIFO; every vertex shaded reads
+// its vertexSize bytes through a small cache of 64 byte lines
+VertexFetchStatistics analyzeVertexFetch(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexSize, uint32_t cacheSize);
+
+// Encodes vertices for the packed decode path and measures the error of the
+// decoded result. Positions decode as boundsMin + unorm * (boundsMax - boundsMin).
+PackedVertexError packVertices(PackedVertex* packed, const Vertex* vertices, size_t count, const float boundsMin[3], const float boundsMax[3]);
+
+// Encodes the positions of vertices alone, matching packVertices bit for bit
+void packPositions(PackedPosition* positions, const Vertex* vertices, size_t count, const float boundsMin[3], const float boundsMax[3]);
+
+// Decodes one packed vertex the way trig.vert does; a missing normal decodes
+// as zero
+void unpackVertex(Vertex* vertex, const PackedVertex* packed, const float boundsMin[3], const float boundsMax[3]);
+
+// Reorders the triangles of every submesh in place for a FIFO cache of
+// cacheSize vertices (Tipsify). With an overdraw threshold above zero the
+// result is then split into clusters, allowing ACMR to grow by that factor,
+// and the clusters are drawn outside in so near surfaces tend to come first
+// from any direction. Returns 0 without changes if scratch memory runs out.
+int optimizeMesh(Mesh* mesh, uint32_t cacheSize, float overdrawThreshold);
+
+// Renumbers vertices in the order the index stream first uses them, so
+// fetches walk the vertex buffer forwards; unused vertices move to the end.
+// Vertices are permuted in place in linear time with 4 bytes of scratch per
+// vertex. Triangles are unchanged, so it runs last and can simply be run
+// again after any later index reordering. Returns 0 without changes if
+// scratch memory runs out.
+int optimizeVertexFetch(Mesh* mesh);
+
+// Splits every submesh into meshlets of at most MESHLET_MAX_VERTICES and
+// MESHLET_MAX_TRIANGLES, scanning the optimised index stream in order so the
+// meshlets inherit its locality and draw order. Each meshlet gets a bounding
+// sphere and a cone bounding its triangle normals for culling. Streams are
+// allocated from the arena; returns 0 if the mesh has no index stream or
+// memory runs out.
+int buildMeshlets(Meshlets* meshlets, const Mesh* mesh, Arena* arena);
+
+// Gives vertices without a normal (all zero) their own copy for each group
+// of triangles around them whose faces meet within creaseAngle degrees, so
+// smooth normals generated from the index stream keep hard edges. Vertices
+// are reallocated from the arena when any are added. Returns 0 without
+// changes if memory runs out.
+int splitCreases(Mesh* mesh, Arena* arena, float creaseAngle);
+
+// CPU reference for normals.comp: the normalized sum of the adjacent face
+// normals of every vertex, each weighted by the face's area and its angle at
+// the vertex. Vertices without a usable face get +z. Writes 3 floats per
+// vertex for all vertices, whether or not they have a normal.
+void computeNormals(float* normals, const Vertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount);
+
+// Simplifies the mesh into a LOD chain over its vertex stream with quadric
+// error metric edge collapses. Collapse cost includes normal and texcoord
+// error; vertices on open borders and attribute seams never move. LODs after
+// the first are reordered for the vertex cache. Streams are allocated from
+// the arena; returns 0 if the mesh has no index stream or memory runs out.
+int buildLods(MeshLods* lods, const Mesh* mesh, Arena* arena);
+
+// Coarsest LOD whose error stays within pixelThreshold pixels, given how many
+// pixels one mesh unit covers on screen
+uint32_t selectLod(const MeshLods* lods, float pixelsPerUnit, float pixelThreshold);
+
+// Cuts every LOD into triangle strips separated by restartIndex, for
+// topology VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP with primitive restart. Each
+// strip follows the optimised triangle order as far as adjacency allows and
+// keeps every triangle's winding. strips gets the same LODs and errors with
+// offsets and counts into its own index stream, allocated from the arena;
+// returns 0 if there are no indices or memory runs out.
+int buildStrips(MeshLods* strips, const MeshLods* lods, size_t vertexCount, uint32_t restartIndex, Arena* arena);
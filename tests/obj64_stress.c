@@ -0,0 +1,232 @@
+// Synthetic stress test for the OBJ loader past 32-bit limits; needs no GPU.
+// Writes two OBJs into the directory given as the first argument (default
+// the current one) and removes them afterwards:
+// - one larger than 4 GiB, with its faces past the 4 GiB offset, loaded
+//   through stdio, mapped and read-ahead paths
+// - one whose polygon fans triangulate to more than UINT32_MAX vertices,
+//   streamed through a ring that drops the batches; the 64-bit build
+//   (FAST_OBJ_64BIT) must load it exactly, the default build must refuse it
+#include "../src/fast_obj.h"
+#include "../src/mesh.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define makeDirectory(path) _mkdir(path)
+#define removeDirectory(path) _rmdir(path)
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define makeDirectory(path) mkdir(path, 0755)
+#define removeDirectory(path) rmdir(path)
+#endif
+
+// Comment bytes between the vertices and the faces of the large file
+#ifndef STRESS_PADDING_BYTES
+#define STRESS_PADDING_BYTES ((1ull << 32) + (64ull << 20))
+#endif
+
+// Corners per polygon of the fan file, and enough polygons to pass UINT32_MAX
+// output vertices
+#ifndef STRESS_FAN_CORNERS
+#define STRESS_FAN_CORNERS 1024ull
+#endif
+
+#ifndef STRESS_FAN_VERTICES
+#define STRESS_FAN_VERTICES ((1ull << 32) + (1ull << 20))
+#endif
+
+#define STRESS_FAN_FACES ((STRESS_FAN_VERTICES + 3 * (STRESS_FAN_CORNERS - 2) - 1) / (3 * (STRESS_FAN_CORNERS - 2)))
+
+static int failures;
+
+static void check(int condition, const char* what)
+{
+    printf("%s: %s\n", condition ? "ok" : "FAILED", what);
+
+    if (!condition)
+        failures++;
+}
+
+static const float tetrahedron[4][3] =
+{
+    { 0.f, 0.f, 0.f },
+    { 1.f, 0.f, 0.f },
+    { 0.f, 2.f, 0.f },
+    { 0.f, 0.f, 3.f },
+};
+
+static int writeLargeFile(const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return 0;
+
+    for (int i = 0; i < 4; i++)
+        fprintf(file, "v %g %g %g\n", tetrahedron[i][0], tetrahedron[i][1], tetrahedron[i][2]);
+
+    // 64 byte comment lines up to the padding size
+    static char block[1 << 20];
+    for (size_t i = 0; i < sizeof(block); i += 64)
+    {
+        memset(block + i, 'x', 63);
+        block[i] = '#';
+        block[i + 63] = '\n';
+    }
+
+    int ok = 1;
+
+    for (unsigned long long written = 0; ok && written < STRESS_PADDING_BYTES; written += sizeof(block))
+        ok = fwrite(block, 1, sizeof(block), file) == sizeof(block);
+
+    if (ok)
+        ok = fprintf(file, "f 1 3 2\nf 1 2 4\nf 1 4 3\nf 2 3 4\n") > 0;
+
+    return fclose(file) == 0 && ok;
+}
+
+static int writeFanFile(const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return 0;
+
+    fprintf(file, "v 0 0 0\nv 1 0 0\nv 0 1 0\n");
+
+    // "f 1 2 3 1 2 3 ...", two bytes per corner
+    static char face[2 * STRESS_FAN_CORNERS + 2];
+    face[0] = 'f';
+    for (unsigned long long i = 0; i < STRESS_FAN_CORNERS; i++)
+    {
+        face[1 + 2 * i] = ' ';
+        face[2 + 2 * i] = (char)('1' + i % 3);
+    }
+    face[sizeof(face) - 1] = '\n';
+
+    int ok = 1;
+
+    for (unsigned long long i = 0; ok && i < STRESS_FAN_FACES; i++)
+        ok = fwrite(face, 1, sizeof(face), file) == sizeof(face);
+
+    return fclose(file) == 0 && ok;
+}
+
+static int checkTetrahedron(const Mesh* mesh)
+{
+    if (mesh->vertexCount != 4 || mesh->indexCount != 12 || mesh->submeshCount != 1)
+        return 0;
+
+    for (int k = 0; k < 3; k++)
+        if (mesh->boundsMin[k] != 0.f || mesh->boundsMax[k] != tetrahedron[k + 1][k])
+            return 0;
+
+    return 1;
+}
+
+static void discardBatch(void* context, uint32_t slot, const Vertex* vertices, size_t count, size_t offset)
+{
+    (void) slot;
+    (void) vertices;
+    (void) offset;
+
+    *(unsigned long long*)context += count;
+}
+
+static void waitForBatch(void* context, uint32_t slot)
+{
+    (void) context;
+    (void) slot;
+}
+
+int main(int argc, char** argv)
+{
+    const char* directory = argc > 1 ? argv[1] : ".";
+
+    char largePath[1024];
+    char fanPath[1024];
+    char cacheBlocker[1040];
+
+    snprintf(largePath, sizeof(largePath), "%s/obj64_stress_large.obj", directory);
+    snprintf(fanPath, sizeof(fanPath), "%s/obj64_stress_fans.obj", directory);
+    snprintf(cacheBlocker, sizeof(cacheBlocker), "%s.streamcache.tmp", fanPath);
+
+    printf("fastObjUInt is %zu bytes, MeshUInt %zu bytes\n", sizeof(fastObjUInt), sizeof(MeshUInt));
+
+    Arena arena;
+    if (!arenaCreate(&arena, (size_t)1 << 32))
+    {
+        printf("FAILED: arena\n");
+        return 1;
+    }
+
+    FileQueue* io = fileQueueCreate(16);
+
+    // Faces past the 4 GiB offset, in every build
+    check(writeLargeFile(largePath), "write a file larger than 4 GiB");
+
+    fastObjMesh* obj = fast_obj_read(largePath);
+    check(obj && obj->position_count == 5 && obj->face_count == 4 && obj->index_count == 12, "fast_obj_read counts");
+
+    if (obj)
+        fast_obj_destroy(obj);
+
+    Mesh mesh;
+
+    check(loadObj(&mesh, &arena, largePath, 0) && checkTetrahedron(&mesh), "loadObj, mapped and parsed in parallel");
+    arenaReset(&arena);
+
+    check(io && loadObj(&mesh, &arena, largePath, io) && checkTetrahedron(&mesh), "loadObj, read ahead through the file queue");
+    arenaReset(&arena);
+
+    remove(largePath);
+
+    // More output vertices than 32 bits address; a directory where the cache
+    // would be written keeps streamMesh from writing over 100 GiB of it
+    check(writeFanFile(fanPath), "write a file of polygon fans");
+    makeDirectory(cacheBlocker);
+
+    static Vertex slots[4 * 4096];
+    unsigned long long streamed = 0;
+
+    StagingRing ring =
+    {
+        .vertices = slots,
+        .slotSize = 4096,
+        .slotCount = 4,
+        .upload = discardBatch,
+        .wait = waitForBatch,
+        .context = &streamed,
+    };
+
+    unsigned long long expected = STRESS_FAN_FACES * 3 * (STRESS_FAN_CORNERS - 2);
+    int loaded = streamMesh(&mesh, &arena, fanPath, &ring, 0);
+
+    if (MESH_UINT_MAX >= expected)
+    {
+        MeshUInt corners = 0;
+        for (size_t i = 0; loaded && i < mesh.submeshCount; i++)
+            corners += mesh.submeshes[i].count;
+
+        check(loaded && mesh.vertexCount == expected && streamed == expected && corners == expected, "streamMesh past UINT32_MAX vertices");
+    }
+    else
+    {
+        check(!loaded && mesh.vertexCount == 0, "streamMesh refuses meshes past MeshUInt");
+    }
+
+    arenaReset(&arena);
+
+    removeDirectory(cacheBlocker);
+    remove(fanPath);
+
+    if (io)
+        fileQueueDestroy(io);
+
+    arenaDestroy(&arena);
+
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures != 0;
+}
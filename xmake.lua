@@ -12,10 +12,37 @@ add_defines("_CRT_SECURE_NO_WARNINGS")
 add_requires("glfw", "vulkan-headers", "vulkan-loader")
 add_requires("glslang", {configs = {binaryonly = true}});
 
+option("obj64")
+    set_default(false)
+    set_showmenu(true)
+    set_description("64-bit counts and indices in the OBJ loader, for meshes past 4G elements")
+    add_defines("FAST_OBJ_64BIT")
+option_end()
+
 target("vulkan-renderer")
     set_kind("binary")
     add_files("src/**.c")
-    add_files("shaders/**.vert", "shaders/**.frag")
+    add_files("shaders/**.vert", "shaders/**.frag", "shaders/**.comp", "shaders/**.task", "shaders/**.mesh")
 
-    add_rules("utils.glsl2spv", {outputdir = "bin"})
+    -- Every shader is built for Vulkan 1.2 (SPIR-V 1.5), which the renderer
+    -- requires of the device anyway; mesh shaders need SPIR-V 1.4 at least
+    add_rules("utils.glsl2spv", {outputdir = "bin", targetenv = "vulkan1.2"})
     add_packages("glfw", "vulkan-headers", "vulkan-loader", "glslang")
+    add_options("obj64")
+
+    if is_plat("linux", "macosx") then
+        add_syslinks("pthread", "m")
+    end
+
+-- Loads OBJs past 4 GiB and past UINT32_MAX vertices without a GPU; writes
+-- about 7 GiB of temporary files into the directory given to it. Run with
+-- xmake run obj64-stress <dir>, in both the default and obj64 configurations.
+target("obj64-stress")
+    set_kind("binary")
+    set_default(false)
+    add_files("tests/obj64_stress.c", "src/arena.c", "src/fast_obj.c", "src/fileio.c", "src/mesh.c", "src/meshopt.c")
+    add_options("obj64")
+
+    if is_plat("linux", "macosx") then
+        add_syslinks("pthread", "m")
+    end